@@ -0,0 +1,22 @@
+// Analysis only: flags black frames and scene cuts as frame metadata (lavfi.mipp.* in
+// ffmpeg, `mipp_test --metadata` prints them) and leaves the pixels alone
+const black_luma = 16;   // mean luma at or below this is black
+const cut_psnr = 18;     // thumbnails this different from the previous one are a cut
+let previous;
+
+function receive_video_frame(frame, pad) {
+    const stats = frame.stats();
+    frame.setMetadata("luma_mean", stats.luma.mean.toFixed(2));
+    if (stats.luma.mean <= black_luma) {
+        frame.setMetadata("black", 1);
+    }
+
+    // Compare small thumbnails, cheap and insensitive to noise
+    const thumb = frame.thumbnail(64, 36);
+    if (previous && thumb.compare(previous).psnr < cut_psnr) {
+        frame.setMetadata("scene_cut", 1);
+    }
+    previous = thumb;
+
+    send_video_frame(frame);
+}
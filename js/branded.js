@@ -0,0 +1,13 @@
+// Two outputs from one input: out0 gets a bug, out1 stays clean.
+// For an ABR ladder add renditions=1280x720|640x360 to the filter: out2 and out3 are
+// out0 scaled natively, the script still runs once per frame.
+make_pads(1, 2);
+
+function receive_video_frame(frame, pad) {
+    send_video_frame(new VideoFrame(frame.width, frame.height, frame.pts, frame), 1);
+
+    frame.font = "48px Arial";
+    frame.fillStyle = "white";
+    frame.fillText("LIVE", frame.width - 160, 80);
+    send_video_frame(frame, 0);
+}
@@ -101,7 +101,8 @@ function clock(time) {
 
 
 function receive_video_frame(frame, pad) {
-    c = clock(frame.pts)
+    // Keyed on the pts the face is drawn at, so a rerun of the same video renders nothing
+    c = cached("clock:" + frame.pts, () => clock(frame.pts))
 
     frame.font = "100px Arial";
     frame.fillStyle = "#00000080";
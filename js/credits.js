@@ -1,34 +1,19 @@
-function fade_credit(frame, text, start_time, duration, fade_duration) {
-    if (frame.pts < start_time) {
-        return;
-    }
-    if (frame.pts > start_time + duration) {
-        return;
-    }
-    if (fade_duration === undefined || fade_duration > duration / 2) {
-        fade_duration = duration / 2;
-    }
-
-    let alpha = (frame.pts - start_time) / fade_duration;
-    // More that half way through the fade, start fading out
-    if (frame.pts > start_time + duration - fade_duration) {
-        alpha = 1 - (frame.pts - (start_time + duration - fade_duration)) / fade_duration;
-    }
-    if (alpha > 1) {
-        alpha = 1;
-    }
-
-    frame.font = "100px Arial";
-    frame.setStrokeStyle(255, 255, 255, 255 * alpha);
-    frame.moveTo(200, 200);
-    frame.strokeText(text);
-    frame.globalAlpha = 1;
+// Opening credits on the timeline, mipp draws and fades them natively and frames
+// between credits go straight through without calling into the script
+function credit(text, start_time, duration, fade_duration) {
+    timeline_add({
+        start: start_time,
+        duration: duration,
+        fade_in: fade_duration,
+        fade_out: fade_duration,
+        text: text,
+        font: "100px Arial",
+        fill: "white",
+        x: 200,
+        y: 200,
+    });
 }
 
-
-function receive_video_frame(frame, pad) {
-    fade_credit(frame, "Mipp Presents", 2, 5, 1);
-    fade_credit(frame, "In association with Mipp", 8, 5, 1);
-    fade_credit(frame, "A Mipp film", 14, 5, 1);
-    send_video_frame(frame);
-}
+credit("Mipp Presents", 2, 5, 1);
+credit("In association with Mipp", 8, 5, 1);
+credit("A Mipp film", 14, 5, 1);
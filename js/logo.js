@@ -0,0 +1,11 @@
+// Corner bug from a still image, no second input needed.
+// loadImage decodes logo.png once, later runs (and other filters in the process) reuse it
+const logo = loadImage("logo.png");
+const margin = 40;
+
+function receive_video_frame(frame, pad) {
+    const w = frame.width / 8;
+    const h = w * logo.height / logo.width;
+    frame.draw(logo, frame.width - w - margin, margin, w, h);
+    send_video_frame(frame);
+}
@@ -0,0 +1,19 @@
+// Works on the lower third only: a view aliases those rows of the frame, so the band is
+// darkened and written on in place without copying it out and back
+function receive_video_frame(frame, pad) {
+    const h = Math.floor(frame.height / 3);
+    const band = frame.view(0, frame.height - h, frame.width, h);
+
+    // Pixel access through the view's data goes row by row with its stride
+    for (let y = 0; y < band.height; y++) {
+        const row = y * band.stride;
+        for (let x = 0; x < band.width; x++) {
+            const p = band.data[row + x];
+            band.data[row + x] = (p & 0xff000000) | ((p >>> 1) & 0x7f7f7f);
+        }
+    }
+    band.font = "64px Arial";
+    band.fillStyle = "white";
+    band.fillText("Mipp News", 60, h / 2);
+    send_video_frame(frame);
+}
@@ -0,0 +1,19 @@
+// Frame differencing against the input a few frames back, with no copies kept by the
+// script: history() hands out the frames mipp already holds
+const lag = 3;           // frames between the two compared
+const still_psnr = 40;   // above this nothing moved
+keep_history(lag + 1);
+
+function receive_video_frame(frame, pad) {
+    const past = history(pad, lag);
+    if (past) {
+        const diff = frame.compare(past);
+        frame.setMetadata("motion_mse", diff.mse.toFixed(2));
+        if (diff.psnr < still_psnr) {
+            frame.font = "48px Arial";
+            frame.fillStyle = "red";
+            frame.fillText("MOTION", 40, 80);
+        }
+    }
+    send_video_frame(frame);
+}
@@ -1,6 +1,6 @@
 
 function receive_video_frame(frame, pad) {
-    log('JS received video frame: ' + frame.width + 'x' + frame.height)
+    log('JS received video frame', { width: frame.width, height: frame.height, pts: frame.pts })
     send_video_frame(frame, 0)
 }
 
@@ -0,0 +1,11 @@
+// Picture in picture from two inputs. With receive_video_frames both inputs' frames of
+// an event arrive in one call, so there's no need to hold on to the overlay between calls.
+make_pads(2)
+
+function receive_video_frames(frames, pads) {
+    let main = frames[pads.indexOf(0)];
+    let inset = frames[pads.indexOf(1)];
+    let [w, h] = [main.width / 4, main.height / 4];
+    main.draw(inset, main.width - w - 40, 40, w, h)
+    send_video_frame(main);
+}
@@ -0,0 +1,16 @@
+// Warhol style quad split, evaluated natively by frame.shade
+const warhol = `
+    sx = (x * 2) % width; sy = (y * 2) % height
+    q = (x >= width / 2) + (y >= height / 2) * 2
+    r = sample_r(0, sx, sy) * (q == 0 || q == 1)
+    g = sample_g(0, sx, sy) * (q == 0 || q == 2)
+    b = sample_b(0, sx, sy) * (q == 0 || q == 3)
+    a = 1
+`;
+
+function receive_video_frame(frame) {
+    var out = new VideoFrame(frame.width, frame.height, frame.pts)
+    out.shade(warhol, {}, [frame])
+    out.shade("r = r * gain; g = g * gain; b = b * gain", { gain: 1.1 })
+    send_video_frame(out)
+}
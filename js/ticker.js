@@ -0,0 +1,24 @@
+// A news ticker that only depends on pts, rendered a few frames ahead on a spare core:
+// receive_video_frame just draws the finished strip
+const width = 1920, height = 80;
+const text = "Mipp News  •  Markets steady  •  Weather: clear skies  •  ";
+const speed = 240; // pixels per second
+prerender(8);
+
+// Runs in a separate copy of this script, it can't see anything receive_video_frame sets
+function render_overlay(pts) {
+    const strip = new VideoFrame(width, height, pts);
+    strip.fillStyle = "#000000c0";
+    strip.fillRect(0, 0, width, height);
+    strip.font = "48px Arial";
+    strip.fillStyle = "white";
+    const offset = (pts * speed) % 2400;
+    strip.fillText(text, width - offset, 58);
+    strip.fillText(text, width - offset + 2400, 58);
+    return strip;
+}
+
+function receive_video_frame(frame, pad) {
+    frame.draw(overlay(frame.pts), 0, frame.height - height, width, height);
+    send_video_frame(frame);
+}
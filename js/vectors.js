@@ -0,0 +1,31 @@
+// Draws the decoder's motion vectors, no pixels are read. Decode with motion vectors
+// exported, e.g. ffmpeg -flags2 +export_mvs -i in.mp4 -vf mipp=script=js/vectors.js ...
+const record = 40;       // sizeof(AVMotionVector)
+const min_length = 2;    // pixels, shorter vectors are left out
+
+function receive_video_frame(frame, pad) {
+    const mvs = frame.sideData.motionVectors;
+    if (mvs) {
+        // Views over the decoder's own buffer, only valid during this call
+        const i16 = new Int16Array(mvs.buffer, mvs.byteOffset, mvs.byteLength >> 1);
+        const i32 = new Int32Array(mvs.buffer, mvs.byteOffset, mvs.byteLength >> 2);
+        let moving = 0;
+        frame.lineWidth = 1;
+        frame.beginPath();
+        for (let i = 0; i < mvs.byteLength / record; i++) {
+            const forward = i32[i * record / 4] > 0;
+            const sx = i16[i * record / 2 + 3], sy = i16[i * record / 2 + 4];
+            const dx = i16[i * record / 2 + 5], dy = i16[i * record / 2 + 6];
+            if (Math.abs(dx - sx) + Math.abs(dy - sy) < min_length || forward) {
+                continue;
+            }
+            frame.moveTo(sx, sy);
+            frame.lineTo(dx, dy);
+            moving++;
+        }
+        frame.strokeStyle = "yellow";
+        frame.stroke();
+        frame.setMetadata("moving_blocks", moving.toString());
+    }
+    send_video_frame(frame);
+}
@@ -0,0 +1,14 @@
+// Runs a wasm kernel directly on frame memory, no copies in or out of the wasm heap.
+// invert.wasm imports its memory as env.memory and exports invert(ptr, pixels), e.g. from
+//   void invert(uint32_t *p, int n) { for (int i = 0; i < n; i++) p[i] ^= 0x00ffffff; }
+// built with `clang --target=wasm32 -O3 -msimd128 -nostdlib -Wl,--no-entry -Wl,--export=invert -Wl,--import-memory`
+const memory = new WebAssembly.Memory({ initial: 256 }); // 16MB, room for one 1080p frame
+const kernels = new WebAssembly.Instance(loadWasm("invert.wasm"), { env: { memory } });
+
+// Every input frame is written at offset 0 of the wasm memory
+set_frame_memory(memory, (pad, byteLength) => 0);
+
+function receive_video_frame(frame, pad) {
+    kernels.exports.invert(frame.data.byteOffset, frame.width * frame.height);
+    send_video_frame(frame);
+}
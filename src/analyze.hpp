@@ -0,0 +1,288 @@
+// Copyright 2024 Mux, Inc.
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include "cairo.hpp"
+#include "kernels.hpp"
+#include "threadpool.hpp"
+
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+// Reductions over a frame, or a region of it, for scripts that decide from content:
+// histograms, mean and variance, differences between frames and thumbnails.
+//
+// Every row is first split into 8 bit R, G, B and BT.709 luma arrays (float surfaces are
+// quantized), the reductions are then plain loops over those the compiler vectorizes,
+// and rows are split across the thread pool. Results are in 8 bit code values.
+namespace analyze
+{
+    enum Channel
+    {
+        LUMA = 0,
+        RED,
+        GREEN,
+        BLUE,
+    };
+
+    struct Region
+    {
+        int x = 0, y = 0, width = 0, height = 0;
+
+        // Clipped to the surface, empty when entirely outside
+        Region clip(int w, int h) const
+        {
+            Region r;
+            r.x = std::max(0, x);
+            r.y = std::max(0, y);
+            r.width = std::max(0, std::min(x + width, w) - r.x);
+            r.height = std::max(0, std::min(y + height, h) - r.y);
+            return r;
+        }
+    };
+
+    // One row of a region split into channels
+    struct Row
+    {
+        std::vector<uint8_t> c[4]; // indexed by Channel
+
+        explicit Row(int width)
+        {
+            for (auto &v : c)
+            {
+                v.resize(width);
+            }
+        }
+
+        void load(const cairo &surface, const Region &r, int y)
+        {
+            auto n = r.width;
+            uint8_t *R = c[RED].data(), *G = c[GREEN].data(), *B = c[BLUE].data(), *L = c[LUMA].data();
+            if (surface.is_float())
+            {
+                auto p = reinterpret_cast<const float *>(surface.data() + static_cast<size_t>(r.y + y) * surface.stride()) + r.x * 4;
+                for (int i = 0; i < n; i++)
+                {
+                    R[i] = kernels::to_u8(p[i * 4 + 0]);
+                    G[i] = kernels::to_u8(p[i * 4 + 1]);
+                    B[i] = kernels::to_u8(p[i * 4 + 2]);
+                }
+            }
+            else
+            {
+                auto p = reinterpret_cast<const uint32_t *>(surface.data() + static_cast<size_t>(r.y + y) * surface.stride()) + r.x;
+                for (int i = 0; i < n; i++)
+                {
+                    R[i] = p[i] >> 16;
+                    G[i] = p[i] >> 8;
+                    B[i] = p[i];
+                }
+            }
+            // BT.709 with weights summing to 256
+            for (int i = 0; i < n; i++)
+            {
+                L[i] = (54 * R[i] + 183 * G[i] + 19 * B[i]) >> 8;
+            }
+        }
+    };
+
+    static std::array<uint32_t, 256> histogram(const cairo &surface, Region r, Channel channel)
+    {
+        std::array<uint32_t, 256> total = {};
+        std::mutex m;
+        parallel_rows(r.height, [&](int y0, int y1)
+                      {
+                          // Four sub histograms so runs of equal values don't serialize on one counter
+                          std::vector<uint32_t> h(4 * 256);
+                          Row row(r.width);
+                          for (int y = y0; y < y1; y++)
+                          {
+                              row.load(surface, r, y);
+                              auto v = row.c[channel].data();
+                              int i = 0;
+                              for (; i + 4 <= r.width; i += 4)
+                              {
+                                  h[v[i]]++;
+                                  h[256 + v[i + 1]]++;
+                                  h[512 + v[i + 2]]++;
+                                  h[768 + v[i + 3]]++;
+                              }
+                              for (; i < r.width; i++)
+                              {
+                                  h[v[i]]++;
+                              }
+                          }
+                          std::lock_guard<std::mutex> lock(m);
+                          for (int i = 0; i < 256; i++)
+                          {
+                              total[i] += h[i] + h[256 + i] + h[512 + i] + h[768 + i];
+                          }
+                      });
+        return total;
+    }
+
+    struct Moments
+    {
+        double mean[4] = {};     // indexed by Channel
+        double variance[4] = {}; // of the population
+    };
+
+    static Moments moments(const cairo &surface, Region r)
+    {
+        uint64_t sum[4] = {}, sum_sq[4] = {};
+        std::mutex m;
+        parallel_rows(r.height, [&](int y0, int y1)
+                      {
+                          uint64_t s[4] = {}, sq[4] = {};
+                          Row row(r.width);
+                          for (int y = y0; y < y1; y++)
+                          {
+                              row.load(surface, r, y);
+                              for (int c = 0; c < 4; c++)
+                              {
+                                  // Fits 32 bits for rows up to 66k pixels
+                                  uint32_t rs = 0, rsq = 0;
+                                  auto v = row.c[c].data();
+                                  for (int i = 0; i < r.width; i++)
+                                  {
+                                      rs += v[i];
+                                      rsq += v[i] * v[i];
+                                  }
+                                  s[c] += rs;
+                                  sq[c] += rsq;
+                              }
+                          }
+                          std::lock_guard<std::mutex> lock(m);
+                          for (int c = 0; c < 4; c++)
+                          {
+                              sum[c] += s[c];
+                              sum_sq[c] += sq[c];
+                          }
+                      });
+
+        Moments out;
+        auto n = static_cast<double>(r.width) * r.height;
+        for (int c = 0; n > 0 && c < 4; c++)
+        {
+            out.mean[c] = sum[c] / n;
+            out.variance[c] = std::max(0.0, sum_sq[c] / n - out.mean[c] * out.mean[c]);
+        }
+        return out;
+    }
+
+    struct Difference
+    {
+        uint64_t sad = 0; // sum of absolute differences over R, G and B
+        double mse = 0;   // per sample
+        double psnr = INFINITY;
+    };
+
+    // `r` is in both surfaces' coordinates, callers clip it to both
+    static Difference compare(const cairo &a, const cairo &b, Region r)
+    {
+        uint64_t sad = 0, sse = 0;
+        std::mutex m;
+        parallel_rows(r.height, [&](int y0, int y1)
+                      {
+                          uint64_t s = 0, sq = 0;
+                          Row ra(r.width), rb(r.width);
+                          for (int y = y0; y < y1; y++)
+                          {
+                              ra.load(a, r, y);
+                              rb.load(b, r, y);
+                              for (int c = RED; c <= BLUE; c++)
+                              {
+                                  uint32_t rs = 0, rsq = 0;
+                                  auto va = ra.c[c].data(), vb = rb.c[c].data();
+                                  for (int i = 0; i < r.width; i++)
+                                  {
+                                      int d = va[i] - vb[i];
+                                      rs += d < 0 ? -d : d;
+                                      rsq += d * d;
+                                  }
+                                  s += rs;
+                                  sq += rsq;
+                              }
+                          }
+                          std::lock_guard<std::mutex> lock(m);
+                          sad += s;
+                          sse += sq;
+                      });
+
+        Difference out;
+        auto n = 3.0 * r.width * r.height;
+        out.sad = sad;
+        out.mse = n > 0 ? sse / n : 0;
+        if (out.mse > 0)
+        {
+            out.psnr = 10 * std::log10(255.0 * 255.0 / out.mse);
+        }
+        return out;
+    }
+
+    // Box filtered downscale of region `r` into `dst`, opaque ARGB32 of width x height
+    static void thumbnail(const cairo &surface, Region r, uint32_t *dst, int width, int height)
+    {
+        parallel_rows(height, [&](int ty0, int ty1)
+                      {
+                          Row row(r.width);
+                          std::vector<uint32_t> acc[3];
+                          for (auto &v : acc)
+                          {
+                              v.resize(width);
+                          }
+                          for (int ty = ty0; ty < ty1; ty++)
+                          {
+                              // Source rows [sy0, sy1) and columns [x0(tx), x0(tx + 1)) land in (tx, ty)
+                              auto sy0 = static_cast<int>(static_cast<int64_t>(ty) * r.height / height);
+                              auto sy1 = std::max(sy0 + 1, static_cast<int>(static_cast<int64_t>(ty + 1) * r.height / height));
+                              for (auto &v : acc)
+                              {
+                                  std::fill(v.begin(), v.end(), 0);
+                              }
+                              for (int y = sy0; y < sy1; y++)
+                              {
+                                  row.load(surface, r, y);
+                                  for (int tx = 0; tx < width; tx++)
+                                  {
+                                      auto x0 = static_cast<int>(static_cast<int64_t>(tx) * r.width / width);
+                                      auto x1 = std::max(x0 + 1, static_cast<int>(static_cast<int64_t>(tx + 1) * r.width / width));
+                                      for (int c = 0; c < 3; c++)
+                                      {
+                                          uint32_t s = 0;
+                                          auto v = row.c[RED + c].data();
+                                          for (int x = x0; x < x1; x++)
+                                          {
+                                              s += v[x];
+                                          }
+                                          acc[c][tx] += s;
+                                      }
+                                  }
+                              }
+                              auto out = dst + static_cast<size_t>(ty) * width;
+                              for (int tx = 0; tx < width; tx++)
+                              {
+                                  auto x0 = static_cast<int>(static_cast<int64_t>(tx) * r.width / width);
+                                  auto x1 = std::max(x0 + 1, static_cast<int>(static_cast<int64_t>(tx + 1) * r.width / width));
+                                  auto n = static_cast<uint32_t>((x1 - x0) * (sy1 - sy0));
+                                  out[tx] = 0xff000000u | (acc[0][tx] + n / 2) / n << 16 | (acc[1][tx] + n / 2) / n << 8 | (acc[2][tx] + n / 2) / n;
+                              }
+                          }
+                      });
+    }
+} // namespace
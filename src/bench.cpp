@@ -0,0 +1,331 @@
+// Copyright 2024 Mux, Inc.
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cairo.hpp"
+#include "client.hpp"
+#include "kernels.hpp"
+#include "threadpool.hpp"
+
+#include <chrono>
+#include <functional>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+#ifdef MIPP_HAVE_SWSCALE
+extern "C"
+{
+#include <libswscale/swscale.h>
+}
+#endif
+
+// Average wall time of fn() in milliseconds
+static double bench(int iterations, const std::function<void()> &fn)
+{
+    fn(); // warm up caches and the thread pool
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++)
+    {
+        fn();
+    }
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count() / iterations;
+}
+
+static void report(const char *name, int w, int h, double ms)
+{
+    fprintf(stderr, "%-34s %4dx%-4d %8.3f ms %8.1f fps\n", name, w, h, ms, 1000.0 / ms);
+}
+
+static void bench_formats(int w, int h, int iterations)
+{
+    // Big enough for any of the supported formats
+    std::vector<uint8_t> host(static_cast<size_t>(w) * h * 8 + 64, 0x40);
+    std::vector<uint8_t> surface(static_cast<size_t>(w) * h * 16);
+    std::vector<uint8_t> out(static_cast<size_t>(w) * h * 8);
+    int float_stride = w * 16;
+
+    struct
+    {
+        const char *name;
+        int format;
+        int strides[3];
+        size_t offsets[3];
+    } inputs[] = {
+        {"unpack rgba64 -> rgba128f", MIPP_PIX_FMT_RGBA64, {w * 8}, {0}},
+        {"unpack rgb48 -> rgba128f", MIPP_PIX_FMT_RGB48, {w * 6}, {0}},
+        {"unpack yuv420p10 -> rgba128f", MIPP_PIX_FMT_YUV420P10, {w * 2, w, w}, {0, size_t(w) * h * 2, size_t(w) * h * 2 + size_t(w) * h / 2}},
+        {"unpack p010 -> rgba128f", MIPP_PIX_FMT_P010, {w * 2, w * 2}, {0, size_t(w) * h * 2}},
+    };
+
+    for (auto &in : inputs)
+    {
+        uint8_t *planes[3] = {host.data() + in.offsets[0], host.data() + in.offsets[1], host.data() + in.offsets[2]};
+        report(in.name, w, h, bench(iterations, [&]
+                                    { parallel_rows(h, [&](int y0, int y1)
+                                                    { kernels::unpack(in.format, planes, in.strides, surface.data(), float_stride, w, y0, y1); }); }));
+    }
+
+    struct
+    {
+        const char *name;
+        bool high_bit_depth;
+        int format;
+    } outputs[] = {
+        {"pack rgba128f -> rgba64", true, MIPP_PIX_FMT_RGBA64},
+        {"pack rgba128f -> rgb48", true, MIPP_PIX_FMT_RGB48},
+        {"pack rgba128f -> rgb32", true, MIPP_PIX_FMT_RGB32},
+        {"pack rgb32 -> rgba64", false, MIPP_PIX_FMT_RGBA64},
+    };
+
+    for (auto &o : outputs)
+    {
+        auto src_stride = o.high_bit_depth ? float_stride : w * 4;
+        auto dst_stride = w * kernels::bytes_per_pixel(o.format);
+        report(o.name, w, h, bench(iterations, [&]
+                                   { parallel_rows(h, [&](int y0, int y1)
+                                                   { kernels::pack(o.high_bit_depth, surface.data(), src_stride, o.format, out.data(), dst_stride, w, y0, y1); }); }));
+    }
+
+    // The same conversion through mipp's float surface and through swscale, 10 bit video
+    // to the 16 bit RGB a filter graph would otherwise scale it to
+    uint8_t *p010[2] = {host.data(), host.data() + size_t(w) * h * 2};
+    int p010_strides[2] = {w * 2, w * 2};
+    report("mipp p010 -> rgba128f -> rgba64", w, h, bench(iterations, [&]
+                                                          { parallel_rows(h, [&](int y0, int y1)
+                                                                          {
+                                                                              kernels::unpack(MIPP_PIX_FMT_P010, p010, p010_strides, surface.data(), float_stride, w, y0, y1);
+                                                                              kernels::pack(true, surface.data(), float_stride, MIPP_PIX_FMT_RGBA64, out.data(), w * 8, w, y0, y1); }); }));
+
+#ifdef MIPP_HAVE_SWSCALE
+    auto to_rgba64 = sws_getContext(w, h, AV_PIX_FMT_P010LE, w, h, AV_PIX_FMT_RGBA64LE, SWS_POINT, nullptr, nullptr, nullptr);
+    uint8_t *rgba64[1] = {out.data()};
+    int rgba64_strides[1] = {w * 8};
+    report("swscale p010 -> rgba64", w, h, bench(iterations, [&]
+                                                 { sws_scale(to_rgba64, p010, p010_strides, 0, h, rgba64, rgba64_strides); }));
+    sws_freeContext(to_rgba64);
+#endif
+}
+
+// The same drawing on a cairo backed and a native backed surface, see raster.hpp
+struct RasterPair
+{
+    int w, h;
+    std::vector<uint32_t> a, b, sprite;
+    cairo ca, cb, cs;
+
+    RasterPair(int w, int h)
+        : w(w), h(h), a(static_cast<size_t>(w) * h), b(a.size()), sprite(200 * 120),
+          ca(w, h, reinterpret_cast<uint8_t *>(a.data())), cb(w, h, reinterpret_cast<uint8_t *>(b.data())),
+          cs(200, 120, reinterpret_cast<uint8_t *>(sprite.data()))
+    {
+        ca.set_backend("cairo");
+        cb.set_backend("native");
+        for (size_t i = 0; i < a.size(); i++)
+        {
+            a[i] = b[i] = 0xff000000u | static_cast<uint32_t>(i * 2654435761u >> 8 & 0xffffff);
+        }
+        // Premultiplied, with alpha running from transparent to opaque across the sprite
+        for (int y = 0; y < 120; y++)
+        {
+            for (int x = 0; x < 200; x++)
+            {
+                uint32_t alpha = x * 255 / 199, c = (x + y) & 0xff;
+                c = c * alpha / 255;
+                sprite[y * 200 + x] = alpha << 24 | c << 16 | (alpha - c / 2) << 8 | c / 3;
+            }
+        }
+        ca.mark_dirty();
+        cb.mark_dirty();
+        cs.mark_dirty();
+    }
+
+    void both(const std::function<void(cairo &)> &fn)
+    {
+        fn(ca);
+        fn(cb);
+    }
+
+    // Largest difference of any channel
+    int difference()
+    {
+        ca.flush();
+        cb.flush();
+        int worst = 0;
+        for (size_t i = 0; i < a.size(); i++)
+        {
+            for (int shift = 0; shift < 32; shift += 8)
+            {
+                worst = std::max(worst, std::abs(static_cast<int>(a[i] >> shift & 0xff) - static_cast<int>(b[i] >> shift & 0xff)));
+            }
+        }
+        return worst;
+    }
+};
+
+// Pixels drawn natively against cairo's, false when any channel is off by more than one
+static bool raster_conformance()
+{
+    RasterPair p(640, 360);
+    struct
+    {
+        const char *name;
+        std::function<void(cairo &)> draw;
+    } cases[] = {
+        {"opaque fillRect", [](cairo &c)
+         { c.fillStyle(200, 30, 90, 255); c.fillRect(10, 10, 300, 100); }},
+        {"translucent fillRect", [](cairo &c)
+         { c.fillStyle(20, 230, 90, 128); c.fillRect(100, 50, 301, 177); }},
+        {"faint fillRect", [](cairo &c)
+         { c.fillStyle(255, 255, 255, 7); c.fillRect(0, 0, 640, 360); }},
+        {"clipped fillRect", [](cairo &c)
+         { c.fillStyle(5, 6, 7, 200); c.fillRect(-50, 300, 200, 200); }},
+        {"negative size fillRect", [](cairo &c)
+         { c.fillStyle(90, 60, 30, 180); c.fillRect(600, 200, -100, -50); }},
+        {"translated fillRect", [](cairo &c)
+         { c.save(); c.translate(33, 17); c.fillStyle(1, 128, 254, 99); c.fillRect(0, 0, 64, 64); c.restore(); }},
+        {"clearRect", [](cairo &c)
+         { c.clearRect(400, 20, 120, 80); }},
+        {"unscaled drawImage", [&p](cairo &c)
+         { c.drawImage(&p.cs, 220, 140, 200, 120); }},
+        {"clipped drawImage", [&p](cairo &c)
+         { c.drawImage(&p.cs, 560, -40, 200, 120); }},
+        {"fractional fillRect (cairo on both)", [](cairo &c)
+         { c.fillStyle(77, 88, 99, 160); c.fillRect(10.5, 200.25, 50, 50); }},
+    };
+
+    auto ok = true;
+    for (auto &t : cases)
+    {
+        p.both(t.draw);
+        auto d = p.difference();
+        fprintf(stderr, "raster %-36s max difference %d%s\n", t.name, d, d > 1 ? "  FAIL" : "");
+        ok = ok && d <= 1;
+    }
+    return ok;
+}
+
+static void bench_raster(int iterations)
+{
+    RasterPair p(1920, 1080);
+    for (auto backend : {"cairo", "native"})
+    {
+        auto &c = std::string(backend) == "cairo" ? p.ca : p.cb;
+        auto name = std::string(backend) + " fillRect 1300x580 translucent";
+        report(name.c_str(), 1300, 580, bench(iterations, [&]
+                                              { c.fillStyle(0, 0, 0, 128); c.fillRect(150, 150, 1300, 580); }));
+        name = std::string(backend) + " drawImage 200x120 x64";
+        report(name.c_str(), 200, 120, bench(iterations, [&]
+                                             { for (int i = 0; i < 64; i++) c.drawImage(&p.cs, (i % 8) * 230, (i / 8) * 130, 200, 120); }));
+    }
+}
+
+#ifdef __linux__
+// Stands in for mipp_worker: returns every frame as is, so only the transport is timed
+static int echo_worker(int fd)
+{
+    ring::Channel channel;
+    if (!channel.attach(fd))
+    {
+        return 1;
+    }
+    auto shared = channel.shared();
+    shared->ready.store(1, std::memory_order_release);
+    ring::wake(&shared->ready);
+
+    for (;;)
+    {
+        auto msg = channel.read_slot(shared->requests);
+        if (!msg)
+        {
+            channel.wait_readable(shared->requests, 1000);
+            continue;
+        }
+        if (msg->kind == ring::QUIT)
+        {
+            return 0;
+        }
+        if (msg->kind == ring::FRAME)
+        {
+            ring::Message *out;
+            while (!(out = channel.write_slot(shared->responses)))
+                channel.wait_writable(shared->responses, 1000);
+            *out = *msg;
+            out->kind = ring::FRAME_OUT;
+            std::memcpy(out->payload(), msg->payload(), static_cast<size_t>(msg->strides[0]) * msg->height);
+            channel.commit(shared->responses);
+
+            while (!(out = channel.write_slot(shared->responses)))
+                channel.wait_writable(shared->responses, 1000);
+            *out = *msg;
+            out->kind = ring::DONE;
+            channel.commit(shared->responses);
+        }
+        channel.release(shared->requests);
+    }
+}
+
+// Per frame cost of running the script out of process, compared with handing the frame over in process
+static void bench_worker(const char *self, int w, int h, int workers, int iterations)
+{
+    std::vector<uint8_t> frame(static_cast<size_t>(w) * h * 4, 0x40);
+    std::vector<uint8_t> out(frame.size());
+    uint8_t *planes[1] = {frame.data()};
+    int strides[1] = {w * 4};
+    auto receive = [&](int, int, double, uint8_t *data)
+    { std::memcpy(out.data(), data, out.size()); };
+
+    report("in process rgb32 hand over", w, h, bench(iterations, [&]
+                                                     { receive(w, h, 0, frame.data()); }));
+
+    Client client("--echo-worker", self, workers, frame.size(), receive, [](int, std::string msg)
+                  { fprintf(stderr, "%s\n", msg.c_str()); });
+    if (!client.ok())
+    {
+        return;
+    }
+    auto name = "worker rgb32 round trip x" + std::to_string(workers);
+    report(name.c_str(), w, h, bench(iterations, [&]
+                                     {
+                                         client.send_video_frame(MIPP_PIX_FMT_RGB32, w, h, strides, 0, planes, 0);
+                                         client.flush(); }));
+}
+#endif
+
+int main(int argc, char **argv)
+{
+#ifdef __linux__
+    if (argc == 3 && std::string(argv[1]) == "--echo-worker")
+    {
+        return echo_worker(std::stoi(argv[2]));
+    }
+#endif
+
+    if (argc == 2 && std::string(argv[1]) == "--raster")
+    {
+        return raster_conformance() ? 0 : 1;
+    }
+
+    int iterations = argc > 1 ? std::stoi(argv[1]) : 50;
+    fprintf(stderr, "mipp_bench: %d iterations, %d threads\n", iterations, ThreadPool::shared().size());
+    bench_formats(1920, 1080, iterations);
+    bench_formats(3840, 2160, iterations);
+    raster_conformance();
+    bench_raster(iterations);
+#ifdef __linux__
+    bench_worker(argv[0], 1920, 1080, 1, iterations);
+    bench_worker(argv[0], 1920, 1080, 2, iterations);
+#endif
+    return 0;
+}
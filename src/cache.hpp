@@ -0,0 +1,100 @@
+// Copyright 2024 Mux, Inc.
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
+// On disk cache shared by every mipp process on the machine.
+// Lives in $MIPP_CACHE_DIR, else $XDG_CACHE_HOME/mipp, else ~/.cache/mipp
+namespace cache
+{
+    static std::string dir()
+    {
+        static const std::string path = []
+        {
+            std::filesystem::path p;
+            if (auto env = std::getenv("MIPP_CACHE_DIR"))
+                p = env;
+            else if (auto xdg = std::getenv("XDG_CACHE_HOME"))
+                p = std::filesystem::path(xdg) / "mipp";
+            else if (auto home = std::getenv("HOME"))
+                p = std::filesystem::path(home) / ".cache" / "mipp";
+            else
+                p = std::filesystem::temp_directory_path() / "mipp";
+
+            std::error_code ec;
+            std::filesystem::create_directories(p, ec);
+            return p.string();
+        }();
+        return path;
+    }
+
+    // 64 bit FNV-1a, stable across processes and builds unlike std::hash
+    static uint64_t hash(const uint8_t *data, size_t size, uint64_t h = 0xcbf29ce484222325ull)
+    {
+        for (size_t i = 0; i < size; i++)
+        {
+            h = (h ^ data[i]) * 0x100000001b3ull;
+        }
+        return h;
+    }
+
+    static uint64_t hash(const std::string &str, uint64_t h = 0xcbf29ce484222325ull)
+    {
+        return hash(reinterpret_cast<const uint8_t *>(str.data()), str.size(), h);
+    }
+
+    static std::string path(uint64_t key, const std::string &ext)
+    {
+        char name[32];
+        std::snprintf(name, sizeof(name), "%016llx", static_cast<unsigned long long>(key));
+        return (std::filesystem::path(dir()) / (name + ext)).string();
+    }
+
+    static bool read(const std::string &path, std::vector<uint8_t> &out)
+    {
+        std::ifstream f(path, std::ios::binary);
+        if (!f)
+        {
+            return false;
+        }
+        out.assign(std::istreambuf_iterator<char>(f), std::istreambuf_iterator<char>());
+        return true;
+    }
+
+    // Readers never see a partial file: write to a private temp name, then rename over
+    static bool write(const std::string &path, const uint8_t *data, size_t size)
+    {
+        auto tmp = path + "." + std::to_string(getpid()) + "." + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id())) + ".tmp";
+        {
+            std::ofstream f(tmp, std::ios::binary | std::ios::trunc);
+            if (!f.write(reinterpret_cast<const char *>(data), size))
+            {
+                std::remove(tmp.c_str());
+                return false;
+            }
+        }
+        return 0 == std::rename(tmp.c_str(), path.c_str());
+    }
+} // namespace
@@ -15,14 +15,17 @@
 
 #include "colors.hpp"
 #include "ezv8.hpp"
+#include "raster.hpp"
 
 #include <cairo/cairo.h>
+#include <cmath>
 
 // https://cairographics.org/manual/
 // https://developer.mozilla.org/en-US/docs/Web/API/CanvasRenderingContext2D
 class cairo
 {
 private:
+    std::shared_ptr<void> m_keepalive; // owner of externally allocated pixels, must outlive the surface
     std::unique_ptr<cairo_surface_t, void (*)(cairo_surface_t *)> m_surface;
     std::unique_ptr<cairo_t, void (*)(cairo_t *)> m_cairo;
 
@@ -34,9 +37,67 @@ private:
     inline double b(uint32_t c) { return (c >> 0 & 0xff) / 255.0; }
     inline double a(uint32_t c) { return (c >> 24 & 0xff) / 255.0; }
 
+public:
+    // Who rasterizes fillRect, clearRect and drawImage, see raster.hpp
+    enum class Backend
+    {
+        CAIRO,
+        NATIVE, // when the native paths can, cairo otherwise
+    };
+
+private:
+    Backend m_backend = Backend::NATIVE;
+
+    // The device space rectangle, unclipped, of a user space one the native backend can draw:
+    // on ARGB32, with the transform an integer translation and integer coordinates
+    bool native_rect(double x, double y, double w, double h, raster::Rect &out)
+    {
+        if (m_backend != Backend::NATIVE || cairo_image_surface_get_format(m_surface.get()) != CAIRO_FORMAT_ARGB32)
+        {
+            return false;
+        }
+        cairo_matrix_t m;
+        cairo_get_matrix(m_cairo.get(), &m);
+        if (m.xx != 1 || m.yy != 1 || m.xy != 0 || m.yx != 0)
+        {
+            return false;
+        }
+        if (w < 0)
+        {
+            x += w;
+            w = -w;
+        }
+        if (h < 0)
+        {
+            y += h;
+            h = -h;
+        }
+        x += m.x0;
+        y += m.y0;
+        auto integral = [](double v)
+        { return v == std::floor(v) && std::fabs(v) < (1 << 28); };
+        if (!integral(x) || !integral(y) || !integral(w) || !integral(h))
+        {
+            return false;
+        }
+        out = {static_cast<int>(x), static_cast<int>(y), static_cast<int>(w), static_cast<int>(h)};
+        return true;
+    }
+
+    // Pixels written natively, cairo drops whatever it cached of them
+    void touched(const raster::Rect &r)
+    {
+        cairo_surface_mark_dirty_rectangle(m_surface.get(), r.x, r.y, r.width, r.height);
+    }
+
 public:
     cairo(int width, int height, uint8_t *data)
-        : m_surface(cairo_image_surface_create_for_data(data, CAIRO_FORMAT_ARGB32, width, height, width * 4), cairo_surface_destroy), m_cairo(cairo_create(m_surface.get()), cairo_destroy), m_fillPattern(cairo_pattern_create_rgb(1, 1, 1), cairo_pattern_destroy), m_strokePattern(cairo_pattern_create_rgb(1, 1, 1), cairo_pattern_destroy)
+        : cairo(width, height, data, width * 4)
+    {
+    }
+
+    cairo(int width, int height, uint8_t *data, int stride, std::shared_ptr<void> keepalive = nullptr, cairo_format_t format = CAIRO_FORMAT_ARGB32)
+        : m_keepalive(std::move(keepalive)), m_surface(cairo_image_surface_create_for_data(data, format, width, height, stride), cairo_surface_destroy), m_cairo(cairo_create(m_surface.get()), cairo_destroy), m_fillPattern(cairo_pattern_create_rgb(1, 1, 1), cairo_pattern_destroy), m_strokePattern(cairo_pattern_create_rgb(1, 1, 1), cairo_pattern_destroy)
     {
         // set_strokeStyle("black");
         // set_fillStyle("black");
@@ -55,6 +116,9 @@ public:
     const uint8_t *data() const { return cairo_image_surface_get_data(m_surface.get()); }
     int stride() const { return cairo_image_surface_get_stride(m_surface.get()); }
 
+    // RGBA128F, used for frames with more than 8 bits per component
+    bool is_float() const { return cairo_image_surface_get_format(m_surface.get()) == CAIRO_FORMAT_RGBA128F; }
+
     void flush() { cairo_surface_flush(m_surface.get()); }
     void mark_dirty() { cairo_surface_mark_dirty(m_surface.get()); }
     int width() { return cairo_image_surface_get_width(m_surface.get()); }
@@ -153,8 +217,26 @@ public:
         return std::string(&rgb[0]);
     }
 
+    std::string get_backend() { return m_backend == Backend::NATIVE ? "native" : "cairo"; }
+    void set_backend(std::string backend) { m_backend = backend == "cairo" ? Backend::CAIRO : Backend::NATIVE; }
+
     void drawImage(cairo *src, int x, int y, double w, double h)
     {
+        raster::Rect r;
+        if (src != this && w == src->width() && h == src->height() && cairo_image_surface_get_format(src->m_surface.get()) == CAIRO_FORMAT_ARGB32 &&
+            cairo_get_operator(m_cairo.get()) == CAIRO_OPERATOR_OVER && native_rect(x, y, w, h, r))
+        {
+            src->flush();
+            flush();
+            raster::blit_over(src->data(), src->stride(), src->width(), src->height(), data(), stride(), width(), height(), r.x, r.y);
+            auto dirty = r.clip(width(), height());
+            if (dirty.width > 0 && dirty.height > 0)
+            {
+                touched(dirty);
+            }
+            return;
+        }
+
         auto sw = w / src->width();
         auto sh = h / src->height();
         save();
@@ -168,16 +250,46 @@ public:
     // https://developer.mozilla.org/en-US/docs/Web/API/CanvasRenderingContext2D/clearRect
     void clearRect(double x, double y, double width, double height)
     {
+        raster::Rect r;
+        if (native_rect(x, y, width, height, r))
+        {
+            r = r.clip(this->width(), this->height());
+            if (r.width > 0 && r.height > 0)
+            {
+                flush();
+                raster::fill_source(data(), stride(), r, 0);
+                touched(r);
+            }
+            return;
+        }
+
         cairo_save(m_cairo.get());
         cairo_set_source_rgba(m_cairo.get(), 0, 0, 0, 0);
         cairo_set_operator(m_cairo.get(), CAIRO_OPERATOR_SOURCE);
-        cairo_paint(m_cairo.get());
+        cairo_rectangle(m_cairo.get(), x, y, width, height);
+        cairo_fill(m_cairo.get());
         cairo_restore(m_cairo.get());
     }
 
     // https://developer.mozilla.org/en-US/docs/Web/API/CanvasRenderingContext2D/fillRect
     void fillRect(double x, double y, double width, double height)
     {
+        raster::Rect r;
+        if (cairo_pattern_get_type(m_fillPattern.get()) == CAIRO_PATTERN_TYPE_SOLID && cairo_get_operator(m_cairo.get()) == CAIRO_OPERATOR_OVER &&
+            native_rect(x, y, width, height, r))
+        {
+            r = r.clip(this->width(), this->height());
+            if (r.width > 0 && r.height > 0)
+            {
+                double cr, cg, cb, ca;
+                cairo_pattern_get_rgba(m_fillPattern.get(), &cr, &cg, &cb, &ca);
+                flush();
+                raster::fill_over(data(), stride(), r, raster::premultiply(cr, cg, cb, ca));
+                touched(r);
+            }
+            return;
+        }
+
         save();
         cairo_set_source(m_cairo.get(), m_fillPattern.get());
         cairo_rectangle(m_cairo.get(), x, y, width, height);
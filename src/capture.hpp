@@ -0,0 +1,204 @@
+// Copyright 2024 Mux, Inc.
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include "kernels.hpp"
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Capture files: every frame a host sent to mipp, so a production workload can be
+// replayed offline by mipp_test.
+//
+// The file is an 8 byte magic followed by records, each a Record header and the frame's
+// planes with rows packed tight (no stride padding), native endian.
+namespace capture
+{
+    static constexpr char magic[8] = {'M', 'I', 'P', 'P', 'C', 'A', 'P', '1'};
+
+    struct Record
+    {
+        int32_t format;
+        int32_t width;
+        int32_t height;
+        int32_t pad;
+        double pts;
+        uint64_t arrival_ns; // since the first frame, for real time replay
+        uint64_t bytes;      // of plane data following the header
+    };
+
+    static uint64_t plane_bytes(int format, int plane, int width, int height)
+    {
+        return static_cast<uint64_t>(kernels::row_bytes(format, plane, width)) * kernels::plane_rows(format, plane, height);
+    }
+
+    class Writer
+    {
+    private:
+        FILE *f = nullptr;
+        std::vector<char> buffer = std::vector<char>(1 << 22);
+        std::chrono::steady_clock::time_point start;
+        bool started = false;
+
+    public:
+        ~Writer()
+        {
+            if (f)
+            {
+                fclose(f);
+            }
+        }
+
+        bool open(const std::string &path)
+        {
+            f = fopen(path.c_str(), "wb");
+            if (!f)
+            {
+                return false;
+            }
+            setvbuf(f, buffer.data(), _IOFBF, buffer.size());
+            return fwrite(magic, sizeof(magic), 1, f) == 1;
+        }
+
+        void write(int format, int width, int height, const int *strides, double pts, const uint8_t *const *planes, int pad)
+        {
+            auto now = std::chrono::steady_clock::now();
+            if (!started)
+            {
+                start = now;
+                started = true;
+            }
+
+            Record r = {format, width, height, pad, pts, static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(now - start).count()), 0};
+            for (int p = 0; p < kernels::plane_count(format); p++)
+            {
+                r.bytes += plane_bytes(format, p, width, height);
+            }
+            fwrite(&r, sizeof(r), 1, f);
+            for (int p = 0; p < kernels::plane_count(format); p++)
+            {
+                auto row = kernels::row_bytes(format, p, width);
+                for (int y = 0; y < kernels::plane_rows(format, p, height); y++)
+                {
+                    fwrite(planes[p] + static_cast<size_t>(y) * strides[p], row, 1, f);
+                }
+            }
+        }
+    };
+
+    // Reads a capture through a read only mapping, frames point into the file
+    class Reader
+    {
+    private:
+        const uint8_t *base = nullptr;
+        size_t size = 0;
+        size_t pos = sizeof(magic);
+
+    public:
+        struct Frame
+        {
+            Record record;
+            const uint8_t *planes[4];
+            int strides[4];
+        };
+
+        ~Reader()
+        {
+            if (base)
+            {
+                munmap(const_cast<uint8_t *>(base), size);
+            }
+        }
+
+        bool open(const std::string &path)
+        {
+            auto fd = ::open(path.c_str(), O_RDONLY);
+            struct stat st;
+            if (fd < 0 || fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(magic))
+            {
+                if (fd >= 0)
+                    close(fd);
+                return false;
+            }
+            auto p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            close(fd);
+            if (p == MAP_FAILED)
+            {
+                return false;
+            }
+            base = static_cast<const uint8_t *>(p);
+            size = st.st_size;
+            madvise(p, size, MADV_SEQUENTIAL);
+            return std::memcmp(base, magic, sizeof(magic)) == 0;
+        }
+
+        void rewind() { pos = sizeof(magic); }
+
+        bool next(Frame &frame)
+        {
+            if (sizeof(Record) > size - pos)
+            {
+                return false;
+            }
+            std::memcpy(&frame.record, base + pos, sizeof(Record));
+            auto &r = frame.record;
+            if (r.format < MIPP_PIX_FMT_RGB32 || r.format > MIPP_PIX_FMT_P010 || r.width <= 0 || r.height <= 0 ||
+                r.width > std::numeric_limits<int>::max() / 8 || r.bytes > size - pos - sizeof(Record))
+            {
+                return false;
+            }
+
+            // The planes must fit in what the record says it holds, which must fit in the file
+            uint64_t needed = 0;
+            for (int p = 0; p < kernels::plane_count(r.format); p++)
+            {
+                needed += plane_bytes(r.format, p, r.width, r.height);
+            }
+            if (needed > r.bytes)
+            {
+                return false;
+            }
+
+            auto data = base + pos + sizeof(Record);
+            uint64_t offset = 0;
+            for (int p = 0; p < kernels::plane_count(r.format); p++)
+            {
+                frame.planes[p] = data + offset;
+                frame.strides[p] = kernels::row_bytes(r.format, p, r.width);
+                offset += plane_bytes(r.format, p, r.width, r.height);
+            }
+            pos += sizeof(Record) + r.bytes;
+
+            // Start paging in the next record while this one is being processed
+            auto page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+            auto ahead = pos & ~(page - 1);
+            if (ahead < size)
+            {
+                madvise(const_cast<uint8_t *>(base) + ahead, std::min<size_t>(r.bytes + sizeof(Record) + page, size - ahead), MADV_WILLNEED);
+            }
+            return true;
+        }
+    };
+} // namespace
@@ -0,0 +1,527 @@
+// Copyright 2024 Mux, Inc.
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#ifdef __linux__
+
+#include "engine.hpp"
+#include "kernels.hpp"
+#include "ring.hpp"
+
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/wait.h>
+
+extern char **environ;
+
+// Runs the script in mipp_worker processes, see ring.hpp for the transport.
+//
+// Each worker is a separate Mipp instance, so a crash or OOM in a script takes down the
+// worker rather than the host: the client logs it, drops the frames that worker had in
+// flight and starts a new one. With one worker every frame is handled before
+// send_video_frame returns, as in process. With more, frame groups (a pad 0 frame and
+// the other pads' frames after it) go round robin and outputs are delivered in input
+// order up to `workers - 1` groups later.
+class Client : public Engine
+{
+private:
+    struct Worker
+    {
+        pid_t pid = -1;
+        ring::Channel channel;
+    };
+
+    static constexpr uint32_t request_slots = 2;
+    static constexpr uint32_t response_slots = 4;
+    static constexpr int poll_ms = 50; // how often blocked waits check that the worker is alive
+
+    std::string script_path;
+    std::string worker_path;
+    uint64_t slot_bytes;
+    std::function<void(int width, int height, double pts, uint8_t *data)> receive_video_frame_callback;
+    std::function<void(int level, std::string msg)> log_callback;
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::deque<std::pair<uint64_t, int>> inflight; // (seq, worker) of frames sent and not done
+    std::vector<std::pair<std::string, std::string>> options;
+    int out_format = MIPP_PIX_FMT_RGB32;
+    int video_in_count = 1;
+    int video_out_count = 1;
+    int current = -1;
+    uint64_t seq = 0;
+    uint64_t restarts = 0, lost = 0;
+
+    bool alive(Worker &w)
+    {
+        int status;
+        return w.pid > 0 && waitpid(w.pid, &status, WNOHANG) == 0;
+    }
+
+    bool spawn(int index)
+    {
+        auto w = std::make_unique<Worker>();
+        if (!w->channel.create(request_slots, response_slots, slot_bytes))
+        {
+            log_callback(16, "worker: can not create shared memory");
+            return false;
+        }
+
+        // Inherited without FD_CLOEXEC, the number is passed on the command line
+        auto fd = fcntl(w->channel.descriptor(), F_DUPFD, 3);
+        auto fd_arg = std::to_string(fd);
+        char *argv[] = {const_cast<char *>(worker_path.c_str()), const_cast<char *>(script_path.c_str()), const_cast<char *>(fd_arg.c_str()), nullptr};
+        auto err = posix_spawnp(&w->pid, worker_path.c_str(), nullptr, nullptr, argv, environ);
+        close(fd);
+        if (err != 0)
+        {
+            log_callback(16, "worker: can not start " + worker_path + ": " + strerror(err));
+            return false;
+        }
+
+        workers[index] = std::move(w);
+        control(index, ring::OUT_FORMAT, out_format, "");
+        for (auto &o : options)
+        {
+            control(index, ring::OPTION, 0, std::string(o.first) + '\0' + o.second);
+        }
+        return true;
+    }
+
+    void died(int index)
+    {
+        auto &w = *workers[index];
+        log_callback(16, "worker " + std::to_string(w.pid) + " exited, restarting");
+        w.pid = -1;
+        for (auto it = inflight.begin(); it != inflight.end();)
+        {
+            if (it->second == index)
+            {
+                lost++;
+                it = inflight.erase(it);
+            }
+            else
+            {
+                ++it;
+            }
+        }
+        restarts++;
+        spawn(index);
+    }
+
+    // Handle worker `index`'s responses until it reports frame `until` done. Without `block`,
+    // return as soon as its queue is empty. False if `until` is still pending.
+    bool collect(int index, uint64_t until, bool block)
+    {
+        auto &w = *workers[index];
+        auto &q = w.channel.shared()->responses;
+        for (;;)
+        {
+            auto msg = w.channel.read_slot(q);
+            if (!msg)
+            {
+                if (!block)
+                {
+                    return false;
+                }
+                if (!alive(w))
+                {
+                    died(index);
+                    return true;
+                }
+                w.channel.wait_readable(q, poll_ms);
+                continue;
+            }
+
+            auto kind = msg->kind;
+            auto done = msg->seq;
+            if (kind == ring::FRAME_OUT)
+            {
+                if (pad_callback)
+                {
+                    pad_callback(msg->pad, msg->width, msg->height, msg->pts, msg->payload());
+                }
+                else if (msg->pad == 0)
+                {
+                    receive_video_frame_callback(msg->width, msg->height, msg->pts, msg->payload());
+                }
+            }
+            else if (kind == ring::LOG)
+            {
+                log_callback(msg->ret, reinterpret_cast<const char *>(msg->payload()));
+            }
+            else if (kind == ring::METADATA && metadata_callback)
+            {
+                auto key = reinterpret_cast<const char *>(msg->payload());
+                metadata_callback(msg->pts, key, key + strlen(key) + 1);
+            }
+            w.channel.release(q);
+
+            if (kind == ring::DONE)
+            {
+                if (!inflight.empty() && inflight.front().first == done)
+                {
+                    inflight.pop_front();
+                }
+                if (done == until)
+                {
+                    return true;
+                }
+            }
+        }
+    }
+
+    // Deliver whatever the oldest frames have finished with, without waiting
+    void pump()
+    {
+        while (!inflight.empty() && collect(inflight.front().second, inflight.front().first, false))
+        {
+        }
+    }
+
+    void finish_front()
+    {
+        auto front = inflight.front();
+        collect(front.second, front.first, true);
+    }
+
+    // A request slot of worker `index`, nullptr if the worker died while waiting
+    ring::Message *acquire(int index)
+    {
+        for (;;)
+        {
+            auto &w = *workers[index];
+            auto &q = w.channel.shared()->requests;
+            if (auto msg = w.channel.write_slot(q))
+            {
+                std::memset(msg, 0, sizeof(ring::Message));
+                return msg;
+            }
+            if (!alive(w))
+            {
+                died(index);
+                return nullptr;
+            }
+            // The worker may be blocked on a full response queue that only drains in order,
+            // or, with nothing in flight, on log messages nobody asked for yet
+            if (std::none_of(inflight.begin(), inflight.end(), [&](auto &f)
+                             { return f.second == index; }))
+            {
+                collect(index, UINT64_MAX, false);
+            }
+            pump();
+            w.channel.wait_writable(q, 1);
+        }
+    }
+
+    void control(int index, ring::Kind kind, int value, const std::string &payload)
+    {
+        auto msg = acquire(index);
+        if (!msg)
+        {
+            return;
+        }
+        msg->kind = kind;
+        msg->format = value;
+        ring::set_text(workers[index]->channel, msg, payload);
+        workers[index]->channel.commit(workers[index]->channel.shared()->requests);
+    }
+
+    void broadcast(ring::Kind kind, int value, const std::string &payload)
+    {
+        for (size_t i = 0; i < workers.size(); i++)
+        {
+            control(i, kind, value, payload);
+        }
+    }
+
+public:
+    Client(const std::string &script_path, const std::string &worker_path, int count, uint64_t slot_bytes,
+           std::function<void(int width, int height, double pts, uint8_t *data)> receive_video_frame_callback,
+           std::function<void(int level, std::string msg)> log_callback)
+        : script_path(script_path), worker_path(worker_path), slot_bytes(slot_bytes),
+          receive_video_frame_callback(receive_video_frame_callback), log_callback(log_callback),
+          workers(std::max(1, count))
+    {
+        for (size_t i = 0; i < workers.size(); i++)
+        {
+            spawn(i);
+        }
+
+        // Pads come from the script's top level, wait for the first worker to run it
+        auto &w = workers[0];
+        while (w && !w->channel.shared()->ready.load(std::memory_order_acquire))
+        {
+            collect(0, UINT64_MAX, false);
+            if (!alive(*w))
+            {
+                w.reset();
+                break;
+            }
+            ring::wait(&w->channel.shared()->ready, 0, poll_ms);
+        }
+        if (w)
+        {
+            video_in_count = std::max(1, w->channel.shared()->video_in_count);
+            video_out_count = std::max(1, w->channel.shared()->video_out_count);
+        }
+    }
+
+    ~Client()
+    {
+        for (size_t i = 0; i < workers.size(); i++)
+        {
+            auto &w = workers[i];
+            if (!w || w->pid <= 0)
+            {
+                continue;
+            }
+
+            auto &q = w->channel.shared()->requests;
+            if (auto msg = w->channel.write_slot(q))
+            {
+                std::memset(msg, 0, sizeof(ring::Message));
+                msg->kind = ring::QUIT;
+                w->channel.commit(q);
+            }
+
+            // Give it a second to finish the frame it's on, then kill it
+            int status;
+            auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+            while (waitpid(w->pid, &status, WNOHANG) == 0)
+            {
+                // Keep its response queue moving so it can get to the QUIT
+                while (w->channel.read_slot(w->channel.shared()->responses))
+                {
+                    w->channel.release(w->channel.shared()->responses);
+                }
+                if (std::chrono::steady_clock::now() > deadline)
+                {
+                    kill(w->pid, SIGKILL);
+                    waitpid(w->pid, &status, 0);
+                    break;
+                }
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+        }
+    }
+
+    bool ok() const
+    {
+        return std::all_of(workers.begin(), workers.end(), [](auto &w)
+                           { return w != nullptr; });
+    }
+
+    int inputPads() const override { return video_in_count; }
+    int outputPads() const override { return video_out_count + static_cast<int>(renditions.size()); }
+
+    int send_video_frame(int format, int width, int height, const int *strides, double pts, uint8_t *const *planes, int in_pad_index) override
+    {
+        mipp_frame_t frame = {format, width, height, {}, {}, pts, in_pad_index};
+        for (int p = 0; p < kernels::plane_count(format); p++)
+        {
+            frame.strides[p] = strides[p];
+            frame.planes[p] = planes[p];
+        }
+        return send(frame);
+    }
+
+    // One by one as the pipeline is per frame, but side data goes along
+    int send_video_frames(const mipp_frame_t *frames, int count) override
+    {
+        auto ret = 0;
+        for (int i = 0; i < count; i++)
+        {
+            ret = std::min(ret, send(frames[i]));
+        }
+        return ret;
+    }
+
+    int send(const mipp_frame_t &frame)
+    {
+        auto format = frame.format;
+        auto height = frame.height;
+        auto in_pad_index = frame.in_pad;
+        if (format < MIPP_PIX_FMT_RGB32 || format > MIPP_PIX_FMT_P010)
+        {
+            return -1;
+        }
+
+        // Bound the pipeline to one frame group per worker
+        int n = workers.size();
+        if (in_pad_index == 0)
+        {
+            current = (current + 1) % n;
+        }
+        while (inflight.size() >= static_cast<size_t>(n * video_in_count))
+        {
+            finish_front();
+        }
+
+        auto msg = acquire(current);
+        if (!msg)
+        {
+            return -1;
+        }
+
+        auto &channel = workers[current]->channel;
+        uint64_t offset = 0;
+        for (int p = 0; p < kernels::plane_count(format); p++)
+        {
+            auto rows = kernels::plane_rows(format, p, height);
+            auto stride = static_cast<size_t>(frame.strides[p]);
+            auto bytes = static_cast<uint64_t>(rows) * stride;
+            if (offset + bytes > channel.payload_capacity())
+            {
+                log_callback(16, "worker: frame does not fit in a slot, raise slot_bytes");
+                return -1;
+            }
+            msg->strides[p] = frame.strides[p];
+            msg->offsets[p] = offset;
+            auto dst = msg->payload() + offset;
+            auto src = frame.planes[p];
+            parallel_rows(rows, [&](int y0, int y1)
+                          { std::memcpy(dst + y0 * stride, src + y0 * stride, (y1 - y0) * stride); });
+            offset = (offset + bytes + 63) & ~uint64_t(63);
+        }
+
+        msg->side_data = offset;
+        for (int i = 0; i < frame.side_data_count; i++)
+        {
+            auto &sd = frame.side_data[i];
+            if (offset + sizeof(ring::SideData) + sd.size > channel.payload_capacity())
+            {
+                log_callback(24, "worker: side data does not fit in a slot, dropped");
+                break;
+            }
+            ring::SideData header = {sd.type, 0, sd.size};
+            std::memcpy(msg->payload() + offset, &header, sizeof(header));
+            std::memcpy(msg->payload() + offset + sizeof(header), sd.data, sd.size);
+            offset = (offset + sizeof(header) + sd.size + 63) & ~uint64_t(63);
+            msg->side_data_count++;
+        }
+
+        msg->kind = ring::FRAME;
+        msg->format = format;
+        msg->width = frame.width;
+        msg->height = height;
+        msg->pad = in_pad_index;
+        msg->pts = frame.pts;
+        msg->seq = seq;
+        msg->bytes = offset;
+        channel.commit(channel.shared()->requests);
+        inflight.emplace_back(seq++, current);
+
+        if (n == 1)
+        {
+            flush();
+        }
+        else
+        {
+            pump();
+        }
+        return 0;
+    }
+
+    void flush() override
+    {
+        while (!inflight.empty())
+        {
+            finish_front();
+        }
+    }
+
+    int set_video_out_format(int format) override
+    {
+        if (!kernels::bytes_per_pixel(format))
+        {
+            return -1;
+        }
+        out_format = format;
+        broadcast(ring::OUT_FORMAT, format, "");
+        return 0;
+    }
+
+    int set_option(const std::string &key, const std::string &value) override
+    {
+        // Workers do the scaling and cropping, the sizes are needed here for outputPads and
+        // mipp_get_output_size
+        if (key == "renditions" && !parse_renditions(value, renditions))
+        {
+            return -1;
+        }
+        if (key == "crop" && !parse_crop(value, crop))
+        {
+            return -1;
+        }
+        auto it = std::find_if(options.begin(), options.end(), [&](auto &o)
+                               { return o.first == key; });
+        if (it != options.end())
+            it->second = value;
+        else
+            options.emplace_back(key, value);
+        broadcast(ring::OPTION, 0, key + '\0' + value);
+        return 0;
+    }
+
+    void request_reload(const std::string &path) override
+    {
+        if (!path.empty())
+        {
+            script_path = path;
+        }
+        broadcast(ring::RELOAD, 0, path);
+    }
+
+    void get_stats(mipp_stats_t *out) override
+    {
+        *out = {};
+        for (auto &w : workers)
+        {
+            if (!w)
+            {
+                continue;
+            }
+            auto &s = w->channel.shared()->stats;
+            out->frames_in += s.frames_in;
+            out->frames_out += s.frames_out;
+            out->script_errors += s.script_errors;
+            out->overruns += s.overruns;
+            out->passed_through += s.passed_through;
+            out->repeated += s.repeated;
+            out->dropped += s.dropped;
+            out->skipped += s.skipped;
+            out->late += s.late;
+            out->idle += s.idle;
+            out->log_dropped += s.log_dropped;
+            out->log_suppressed += s.log_suppressed;
+            out->prerendered += s.prerendered;
+            out->max_lateness_ms = std::max(out->max_lateness_ms, s.max_lateness_ms);
+            out->avg_cost_ms += s.avg_cost_ms / workers.size();
+            out->frame_interval_ms = std::max(out->frame_interval_ms, s.frame_interval_ms);
+        }
+        out->dropped += lost;
+        out->worker_restarts = restarts;
+    }
+};
+
+#endif
@@ -196,7 +196,7 @@ static uint32_t color_from_string(std::string name)
     {
         return color_from_rgba(r, g, b, 255);
     }
-    if (3 == std::sscanf(name.c_str(), "rgba ( %hhu , %hhu , %hhu , %f )", &r, &g, &b, &d))
+    if (4 == std::sscanf(name.c_str(), "rgba ( %hhu , %hhu , %hhu , %f )", &r, &g, &b, &d))
     {
         return color_from_rgba(r, g, b, static_cast<uint8_t>(std::min(255.0, d * 255.0)));
     }
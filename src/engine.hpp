@@ -0,0 +1,115 @@
+// Copyright 2024 Mux, Inc.
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include "capture.hpp"
+#include "mipp.h"
+#include "threadpool.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <functional>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+// What mipp_t::priv points to: the script running in this process (Mipp) or in
+// mipp_worker processes (Client). The C API in mipp.cpp only talks to this interface.
+class Engine
+{
+public:
+    virtual ~Engine() = default;
+
+    virtual int inputPads() const = 0;
+    virtual int outputPads() const = 0; // the script's (see make_pads), then one per rendition
+    virtual int send_video_frame(int format, int width, int height, const int *strides, double pts, uint8_t *const *planes, int in_pad_index) = 0;
+
+    // See mipp_send_video_frames, engines without a batched path send the entries one by one
+    virtual int send_video_frames(const mipp_frame_t *frames, int count)
+    {
+        auto ret = 0;
+        for (int i = 0; i < count; i++)
+        {
+            auto &f = frames[i];
+            ret = std::min(ret, send_video_frame(f.format, f.width, f.height, f.strides, f.pts, f.planes, f.in_pad));
+        }
+        return ret;
+    }
+    virtual int set_video_out_format(int format) = 0;
+    virtual int set_option(const std::string &key, const std::string &value) = 0;
+    virtual void request_reload(const std::string &path) = 0;
+    virtual void get_stats(mipp_stats_t *out) = 0;
+
+    // Wait until every frame sent so far has been handled
+    virtual void flush() {}
+
+    // Records every frame sent while the "capture" option is set
+    std::unique_ptr<capture::Writer> recorder;
+
+    // See mipp_set_metadata_callback
+    std::function<void(double pts, const std::string &key, const std::string &value)> metadata_callback;
+
+    // See mipp_set_receive_video_frame_pad, without it only output pad 0 reaches the host
+    std::function<int(int pad, int width, int height, double pts, uint8_t *data)> pad_callback;
+
+    // See mipp_set_execute, native slice work runs on mipp's own pool without it
+    HostPool host_pool;
+
+    // Sizes of the output pads added by the "renditions" option, each gets output pad 0 scaled
+    std::vector<std::pair<int, int>> renditions;
+
+    // Rectangle of the script's outputs the host gets, see the "crop" option. Width 0 is off.
+    struct Crop
+    {
+        int x = 0, y = 0, width = 0, height = 0;
+    } crop;
+
+    // "WxH+X+Y", "" for no crop
+    static bool parse_crop(const std::string &value, Crop &out)
+    {
+        Crop c;
+        char tail;
+        if (!value.empty() && (std::sscanf(value.c_str(), "%dx%d+%d+%d%c", &c.width, &c.height, &c.x, &c.y, &tail) != 4 ||
+                               c.width <= 0 || c.height <= 0 || c.x < 0 || c.y < 0))
+        {
+            return false;
+        }
+        out = c;
+        return true;
+    }
+
+    // "1280x720,640x360"
+    static bool parse_renditions(const std::string &value, std::vector<std::pair<int, int>> &out)
+    {
+        std::vector<std::pair<int, int>> sizes;
+        size_t pos = 0;
+        while (pos < value.size())
+        {
+            auto end = value.find(',', pos);
+            auto item = value.substr(pos, end == std::string::npos ? std::string::npos : end - pos);
+            int w, h;
+            char tail;
+            if (std::sscanf(item.c_str(), "%dx%d%c", &w, &h, &tail) != 2 || w <= 0 || h <= 0)
+            {
+                return false;
+            }
+            sizes.emplace_back(w, h);
+            pos = end == std::string::npos ? value.size() : end + 1;
+        }
+        out = std::move(sizes);
+        return true;
+    }
+};
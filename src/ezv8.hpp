@@ -16,6 +16,7 @@
 
 // https://v8.github.io/api/head/
 
+#include <cstdlib>
 #include <functional>
 #include <iostream>
 #include <string>
@@ -58,11 +59,24 @@ namespace ezv8
             {
                 return;
             }
+            // e.g. MIPP_V8_FLAGS="--max-lazy --no-wasm-dynamic-tiering"
+            if (auto flags = std::getenv("MIPP_V8_FLAGS"))
+            {
+                v8::V8::SetFlagsFromString(flags);
+            }
+            // JIT code map in /tmp/perf-<pid>.map for perf record, see mipp_profile_start
+            if (std::getenv("MIPP_PERF_MAP"))
+            {
+                v8::V8::SetFlagsFromString("--perf-basic-prof --interpreted-frames-native-stack");
+            }
+
             platform = v8::platform::NewDefaultPlatform();
             v8::V8::InitializePlatform(platform.get());
             v8::V8::Initialize();
         }
 
+        static v8::Platform *get() { return platform.get(); }
+
         ~V8Platform()
         {
             if (!platform)
@@ -0,0 +1,211 @@
+// Copyright 2024 Mux, Inc.
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include "cairo.hpp"
+#include "ezv8.hpp"
+
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <vector>
+
+// The last frames received on each input pad, for `history(pad, k)`
+//
+// Frames are kept as they arrived, before the script draws on them, in the packed layout of
+// a VideoFrame. Entries are reference counted: a script holding a history frame keeps its
+// pixels alive after the ring moved past it, and buffers nobody else holds are recycled for
+// new frames instead of being freed.
+namespace history
+{
+    using Pixels = std::shared_ptr<std::vector<uint8_t>>;
+
+    struct Entry
+    {
+        Pixels pixels;
+        int width = 0;
+        int height = 0;
+        bool is_float = false;
+        double pts = 0;
+    };
+
+    class Ring
+    {
+    private:
+        size_t depth = 0;         // frames per pad
+        uint64_t budget = 256ull << 20;
+        uint64_t bytes = 0;
+        std::vector<std::deque<Entry>> pads;
+        std::vector<Pixels> spare; // only referenced from here
+
+        void retire(std::deque<Entry> &ring)
+        {
+            auto &e = ring.front();
+            bytes -= e.pixels->size();
+            if (e.pixels.use_count() == 1 && spare.size() < 2)
+            {
+                spare.push_back(std::move(e.pixels));
+            }
+            ring.pop_front();
+        }
+
+        // Oldest frames go first, but every pad keeps its newest frame
+        void trim()
+        {
+            for (auto &ring : pads)
+            {
+                while (ring.size() > depth)
+                {
+                    retire(ring);
+                }
+            }
+            while (bytes > budget)
+            {
+                std::deque<Entry> *longest = nullptr;
+                for (auto &ring : pads)
+                {
+                    if (ring.size() > 1 && (!longest || ring.size() > longest->size()))
+                    {
+                        longest = &ring;
+                    }
+                }
+                if (!longest)
+                {
+                    break;
+                }
+                retire(*longest);
+            }
+        }
+
+    public:
+        bool enabled() const { return depth > 0; }
+
+        void set_depth(size_t frames)
+        {
+            depth = frames;
+            trim();
+        }
+
+        void set_budget(uint64_t b)
+        {
+            budget = b;
+            trim();
+        }
+
+        // Room for the frame arriving on `pad`, width * height * bpp packed bytes
+        uint8_t *push(int pad, int width, int height, bool is_float, double pts)
+        {
+            if (pad < 0 || !enabled())
+            {
+                return nullptr;
+            }
+            if (static_cast<size_t>(pad) >= pads.size())
+            {
+                pads.resize(pad + 1);
+            }
+
+            auto size = static_cast<size_t>(width) * height * (is_float ? 16 : 4);
+            Pixels pixels;
+            if (!spare.empty())
+            {
+                pixels = std::move(spare.back());
+                spare.pop_back();
+            }
+            else if (pads[pad].size() >= depth && pads[pad].front().pixels.use_count() == 1)
+            {
+                // The ring is full, take over the buffer of the frame falling out of it
+                pixels = std::move(pads[pad].front().pixels);
+                bytes -= pixels->size();
+                pads[pad].pop_front();
+            }
+            else
+            {
+                pixels = std::make_shared<std::vector<uint8_t>>();
+            }
+            pixels->resize(size);
+
+            pads[pad].push_back({std::move(pixels), width, height, is_float, pts});
+            bytes += size;
+            auto data = pads[pad].back().pixels->data();
+            trim();
+            return data;
+        }
+
+        // k frames back on `pad`, 0 is the latest frame, nullptr past what is kept
+        const Entry *at(int pad, int k) const
+        {
+            if (pad < 0 || static_cast<size_t>(pad) >= pads.size() || k < 0 || static_cast<size_t>(k) >= pads[pad].size())
+            {
+                return nullptr;
+            }
+            return &pads[pad][pads[pad].size() - 1 - k];
+        }
+    };
+
+    // A read only frame for scripts: width, height, pts, format and a typed array `data`, with
+    // the internal field a cairo surface over the kept pixels so it can be drawn from and
+    // compared against like a loadImage result. It has no drawing methods. `data` is a copy
+    // made on first access, so writing to it can't change the kept frame.
+    static v8::MaybeLocal<v8::Object> wrap(v8::Isolate *iso, v8::Local<v8::Context> ctx, const Entry &e)
+    {
+        auto templ = v8::ObjectTemplate::New(iso);
+        templ->SetInternalFieldCount(1);
+        v8::Local<v8::Object> obj;
+        if (!templ->NewInstance(ctx).ToLocal(&obj))
+        {
+            return {};
+        }
+
+        struct Held
+        {
+            v8::Global<v8::Object> handle;
+            std::unique_ptr<cairo> canvas;
+        };
+        auto bpp = e.is_float ? 16 : 4;
+        auto format = e.is_float ? CAIRO_FORMAT_RGBA128F : CAIRO_FORMAT_ARGB32;
+        auto held = new Held{v8::Global<v8::Object>(iso, obj), std::make_unique<cairo>(e.width, e.height, e.pixels->data(), e.width * bpp, e.pixels, format)};
+        held->handle.SetWeak(
+            held, [](const v8::WeakCallbackInfo<Held> &info)
+            {
+                auto held = info.GetParameter();
+                held->handle.Reset();
+                delete held; },
+            v8::WeakCallbackType::kParameter);
+
+        obj->SetInternalField(0, v8::External::New(iso, held->canvas.get()));
+        obj->Set(ctx, v8::String::NewFromUtf8(iso, "width").ToLocalChecked(), v8::Number::New(iso, e.width)).FromJust();
+        obj->Set(ctx, v8::String::NewFromUtf8(iso, "height").ToLocalChecked(), v8::Number::New(iso, e.height)).FromJust();
+        obj->Set(ctx, v8::String::NewFromUtf8(iso, "pts").ToLocalChecked(), v8::Number::New(iso, e.pts)).FromJust();
+        obj->Set(ctx, v8::String::NewFromUtf8(iso, "format").ToLocalChecked(), v8::String::NewFromUtf8(iso, e.is_float ? "rgba128f" : "rgb32").ToLocalChecked()).FromJust();
+        // The getter only runs while the object, and so `held`, is alive
+        obj->SetLazyDataProperty(
+               ctx, v8::String::NewFromUtf8(iso, "data").ToLocalChecked(),
+               [](v8::Local<v8::Name>, const v8::PropertyCallbackInfo<v8::Value> &info)
+               {
+                   auto canvas = static_cast<const cairo *>(info.Data().As<v8::External>()->Value());
+                   auto size = static_cast<size_t>(canvas->stride()) * canvas->height();
+                   auto buffer = v8::ArrayBuffer::New(info.GetIsolate(), size);
+                   std::memcpy(buffer->Data(), canvas->data(), size);
+                   if (canvas->is_float())
+                       info.GetReturnValue().Set(v8::Float32Array::New(buffer, 0, size / 4));
+                   else
+                       info.GetReturnValue().Set(v8::Uint32Array::New(buffer, 0, size / 4));
+               },
+               v8::External::New(iso, held->canvas.get()))
+            .FromJust();
+        return obj;
+    }
+} // namespace
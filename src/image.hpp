@@ -0,0 +1,320 @@
+// Copyright 2024 Mux, Inc.
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include "cache.hpp"
+#include "cairo.hpp"
+#include "ezv8.hpp"
+
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef MIPP_HAVE_JPEG
+#include <csetjmp>
+#include <jpeglib.h>
+#endif
+
+// Still images for `loadImage(path)`
+//
+// PNG and JPEG files are decoded once into premultiplied ARGB32, the decoded pixels are
+// stored in the mipp cache keyed by a hash of the file, and mapped read only from there.
+// Every Mipp instance in the process that loads the same file shares one mapping.
+namespace image
+{
+    static constexpr char magic[8] = {'M', 'I', 'P', 'P', 'I', 'M', 'G', '1'};
+
+    // Decoded form on disk: this header, then height rows of stride bytes
+    struct Header
+    {
+        char magic[8];
+        int32_t width;
+        int32_t height;
+        int32_t stride;
+        int32_t reserved[3];
+    };
+
+    struct Pixels
+    {
+        int width = 0;
+        int height = 0;
+        int stride = 0;
+        const uint8_t *data = nullptr;
+
+        void *map = nullptr; // the cache file, or
+        size_t map_size = 0;
+        std::vector<uint8_t> heap; // decoded pixels when the cache can't be written
+
+        ~Pixels()
+        {
+            if (map)
+            {
+                munmap(map, map_size);
+            }
+        }
+    };
+
+    static std::mutex &loaded_mutex()
+    {
+        static std::mutex m;
+        return m;
+    }
+
+    static std::unordered_map<uint64_t, std::weak_ptr<Pixels>> &loaded()
+    {
+        static std::unordered_map<uint64_t, std::weak_ptr<Pixels>> images;
+        return images;
+    }
+
+    static std::shared_ptr<Pixels> map(const std::string &path)
+    {
+        auto fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+        {
+            return nullptr;
+        }
+        struct stat st;
+        auto p = fstat(fd, &st) == 0 && static_cast<size_t>(st.st_size) >= sizeof(Header) ? mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+        close(fd);
+        if (p == MAP_FAILED)
+        {
+            return nullptr;
+        }
+
+        auto pixels = std::make_shared<Pixels>();
+        pixels->map = p;
+        pixels->map_size = st.st_size;
+        Header h;
+        std::memcpy(&h, p, sizeof(h));
+        if (std::memcmp(h.magic, magic, sizeof(magic)) != 0 || h.width <= 0 || h.height <= 0 ||
+            h.stride != cairo_format_stride_for_width(CAIRO_FORMAT_ARGB32, h.width) ||
+            sizeof(Header) + static_cast<size_t>(h.stride) * h.height > pixels->map_size)
+        {
+            return nullptr;
+        }
+        pixels->width = h.width;
+        pixels->height = h.height;
+        pixels->stride = h.stride;
+        pixels->data = static_cast<const uint8_t *>(p) + sizeof(Header);
+        return pixels;
+    }
+
+    // Decoded images are stored behind a Header, so the cache file can be written as is
+    static bool decode_png(const std::vector<uint8_t> &file, Header &h, std::vector<uint8_t> &out)
+    {
+        struct Cursor
+        {
+            const std::vector<uint8_t> &file;
+            size_t pos;
+        } cursor = {file, 0};
+        auto read = [](void *closure, unsigned char *data, unsigned int length)
+        {
+            auto c = static_cast<Cursor *>(closure);
+            if (c->pos + length > c->file.size())
+            {
+                return CAIRO_STATUS_READ_ERROR;
+            }
+            std::memcpy(data, c->file.data() + c->pos, length);
+            c->pos += length;
+            return CAIRO_STATUS_SUCCESS;
+        };
+        auto png = cairo_image_surface_create_from_png_stream(read, &cursor);
+        if (cairo_surface_status(png) != CAIRO_STATUS_SUCCESS)
+        {
+            cairo_surface_destroy(png);
+            return false;
+        }
+
+        // Paint onto ARGB32 whatever cairo chose (RGB24 leaves alpha undefined, gray is A8)
+        h.width = cairo_image_surface_get_width(png);
+        h.height = cairo_image_surface_get_height(png);
+        h.stride = cairo_format_stride_for_width(CAIRO_FORMAT_ARGB32, h.width);
+        out.assign(sizeof(Header) + static_cast<size_t>(h.stride) * h.height, 0);
+        auto surface = cairo_image_surface_create_for_data(out.data() + sizeof(Header), CAIRO_FORMAT_ARGB32, h.width, h.height, h.stride);
+        auto cr = cairo_create(surface);
+        cairo_set_source_surface(cr, png, 0, 0);
+        cairo_paint(cr);
+        cairo_destroy(cr);
+        cairo_surface_flush(surface);
+        cairo_surface_destroy(surface);
+        cairo_surface_destroy(png);
+        return true;
+    }
+
+#ifdef MIPP_HAVE_JPEG
+    static bool decode_jpeg(const std::vector<uint8_t> &file, Header &h, std::vector<uint8_t> &out)
+    {
+        struct Error
+        {
+            jpeg_error_mgr mgr;
+            std::jmp_buf jump;
+        } err;
+        jpeg_decompress_struct info;
+        info.err = jpeg_std_error(&err.mgr);
+        err.mgr.error_exit = [](j_common_ptr c)
+        { std::longjmp(reinterpret_cast<Error *>(c->err)->jump, 1); };
+        if (setjmp(err.jump))
+        {
+            jpeg_destroy_decompress(&info);
+            return false;
+        }
+
+        jpeg_create_decompress(&info);
+        jpeg_mem_src(&info, file.data(), file.size());
+        jpeg_read_header(&info, TRUE);
+        info.out_color_space = JCS_RGB;
+        jpeg_start_decompress(&info);
+
+        h.width = info.output_width;
+        h.height = info.output_height;
+        h.stride = cairo_format_stride_for_width(CAIRO_FORMAT_ARGB32, h.width);
+        out.assign(sizeof(Header) + static_cast<size_t>(h.stride) * h.height, 0);
+        std::vector<uint8_t> row(static_cast<size_t>(h.width) * 3);
+        while (info.output_scanline < info.output_height)
+        {
+            auto y = info.output_scanline;
+            auto p = row.data();
+            jpeg_read_scanlines(&info, &p, 1);
+            auto dst = reinterpret_cast<uint32_t *>(out.data() + sizeof(Header) + static_cast<size_t>(y) * h.stride);
+            for (int x = 0; x < h.width; x++)
+            {
+                // Opaque, so already premultiplied
+                dst[x] = 0xff000000u | row[x * 3] << 16 | row[x * 3 + 1] << 8 | row[x * 3 + 2];
+            }
+        }
+        jpeg_finish_decompress(&info);
+        jpeg_destroy_decompress(&info);
+        return true;
+    }
+#endif
+
+    static std::shared_ptr<Pixels> decode(const std::vector<uint8_t> &file, const std::string &cache_path, std::string &error)
+    {
+        Header h = {};
+        std::vector<uint8_t> out;
+        auto ok = false;
+        if (file.size() >= 8 && std::memcmp(file.data(), "\x89PNG\r\n\x1a\n", 8) == 0)
+        {
+            ok = decode_png(file, h, out);
+        }
+        else if (file.size() >= 3 && file[0] == 0xff && file[1] == 0xd8 && file[2] == 0xff)
+        {
+#ifdef MIPP_HAVE_JPEG
+            ok = decode_jpeg(file, h, out);
+#else
+            error = "JPEG support was not built in";
+            return nullptr;
+#endif
+        }
+        else
+        {
+            error = "not a PNG or JPEG";
+            return nullptr;
+        }
+        if (!ok)
+        {
+            error = "can not decode";
+            return nullptr;
+        }
+
+        std::memcpy(h.magic, magic, sizeof(magic));
+        std::memcpy(out.data(), &h, sizeof(h));
+        if (cache::write(cache_path, out.data(), out.size()))
+        {
+            if (auto mapped = map(cache_path))
+            {
+                return mapped;
+            }
+        }
+
+        auto pixels = std::make_shared<Pixels>();
+        pixels->width = h.width;
+        pixels->height = h.height;
+        pixels->stride = h.stride;
+        pixels->heap = std::move(out);
+        pixels->data = pixels->heap.data() + sizeof(Header);
+        return pixels;
+    }
+
+    // The decoded image at `path`, throws into the script on failure
+    static std::shared_ptr<Pixels> load(v8::Isolate *iso, const std::string &path)
+    {
+        std::vector<uint8_t> file;
+        if (!cache::read(path, file))
+        {
+            iso->ThrowException(v8::Exception::Error(v8::String::NewFromUtf8(iso, ("loadImage: can not read " + path).c_str()).ToLocalChecked()));
+            return nullptr;
+        }
+
+        auto key = cache::hash(file.data(), file.size());
+        std::lock_guard<std::mutex> lock(loaded_mutex());
+        if (auto pixels = loaded()[key].lock())
+        {
+            return pixels;
+        }
+
+        auto cache_path = cache::path(key, ".argb");
+        auto pixels = map(cache_path);
+        std::string error;
+        if (!pixels && !(pixels = decode(file, cache_path, error)))
+        {
+            iso->ThrowException(v8::Exception::Error(v8::String::NewFromUtf8(iso, ("loadImage: " + path + ": " + error).c_str()).ToLocalChecked()));
+            return nullptr;
+        }
+        loaded()[key] = pixels;
+        return pixels;
+    }
+
+    // Wrap the image for scripts: an object with width and height whose internal field is a
+    // cairo surface over the shared pixels, usable anywhere a VideoFrame is drawn from
+    // (frame.draw, new VideoFrame(w, h, pts, src), frame.shade sources). Nothing ever draws
+    // on it, the pixels are mapped read only.
+    static v8::MaybeLocal<v8::Object> wrap(v8::Isolate *iso, v8::Local<v8::Context> ctx, std::shared_ptr<Pixels> pixels)
+    {
+        auto templ = v8::ObjectTemplate::New(iso);
+        templ->SetInternalFieldCount(1);
+        v8::Local<v8::Object> obj;
+        if (!templ->NewInstance(ctx).ToLocal(&obj))
+        {
+            return {};
+        }
+
+        struct Held
+        {
+            v8::Global<v8::Object> handle;
+            std::unique_ptr<cairo> canvas;
+        };
+        auto data = const_cast<uint8_t *>(pixels->data);
+        auto held = new Held{v8::Global<v8::Object>(iso, obj), std::make_unique<cairo>(pixels->width, pixels->height, data, pixels->stride, pixels)};
+        held->handle.SetWeak(
+            held, [](const v8::WeakCallbackInfo<Held> &info)
+            {
+                auto held = info.GetParameter();
+                held->handle.Reset();
+                delete held; },
+            v8::WeakCallbackType::kParameter);
+
+        obj->SetInternalField(0, v8::External::New(iso, held->canvas.get()));
+        obj->Set(ctx, v8::String::NewFromUtf8(iso, "width").ToLocalChecked(), v8::Number::New(iso, pixels->width)).FromJust();
+        obj->Set(ctx, v8::String::NewFromUtf8(iso, "height").ToLocalChecked(), v8::Number::New(iso, pixels->height)).FromJust();
+        return obj;
+    }
+} // namespace
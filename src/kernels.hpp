@@ -0,0 +1,417 @@
+// Copyright 2024 Mux, Inc.
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include "mipp.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// Pixel format conversion between host formats and the two surface formats scripts see:
+// 8 bit premultiplied ARGB (cairo ARGB32) and float premultiplied RGBA (cairo RGBA128F).
+//
+// Every kernel converts a range of rows so callers can split a frame across threads, and the
+// inner loops are plain fixed stride arithmetic so the compiler vectorizes them for whatever
+// SIMD the target has (SSE/AVX, NEON). 16 bit host formats are little endian.
+namespace kernels
+{
+    static inline float saturate(float v) { return v > 0.0f ? (v < 1.0f ? v : 1.0f) : 0.0f; }
+
+    static inline uint16_t to_u16(float v) { return static_cast<uint16_t>(saturate(v) * 65535.0f + 0.5f); }
+
+    static inline uint8_t to_u8(float v) { return static_cast<uint8_t>(saturate(v) * 255.0f + 0.5f); }
+
+    static inline const uint16_t *row16(const uint8_t *base, int stride, int y) { return reinterpret_cast<const uint16_t *>(base + y * stride); }
+
+    static inline float *rowf(uint8_t *base, int stride, int y) { return reinterpret_cast<float *>(base + y * stride); }
+
+    // Bytes per pixel of a packed host format, 0 for planar formats
+    static int bytes_per_pixel(int format)
+    {
+        switch (format)
+        {
+        case MIPP_PIX_FMT_RGB32:
+            return 4;
+        case MIPP_PIX_FMT_RGBA64:
+            return 8;
+        case MIPP_PIX_FMT_RGB48:
+            return 6;
+        default:
+            return 0;
+        }
+    }
+
+    // Formats with more than 8 bits per component land on float surfaces
+    static bool is_high_bit_depth(int format) { return format != MIPP_PIX_FMT_RGB32; }
+
+    static int plane_count(int format)
+    {
+        return format == MIPP_PIX_FMT_YUV420P10 ? 3 : format == MIPP_PIX_FMT_P010 ? 2
+                                                                                 : 1;
+    }
+
+    // Rows in `plane` of a frame `height` rows tall, chroma planes are subsampled vertically
+    static int plane_rows(int format, int plane, int height)
+    {
+        return plane > 0 && (format == MIPP_PIX_FMT_YUV420P10 || format == MIPP_PIX_FMT_P010) ? (height + 1) / 2 : height;
+    }
+
+    // Bytes of pixel data in a row of `plane`, without padding
+    static int row_bytes(int format, int plane, int width)
+    {
+        switch (format)
+        {
+        case MIPP_PIX_FMT_YUV420P10:
+            return plane > 0 ? (width + 1) / 2 * 2 : width * 2;
+        case MIPP_PIX_FMT_P010:
+            return plane > 0 ? (width + 1) / 2 * 4 : width * 2;
+        default:
+            return width * bytes_per_pixel(format);
+        }
+    }
+
+    ///////////////////////////////////////////////////////////////////////////
+    // Ingress, host -> RGBA128F. Host formats are opaque or straight alpha, so premultiply.
+    static void rgba64_to_rgba128f(const uint8_t *src, int src_stride, uint8_t *dst, int dst_stride, int width, int y0, int y1)
+    {
+        for (int y = y0; y < y1; y++)
+        {
+            auto s = row16(src, src_stride, y);
+            auto d = rowf(dst, dst_stride, y);
+            for (int x = 0; x < width; x++)
+            {
+                auto a = s[x * 4 + 3] * (1.0f / 65535.0f);
+                d[x * 4 + 0] = s[x * 4 + 0] * (1.0f / 65535.0f) * a;
+                d[x * 4 + 1] = s[x * 4 + 1] * (1.0f / 65535.0f) * a;
+                d[x * 4 + 2] = s[x * 4 + 2] * (1.0f / 65535.0f) * a;
+                d[x * 4 + 3] = a;
+            }
+        }
+    }
+
+    static void rgb48_to_rgba128f(const uint8_t *src, int src_stride, uint8_t *dst, int dst_stride, int width, int y0, int y1)
+    {
+        for (int y = y0; y < y1; y++)
+        {
+            auto s = row16(src, src_stride, y);
+            auto d = rowf(dst, dst_stride, y);
+            for (int x = 0; x < width; x++)
+            {
+                d[x * 4 + 0] = s[x * 3 + 0] * (1.0f / 65535.0f);
+                d[x * 4 + 1] = s[x * 3 + 1] * (1.0f / 65535.0f);
+                d[x * 4 + 2] = s[x * 3 + 2] * (1.0f / 65535.0f);
+                d[x * 4 + 3] = 1.0f;
+            }
+        }
+    }
+
+    // 10 bit limited range BT.2020 non constant luminance, the HDR10/HLG matrix.
+    // Chroma is nearest neighbour upsampled, each sample covers a 2x2 block.
+    static inline void yuv10_to_rgb(float *d, int y, int u, int v)
+    {
+        auto Y = (y - 64) * (1.0f / 876.0f);
+        auto Cb = (u - 512) * (1.0f / 896.0f);
+        auto Cr = (v - 512) * (1.0f / 896.0f);
+        d[0] = saturate(Y + 1.4746f * Cr);
+        d[1] = saturate(Y - 0.16455f * Cb - 0.57135f * Cr);
+        d[2] = saturate(Y + 1.8814f * Cb);
+        d[3] = 1.0f;
+    }
+
+    static void yuv420p10_to_rgba128f(const uint8_t *const planes[], const int strides[], uint8_t *dst, int dst_stride, int width, int y0, int y1)
+    {
+        for (int y = y0; y < y1; y++)
+        {
+            auto ys = row16(planes[0], strides[0], y);
+            auto us = row16(planes[1], strides[1], y / 2);
+            auto vs = row16(planes[2], strides[2], y / 2);
+            auto d = rowf(dst, dst_stride, y);
+            for (int x = 0; x < width; x++)
+            {
+                yuv10_to_rgb(d + x * 4, ys[x] & 0x3ff, us[x / 2] & 0x3ff, vs[x / 2] & 0x3ff);
+            }
+        }
+    }
+
+    // P010 keeps the 10 significant bits at the top of each 16 bit word, chroma interleaved
+    static void p010_to_rgba128f(const uint8_t *const planes[], const int strides[], uint8_t *dst, int dst_stride, int width, int y0, int y1)
+    {
+        for (int y = y0; y < y1; y++)
+        {
+            auto ys = row16(planes[0], strides[0], y);
+            auto uv = row16(planes[1], strides[1], y / 2);
+            auto d = rowf(dst, dst_stride, y);
+            for (int x = 0; x < width; x++)
+            {
+                yuv10_to_rgb(d + x * 4, ys[x] >> 6, uv[(x / 2) * 2] >> 6, uv[(x / 2) * 2 + 1] >> 6);
+            }
+        }
+    }
+
+    ///////////////////////////////////////////////////////////////////////////
+    // Egress, surface -> host. Surfaces are premultiplied, host formats straight alpha.
+    static void rgba128f_to_rgba64(const uint8_t *src, int src_stride, uint8_t *dst, int dst_stride, int width, int y0, int y1)
+    {
+        for (int y = y0; y < y1; y++)
+        {
+            auto s = reinterpret_cast<const float *>(src + y * src_stride);
+            auto d = reinterpret_cast<uint16_t *>(dst + y * dst_stride);
+            for (int x = 0; x < width; x++)
+            {
+                auto a = s[x * 4 + 3];
+                auto inv = a > 0.0f ? 1.0f / a : 0.0f;
+                d[x * 4 + 0] = to_u16(s[x * 4 + 0] * inv);
+                d[x * 4 + 1] = to_u16(s[x * 4 + 1] * inv);
+                d[x * 4 + 2] = to_u16(s[x * 4 + 2] * inv);
+                d[x * 4 + 3] = to_u16(a);
+            }
+        }
+    }
+
+    static void rgba128f_to_rgb48(const uint8_t *src, int src_stride, uint8_t *dst, int dst_stride, int width, int y0, int y1)
+    {
+        for (int y = y0; y < y1; y++)
+        {
+            auto s = reinterpret_cast<const float *>(src + y * src_stride);
+            auto d = reinterpret_cast<uint16_t *>(dst + y * dst_stride);
+            for (int x = 0; x < width; x++)
+            {
+                auto a = s[x * 4 + 3];
+                auto inv = a > 0.0f ? 1.0f / a : 0.0f;
+                d[x * 3 + 0] = to_u16(s[x * 4 + 0] * inv);
+                d[x * 3 + 1] = to_u16(s[x * 4 + 1] * inv);
+                d[x * 3 + 2] = to_u16(s[x * 4 + 2] * inv);
+            }
+        }
+    }
+
+    // Stays premultiplied, like every ARGB32 frame mipp emits
+    static void rgba128f_to_rgb32(const uint8_t *src, int src_stride, uint8_t *dst, int dst_stride, int width, int y0, int y1)
+    {
+        for (int y = y0; y < y1; y++)
+        {
+            auto s = reinterpret_cast<const float *>(src + y * src_stride);
+            auto d = reinterpret_cast<uint32_t *>(dst + y * dst_stride);
+            for (int x = 0; x < width; x++)
+            {
+                d[x] = static_cast<uint32_t>(to_u8(s[x * 4 + 3])) << 24 | static_cast<uint32_t>(to_u8(s[x * 4 + 0])) << 16 | static_cast<uint32_t>(to_u8(s[x * 4 + 1])) << 8 | to_u8(s[x * 4 + 2]);
+            }
+        }
+    }
+
+    // ARGB32 surface to 16 bit host formats, for 8 bit frames sent to a high bit depth output
+    static void rgb32_to_rgba64(const uint8_t *src, int src_stride, uint8_t *dst, int dst_stride, int width, int y0, int y1)
+    {
+        for (int y = y0; y < y1; y++)
+        {
+            auto s = reinterpret_cast<const uint32_t *>(src + y * src_stride);
+            auto d = reinterpret_cast<uint16_t *>(dst + y * dst_stride);
+            for (int x = 0; x < width; x++)
+            {
+                auto a = s[x] >> 24;
+                auto scale = a ? 1.0f / a : 0.0f;
+                d[x * 4 + 0] = to_u16((s[x] >> 16 & 0xff) * scale);
+                d[x * 4 + 1] = to_u16((s[x] >> 8 & 0xff) * scale);
+                d[x * 4 + 2] = to_u16((s[x] & 0xff) * scale);
+                d[x * 4 + 3] = a * 257;
+            }
+        }
+    }
+
+    static void rgb32_to_rgb48(const uint8_t *src, int src_stride, uint8_t *dst, int dst_stride, int width, int y0, int y1)
+    {
+        for (int y = y0; y < y1; y++)
+        {
+            auto s = reinterpret_cast<const uint32_t *>(src + y * src_stride);
+            auto d = reinterpret_cast<uint16_t *>(dst + y * dst_stride);
+            for (int x = 0; x < width; x++)
+            {
+                auto a = s[x] >> 24;
+                auto scale = a ? 1.0f / a : 0.0f;
+                d[x * 3 + 0] = to_u16((s[x] >> 16 & 0xff) * scale);
+                d[x * 3 + 1] = to_u16((s[x] >> 8 & 0xff) * scale);
+                d[x * 3 + 2] = to_u16((s[x] & 0xff) * scale);
+            }
+        }
+    }
+
+    static void copy_rows(const uint8_t *src, int src_stride, uint8_t *dst, int dst_stride, int row_bytes, int y0, int y1)
+    {
+        for (int y = y0; y < y1; y++)
+        {
+            std::memcpy(dst + y * dst_stride, src + y * src_stride, row_bytes);
+        }
+    }
+
+    ///////////////////////////////////////////////////////////////////////////
+    // Resampling of packed host formats, for renditions
+
+    // Area averaging filter taps from `src` samples to `dst`: output i is the coverage
+    // weighted average of the inputs under [i, i + 1) scaled to the input
+    struct Taps
+    {
+        std::vector<int> first;
+        std::vector<int> count;
+        std::vector<float> weights; // `width` per output
+        int width = 0;
+
+        Taps(int src, int dst)
+        {
+            auto scale = static_cast<double>(src) / dst;
+            width = static_cast<int>(std::ceil(scale)) + 1;
+            first.resize(dst);
+            count.resize(dst);
+            weights.assign(static_cast<size_t>(dst) * width, 0.0f);
+            for (int i = 0; i < dst; i++)
+            {
+                auto a = i * scale, b = std::min<double>(src, (i + 1) * scale);
+                first[i] = std::min(src - 1, static_cast<int>(a));
+                count[i] = 0;
+                auto total = 0.0;
+                for (int j = first[i]; j < src && j < b && count[i] < width; j++, count[i]++)
+                {
+                    auto w = std::min<double>(j + 1, b) - std::max<double>(j, a);
+                    weights[static_cast<size_t>(i) * width + count[i]] = static_cast<float>(w);
+                    total += w;
+                }
+                for (int k = 0; k < count[i]; k++)
+                {
+                    weights[static_cast<size_t>(i) * width + k] /= static_cast<float>(total);
+                }
+            }
+        }
+    };
+
+    // Rows [y0, y1) of dst, `C` components of type T per pixel
+    template <typename T, int C>
+    static void resize_rows(const uint8_t *src, int src_stride, int src_width, const Taps &h, const Taps &v,
+                            uint8_t *dst, int dst_stride, int dst_width, int y0, int y1)
+    {
+        constexpr float max = sizeof(T) == 1 ? 255.0f : 65535.0f;
+        std::vector<float> acc(static_cast<size_t>(src_width) * C);
+        for (int y = y0; y < y1; y++)
+        {
+            // Vertical pass over whole rows, the long loop vectorizes
+            std::fill(acc.begin(), acc.end(), 0.0f);
+            for (int k = 0; k < v.count[y]; k++)
+            {
+                auto w = v.weights[static_cast<size_t>(y) * v.width + k];
+                auto s = reinterpret_cast<const T *>(src + static_cast<size_t>(v.first[y] + k) * src_stride);
+                for (int i = 0; i < src_width * C; i++)
+                {
+                    acc[i] += w * s[i];
+                }
+            }
+
+            auto d = reinterpret_cast<T *>(dst + static_cast<size_t>(y) * dst_stride);
+            for (int x = 0; x < dst_width; x++)
+            {
+                float sum[C] = {};
+                auto weights = &h.weights[static_cast<size_t>(x) * h.width];
+                auto a = &acc[static_cast<size_t>(h.first[x]) * C];
+                for (int k = 0; k < h.count[x]; k++)
+                {
+                    for (int c = 0; c < C; c++)
+                    {
+                        sum[c] += weights[k] * a[k * C + c];
+                    }
+                }
+                for (int c = 0; c < C; c++)
+                {
+                    d[x * C + c] = static_cast<T>(std::min(max, sum[c] + 0.5f));
+                }
+            }
+        }
+    }
+
+    // Packed host frame -> another size, rows [y0, y1) of dst. Returns false for planar formats
+    static bool resize(int format, const uint8_t *src, int src_stride, int src_width, const Taps &h, const Taps &v,
+                       uint8_t *dst, int dst_stride, int dst_width, int y0, int y1)
+    {
+        switch (format)
+        {
+        case MIPP_PIX_FMT_RGB32:
+            resize_rows<uint8_t, 4>(src, src_stride, src_width, h, v, dst, dst_stride, dst_width, y0, y1);
+            return true;
+        case MIPP_PIX_FMT_RGBA64:
+            resize_rows<uint16_t, 4>(src, src_stride, src_width, h, v, dst, dst_stride, dst_width, y0, y1);
+            return true;
+        case MIPP_PIX_FMT_RGB48:
+            resize_rows<uint16_t, 3>(src, src_stride, src_width, h, v, dst, dst_stride, dst_width, y0, y1);
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    ///////////////////////////////////////////////////////////////////////////
+    // Dispatch
+
+    // Host frame -> surface rows [y0, y1). Returns false for unknown formats
+    static bool unpack(int format, const uint8_t *const planes[], const int strides[], uint8_t *dst, int dst_stride, int width, int y0, int y1)
+    {
+        switch (format)
+        {
+        case MIPP_PIX_FMT_RGB32:
+            copy_rows(planes[0], strides[0], dst, dst_stride, width * 4, y0, y1);
+            return true;
+        case MIPP_PIX_FMT_RGBA64:
+            rgba64_to_rgba128f(planes[0], strides[0], dst, dst_stride, width, y0, y1);
+            return true;
+        case MIPP_PIX_FMT_RGB48:
+            rgb48_to_rgba128f(planes[0], strides[0], dst, dst_stride, width, y0, y1);
+            return true;
+        case MIPP_PIX_FMT_YUV420P10:
+            yuv420p10_to_rgba128f(planes, strides, dst, dst_stride, width, y0, y1);
+            return true;
+        case MIPP_PIX_FMT_P010:
+            p010_to_rgba128f(planes, strides, dst, dst_stride, width, y0, y1);
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    // Surface rows [y0, y1) -> packed host format. `high_bit_depth` says which surface format src is.
+    static bool pack(bool high_bit_depth, const uint8_t *src, int src_stride, int format, uint8_t *dst, int dst_stride, int width, int y0, int y1)
+    {
+        switch (format)
+        {
+        case MIPP_PIX_FMT_RGB32:
+            if (high_bit_depth)
+                rgba128f_to_rgb32(src, src_stride, dst, dst_stride, width, y0, y1);
+            else
+                copy_rows(src, src_stride, dst, dst_stride, width * 4, y0, y1);
+            return true;
+        case MIPP_PIX_FMT_RGBA64:
+            if (high_bit_depth)
+                rgba128f_to_rgba64(src, src_stride, dst, dst_stride, width, y0, y1);
+            else
+                rgb32_to_rgba64(src, src_stride, dst, dst_stride, width, y0, y1);
+            return true;
+        case MIPP_PIX_FMT_RGB48:
+            if (high_bit_depth)
+                rgba128f_to_rgb48(src, src_stride, dst, dst_stride, width, y0, y1);
+            else
+                rgb32_to_rgb48(src, src_stride, dst, dst_stride, width, y0, y1);
+            return true;
+        default:
+            return false;
+        }
+    }
+} // namespace
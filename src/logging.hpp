@@ -0,0 +1,253 @@
+// Copyright 2024 Mux, Inc.
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// Messages from scripts (and mipp itself) on their way to the host's log callback
+//
+// Producers only claim a slot of a bounded queue and move the text in, the host callback
+// (av_log in ffmpeg) runs on a drain thread, or on the caller after each frame when the
+// host's callback isn't thread safe. Messages that find the queue full are counted and
+// dropped rather than waited for. Level filtering and per call site rate limiting happen
+// in the log binding before any argument is converted to a string.
+namespace logging
+{
+    struct Entry
+    {
+        int level = 0;
+        std::string text;
+    };
+
+    // Bounded multi producer queue (Vyukov's), each slot's sequence number says whose turn it is
+    class Queue
+    {
+    private:
+        struct Slot
+        {
+            std::atomic<size_t> seq;
+            Entry entry;
+        };
+        std::vector<Slot> slots;
+        size_t mask;
+        alignas(64) std::atomic<size_t> head{0}; // next slot to write
+        alignas(64) size_t tail = 0;             // next slot to read, consumer only
+
+    public:
+        // size must be a power of two
+        explicit Queue(size_t size) : slots(size), mask(size - 1)
+        {
+            for (size_t i = 0; i < size; i++)
+            {
+                slots[i].seq.store(i, std::memory_order_relaxed);
+            }
+        }
+
+        bool push(Entry &&e)
+        {
+            auto pos = head.load(std::memory_order_relaxed);
+            for (;;)
+            {
+                auto &slot = slots[pos & mask];
+                auto diff = static_cast<intptr_t>(slot.seq.load(std::memory_order_acquire)) - static_cast<intptr_t>(pos);
+                if (diff == 0)
+                {
+                    if (head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    {
+                        slot.entry = std::move(e);
+                        slot.seq.store(pos + 1, std::memory_order_release);
+                        return true;
+                    }
+                }
+                else if (diff < 0)
+                {
+                    return false; // full
+                }
+                else
+                {
+                    pos = head.load(std::memory_order_relaxed);
+                }
+            }
+        }
+
+        bool pop(Entry &out)
+        {
+            auto &slot = slots[tail & mask];
+            if (slot.seq.load(std::memory_order_acquire) != tail + 1)
+            {
+                return false;
+            }
+            out = std::move(slot.entry);
+            slot.seq.store(tail + mask + 1, std::memory_order_release);
+            tail++;
+            return true;
+        }
+    };
+
+    // Token bucket per call site, see the "log_rate" option
+    class Limiter
+    {
+    private:
+        using clock = std::chrono::steady_clock;
+        struct Bucket
+        {
+            double tokens;
+            clock::time_point last;
+            uint64_t suppressed = 0;
+        };
+        std::unordered_map<uint64_t, Bucket> sites;
+        double per_second = 50;
+
+    public:
+        double rate() const { return per_second; }
+
+        void set_rate(double r)
+        {
+            per_second = r;
+            sites.clear();
+        }
+
+        // False if the site is over its rate. When it's let through again, `suppressed` is how
+        // many of its messages were held back meanwhile.
+        bool admit(uint64_t site, uint64_t &suppressed)
+        {
+            auto now = clock::now();
+            auto it = sites.find(site);
+            if (it == sites.end())
+            {
+                // A burst of one second's worth
+                it = sites.emplace(site, Bucket{per_second, now}).first;
+            }
+            auto &b = it->second;
+            b.tokens = std::min(per_second, b.tokens + std::chrono::duration<double>(now - b.last).count() * per_second);
+            b.last = now;
+            if (b.tokens < 1)
+            {
+                b.suppressed++;
+                return false;
+            }
+            b.tokens -= 1;
+            suppressed = b.suppressed;
+            b.suppressed = 0;
+            return true;
+        }
+    };
+
+    class Logger
+    {
+    private:
+        std::function<void(int level, const std::string &msg)> sink;
+        Queue queue{4096};
+        std::mutex draining; // one consumer at a time
+        std::thread thread;
+        std::mutex m;
+        std::condition_variable cv;
+        std::atomic<bool> idle{false};
+        bool quit = false;
+
+        void run()
+        {
+            for (;;)
+            {
+                drain();
+                std::unique_lock<std::mutex> lock(m);
+                if (quit)
+                {
+                    break;
+                }
+                idle.store(true);
+                // The timeout covers a push racing with going idle
+                cv.wait_for(lock, std::chrono::milliseconds(100));
+                idle.store(false);
+            }
+            drain();
+        }
+
+    public:
+        std::atomic<int> max_level{56}; // AV_LOG_TRACE, everything
+        std::atomic<uint64_t> dropped{0};
+        std::atomic<uint64_t> suppressed{0};
+
+        explicit Logger(std::function<void(int level, const std::string &msg)> sink) : sink(std::move(sink)) {}
+
+        ~Logger()
+        {
+            stop();
+        }
+
+        bool enabled(int level) const { return level <= max_level.load(std::memory_order_relaxed); }
+        bool threaded() const { return thread.joinable(); }
+
+        void push(int level, std::string text)
+        {
+            if (!queue.push({level, std::move(text)}))
+            {
+                dropped.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+            if (idle.load())
+            {
+                std::lock_guard<std::mutex> lock(m);
+                cv.notify_one();
+            }
+        }
+
+        // Hand everything queued to the host, on the calling thread
+        void drain()
+        {
+            std::lock_guard<std::mutex> lock(draining);
+            Entry e;
+            while (queue.pop(e))
+            {
+                sink(e.level, e.text);
+            }
+        }
+
+        void start()
+        {
+            if (!thread.joinable())
+            {
+                quit = false;
+                thread = std::thread([this]
+                                     { run(); });
+            }
+        }
+
+        // Back to draining on the caller, after the thread handed over what it had
+        void stop()
+        {
+            if (thread.joinable())
+            {
+                {
+                    std::lock_guard<std::mutex> lock(m);
+                    quit = true;
+                    cv.notify_one();
+                }
+                thread.join();
+            }
+            drain();
+        }
+    };
+} // namespace
@@ -13,45 +13,518 @@
 // limitations under the License.
 
 #include "cairo.hpp"
+#include "capture.hpp"
+#include "kernels.hpp"
 #include "mipp.h"
 
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
+#include <limits>
+#include <memory>
 #include <stdio.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static void usage(const char *name)
+{
+    fprintf(stderr,
+            "usage: %s <script> [options]\n"
+            "  -i <file.y4m>                 input, repeat for more pads. 10 bit 4:2:0 (C420p10) only\n"
+            "  -i <file>:<w>x<h>:<format>    rawvideo input, format rgb32, rgba64, rgb48, yuv420p10 or p010\n"
+            "  -r <fps>                      frame rate of rawvideo inputs (default 30)\n"
+            "  -n <frames>                   stop after this many frames per pad\n"
+            "  -o <file>                     write output frames as rawvideo, - for stdout (default: discard)\n"
+            "  -f <format>                   output format, rgb32 (default), rgba64 or rgb48\n"
+            "  --png <file>                  save the last output frame (rgb32 output only)\n"
+            "  --replay <file>               send the frames of a capture file instead of inputs\n"
+            "  --realtime                    pace sending like the source: capture arrival times or pts\n"
+            "  --loop <n>                    send the inputs n times\n"
+            "  --workers <n>                 run the script in n mipp_worker processes\n"
+            "  --set <key>=<value>           mipp_set_option, e.g. --set capture=prod.mcap\n"
+            "  --metadata                    print the metadata scripts attach to frames\n"
+            "With no inputs one blank 1920x1080 frame is sent and the result saved to test.png\n",
+            name);
+}
+
+static int parse_format(const std::string &name)
+{
+    static const char *const names[] = {"rgb32", "rgba64", "rgb48", "yuv420p10", "p010"};
+    for (int i = 0; i < 5; i++)
+    {
+        if (name == names[i])
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// A frame width or height at the start of `s`, `end` is set past its digits. Zero, negative
+// and sizes whose rows wouldn't fit an int are refused, as capture files refuse them
+static bool parse_dimension(const char *s, int &out, const char **end)
+{
+    char *e;
+    errno = 0;
+    auto v = std::strtol(s, &e, 10);
+    if (e == s || errno == ERANGE || v <= 0 || v > std::numeric_limits<int>::max() / 8)
+    {
+        return false;
+    }
+    out = static_cast<int>(v);
+    *end = e;
+    return true;
+}
+
+// A read only mapping of a whole file, read ahead of the frame being sent
+class Mapped
+{
+private:
+    const uint8_t *base = nullptr;
+    size_t bytes = 0;
+
+public:
+    ~Mapped()
+    {
+        if (base)
+        {
+            munmap(const_cast<uint8_t *>(base), bytes);
+        }
+    }
+
+    bool open(const std::string &path)
+    {
+        auto fd = ::open(path.c_str(), O_RDONLY);
+        struct stat st;
+        if (fd < 0 || fstat(fd, &st) != 0 || st.st_size == 0)
+        {
+            if (fd >= 0)
+                close(fd);
+            return false;
+        }
+        auto p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (p == MAP_FAILED)
+        {
+            return false;
+        }
+        base = static_cast<const uint8_t *>(p);
+        bytes = st.st_size;
+        madvise(p, bytes, MADV_SEQUENTIAL);
+        return true;
+    }
+
+    const uint8_t *data() const { return base; }
+    size_t size() const { return bytes; }
+
+    void prefetch(size_t offset, size_t length)
+    {
+        auto page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+        auto start = offset & ~(page - 1);
+        if (start < bytes)
+        {
+            madvise(const_cast<uint8_t *>(base) + start, std::min(length + (offset - start), bytes - start), MADV_WILLNEED);
+        }
+    }
+};
+
+// One pad's worth of frames from a Y4M or rawvideo file
+struct Input
+{
+    Mapped file;
+    int format = MIPP_PIX_FMT_RGB32;
+    int width = 0, height = 0;
+    double fps = 30;
+    size_t first = 0;       // offset of the first frame (its FRAME line for Y4M)
+    size_t frame_bytes = 0; // of pixel data
+    bool y4m = false;
+    size_t pos = 0;
+    int64_t index = 0;
+
+    bool open(const std::string &spec, double raw_fps)
+    {
+        auto colon = spec.find(':');
+        if (colon == std::string::npos)
+        {
+            return open_y4m(spec);
+        }
+
+        // path:WxH:format
+        const char *p = spec.c_str() + colon + 1;
+        if (!parse_dimension(p, width, &p) || *p != 'x' || !parse_dimension(p + 1, height, &p) || *p != ':' ||
+            (format = parse_format(p + 1)) < 0 || !file.open(spec.substr(0, colon)))
+        {
+            return false;
+        }
+        fps = raw_fps;
+        set_frame_bytes();
+        return true;
+    }
+
+    bool open_y4m(const std::string &path)
+    {
+        if (!file.open(path) || file.size() < 10 || std::memcmp(file.data(), "YUV4MPEG2 ", 10) != 0)
+        {
+            return false;
+        }
+
+        auto end = static_cast<const uint8_t *>(std::memchr(file.data(), '\n', file.size()));
+        if (!end)
+        {
+            return false;
+        }
+        std::string header(reinterpret_cast<const char *>(file.data()), end - file.data());
+        std::string colorspace = "420jpeg";
+        size_t i = 0;
+        while ((i = header.find(' ', i)) != std::string::npos)
+        {
+            auto token = header.substr(i + 1, header.find(' ', i + 1) - i - 1);
+            i++;
+            if (token.empty())
+                continue;
+            int num, den;
+            const char *rest;
+            switch (token[0])
+            {
+            case 'W':
+            case 'H':
+                if (!parse_dimension(token.c_str() + 1, token[0] == 'W' ? width : height, &rest) || *rest)
+                {
+                    fprintf(stderr, "%s: bad Y4M frame size %s\n", path.c_str(), token.c_str());
+                    return false;
+                }
+                break;
+            case 'F':
+                if (sscanf(token.c_str() + 1, "%d:%d", &num, &den) == 2 && num > 0 && den > 0)
+                    fps = static_cast<double>(num) / den;
+                break;
+            case 'C':
+                colorspace = token.substr(1);
+                break;
+            }
+        }
+
+        // The only Y4M layout mipp takes without conversion
+        if (colorspace != "420p10")
+        {
+            fprintf(stderr, "%s: unsupported Y4M colorspace C%s, convert with -pix_fmt yuv420p10le\n", path.c_str(), colorspace.c_str());
+            return false;
+        }
+        format = MIPP_PIX_FMT_YUV420P10;
+        y4m = true;
+        first = pos = end - file.data() + 1;
+        set_frame_bytes();
+        return width > 0 && height > 0;
+    }
+
+    void set_frame_bytes()
+    {
+        frame_bytes = 0;
+        for (int p = 0; p < kernels::plane_count(format); p++)
+        {
+            frame_bytes += capture::plane_bytes(format, p, width, height);
+        }
+    }
+
+    void rewind()
+    {
+        pos = first;
+    }
+
+    // Planes of the next frame, false at the end of the file
+    bool next(const uint8_t *planes[], int strides[], double &pts)
+    {
+        if (y4m)
+        {
+            // "FRAME" and optional parameters up to a newline
+            auto end = pos < file.size() ? static_cast<const uint8_t *>(std::memchr(file.data() + pos, '\n', file.size() - pos)) : nullptr;
+            if (!end || end - (file.data() + pos) < 5 || std::memcmp(file.data() + pos, "FRAME", 5) != 0)
+            {
+                return false;
+            }
+            pos = end - file.data() + 1;
+        }
+        if (pos + frame_bytes > file.size())
+        {
+            return false;
+        }
+
+        size_t offset = pos;
+        for (int p = 0; p < kernels::plane_count(format); p++)
+        {
+            planes[p] = file.data() + offset;
+            strides[p] = kernels::row_bytes(format, p, width);
+            offset += capture::plane_bytes(format, p, width, height);
+        }
+        pos = offset;
+        file.prefetch(pos, frame_bytes * 2);
+        pts = index++ / fps;
+        return true;
+    }
+};
+
+struct Output
+{
+    FILE *file = nullptr;
+    int format = MIPP_PIX_FMT_RGB32;
+    std::string png;
+    std::vector<uint8_t> last;
+    int last_width = 0, last_height = 0;
+    uint64_t frames = 0;
+};
 
 int main(int argc, char **argv)
 {
     if (argc < 2)
     {
-        fprintf(stderr, "usage: %s <url>\n", argv[0]);
+        usage(argv[0]);
         return 1;
     }
 
-    int w = 1920;
-    int h = 1080;
-    std::vector<uint8_t> video_data(w * h * 4);
+    std::vector<std::string> input_specs;
+    std::vector<std::pair<std::string, std::string>> options;
+    std::string output_path, replay_path;
+    Output out;
+    double raw_fps = 30;
+    int64_t max_frames = -1;
+    int loops = 1, workers = 0;
+    bool realtime = false, metadata = false;
 
-    int channels = 2;
-    int sample_count = 1024;
-    int _sample_rate = 48000;
-    std::vector<uint8_t> audio_data(sample_count * channels * 2);
+    for (int i = 2; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        auto value = [&]() -> std::string
+        {
+            if (i + 1 >= argc)
+            {
+                usage(argv[0]);
+                exit(1);
+            }
+            return argv[++i];
+        };
 
-    mipp_t mipp;
-    mipp_init(
-        &mipp, argv[1], nullptr,
-        [](void *opaque, int width, int height, double pts, uint8_t *data) -> int
+        if (arg == "-i")
+            input_specs.push_back(value());
+        else if (arg == "-r")
+            raw_fps = std::stod(value());
+        else if (arg == "-n")
+            max_frames = std::stoll(value());
+        else if (arg == "-o")
+            output_path = value();
+        else if (arg == "-f")
+            out.format = parse_format(value());
+        else if (arg == "--png")
+            out.png = value();
+        else if (arg == "--replay")
+            replay_path = value();
+        else if (arg == "--realtime")
+            realtime = true;
+        else if (arg == "--loop")
+            loops = std::stoi(value());
+        else if (arg == "--metadata")
+            metadata = true;
+        else if (arg == "--workers")
+            workers = std::stoi(value());
+        else if (arg == "--set")
+        {
+            auto kv = value();
+            auto eq = kv.find('=');
+            options.emplace_back(kv.substr(0, eq), eq == std::string::npos ? "" : kv.substr(eq + 1));
+        }
+        else
+        {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (!kernels::bytes_per_pixel(out.format))
+    {
+        fprintf(stderr, "unsupported output format\n");
+        return 1;
+    }
+
+    std::vector<std::unique_ptr<Input>> inputs;
+    for (auto &spec : input_specs)
+    {
+        inputs.push_back(std::make_unique<Input>());
+        if (!inputs.back()->open(spec, raw_fps))
         {
-            fprintf(stderr, "received video frame: %dx%d\n", width, height);
-            auto c = cairo(width, height, data);
-            c.save_png("test.png");
-            return 0;
-        },
-        [](int level, const char *msg)
+            fprintf(stderr, "can not open input %s\n", spec.c_str());
+            return 1;
+        }
+    }
+
+    capture::Reader replay;
+    if (!replay_path.empty() && !replay.open(replay_path))
+    {
+        fprintf(stderr, "can not open capture %s\n", replay_path.c_str());
+        return 1;
+    }
+
+    // The original smoke test: one blank frame to test.png
+    std::vector<uint8_t> blank;
+    if (inputs.empty() && replay_path.empty())
+    {
+        blank.resize(1920 * 1080 * 4);
+        inputs.push_back(std::make_unique<Input>());
+        inputs.back()->width = 1920;
+        inputs.back()->height = 1080;
+        if (out.png.empty())
+            out.png = "test.png";
+        max_frames = 1;
+    }
+
+    if (!output_path.empty())
+    {
+        out.file = output_path == "-" ? stdout : fopen(output_path.c_str(), "wb");
+        if (!out.file)
         {
-            fprintf(stderr, "log: %d: %s\n", level, msg);
-        });
+            fprintf(stderr, "can not open output %s\n", output_path.c_str());
+            return 1;
+        }
+    }
 
-    fprintf(stderr, "sending video frame: %dx%d\n", w, h);
-    mipp_send_video_frame(&mipp, w, h, w * 4, 0.0, video_data.data(), 0);
+    auto receive = [](void *opaque, int width, int height, double pts, uint8_t *data) -> int
+    {
+        auto out = reinterpret_cast<Output *>(opaque);
+        auto bytes = static_cast<size_t>(width) * height * kernels::bytes_per_pixel(out->format);
+        out->frames++;
+        if (out->file)
+        {
+            fwrite(data, bytes, 1, out->file);
+        }
+        if (!out->png.empty())
+        {
+            out->last.assign(data, data + bytes);
+            out->last_width = width;
+            out->last_height = height;
+        }
+        return 0;
+    };
+    auto log = [](int level, const char *msg)
+    {
+        fprintf(stderr, "log: %d: %s\n", level, msg);
+    };
+
+    mipp_t mipp = {};
+    auto err = workers > 0 ? mipp_init_worker(&mipp, argv[1], nullptr, workers, 0, &out, receive, log)
+                           : mipp_init(&mipp, argv[1], &out, receive, log);
+    if (err < 0)
+    {
+        return 1;
+    }
+    mipp_set_video_out_format(&mipp, out.format);
+    if (metadata)
+    {
+        mipp_set_metadata_callback(&mipp, nullptr, [](void *, double pts, const char *key, const char *value)
+                                   { fprintf(stderr, "metadata: %.3f %s=%s\n", pts, key, value); });
+    }
+    for (auto &o : options)
+    {
+        if (mipp_set_option(&mipp, o.first.c_str(), o.second.c_str()) < 0)
+        {
+            fprintf(stderr, "unknown option %s\n", o.first.c_str());
+        }
+    }
+
+    // Real time pacing: wait until `offset` seconds after the start
+    auto start = std::chrono::steady_clock::now();
+    auto pace = [&](double offset)
+    {
+        if (realtime)
+        {
+            std::this_thread::sleep_until(start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(offset)));
+        }
+    };
+
+    uint64_t sent = 0;
+    if (!replay_path.empty())
+    {
+        capture::Reader::Frame f;
+        for (int loop = 0; loop < loops; loop++)
+        {
+            auto loop_start = std::chrono::steady_clock::now();
+            replay.rewind();
+            for (int64_t n = 0; replay.next(f) && (max_frames < 0 || n < max_frames); n++)
+            {
+                if (realtime)
+                    std::this_thread::sleep_until(loop_start + std::chrono::nanoseconds(f.record.arrival_ns));
+                mipp_send_video_frame_planes(&mipp, f.record.format, f.record.width, f.record.height, f.strides, f.record.pts,
+                                             const_cast<uint8_t *const *>(f.planes), f.record.pad);
+                sent++;
+            }
+        }
+    }
+    else
+    {
+        double duration = 0;
+        for (int loop = 0; loop < loops; loop++)
+        {
+            for (auto &in : inputs)
+                in->rewind();
+
+            // One frame per pad and step, pad 0 first, until any input runs out
+            for (int64_t n = 0; max_frames < 0 || n < max_frames; n++)
+            {
+                double pts = 0;
+                bool more = true;
+                for (size_t pad = 0; pad < inputs.size() && more; pad++)
+                {
+                    auto &in = *inputs[pad];
+                    const uint8_t *planes[4] = {blank.data()};
+                    int strides[4] = {in.width * 4};
+                    double frame_pts = n / in.fps;
+                    if (blank.empty() && !(more = in.next(planes, strides, frame_pts)))
+                        break;
+                    if (pad == 0)
+                    {
+                        pts = duration + frame_pts;
+                        pace(pts);
+                    }
+                    mipp_send_video_frame_planes(&mipp, in.format, in.width, in.height, strides, pts, const_cast<uint8_t *const *>(planes), pad);
+                    sent++;
+                }
+                if (!more)
+                    break;
+            }
+            duration += inputs[0]->index / inputs[0]->fps;
+            for (auto &in : inputs)
+                in->index = 0;
+        }
+    }
+
+    mipp_flush(&mipp);
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    mipp_stats_t stats;
+    mipp_get_stats(&mipp, &stats);
+    fprintf(stderr, "%llu frames in, %llu out in %.3f s, %.1f fps\n", (unsigned long long)sent, (unsigned long long)out.frames,
+            elapsed.count(), sent / elapsed.count());
+    if (stats.script_errors || stats.overruns || stats.skipped)
+    {
+        fprintf(stderr, "%llu script errors, %llu overruns, %llu skipped, %llu late\n", (unsigned long long)stats.script_errors,
+                (unsigned long long)stats.overruns, (unsigned long long)stats.skipped, (unsigned long long)stats.late);
+    }
 
     mipp_free(&mipp);
+
+    if (!out.png.empty() && !out.last.empty() && out.format == MIPP_PIX_FMT_RGB32)
+    {
+        auto c = cairo(out.last_width, out.last_height, out.last.data());
+        c.save_png(out.png.c_str());
+    }
+    if (out.file && out.file != stdout)
+    {
+        fclose(out.file);
+    }
+    return 0;
 }
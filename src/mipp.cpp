@@ -13,9 +13,26 @@
 // limitations under the License.
 
 #include "mipp.h"
+#include "analyze.hpp"
 #include "cairo.hpp"
+#include "client.hpp"
+#include "engine.hpp"
+#include "history.hpp"
+#include "image.hpp"
+#include "kernels.hpp"
+#include "logging.hpp"
+#include "prerender.hpp"
+#include "profile.hpp"
+#include "reload.hpp"
+#include "rendercache.hpp"
+#include "scheduler.hpp"
+#include "shade.hpp"
+#include "timeline.hpp"
+#include "wasm.hpp"
+#include "watchdog.hpp"
 
 #include <iostream>
+#include <limits>
 
 static std::string load_script(std::string filename)
 {
@@ -27,69 +44,1261 @@ static std::string load_script(std::string filename)
 
 ezv8::V8Platform platform = ezv8::V8Platform();
 
-class Mipp
+class Mipp : public Engine
 {
 private:
     std::unique_ptr<v8::Isolate, void (*)(v8::Isolate *)> isolate;
     v8::HandleScope handle_scope;
     v8::Local<v8::ObjectTemplate> global_templ;
 
-    v8::Persistent<v8::Context> persistent_context;
+    v8::Global<v8::Context> persistent_context;
 
-    v8::Local<v8::Function> receive_video_frame_func;
+    v8::Global<v8::Function> receive_video_frame_func;
+    v8::Global<v8::Function> receive_video_frames_func; // optional, takes a mipp_send_video_frames batch at once
     std::function<void(int width, int height, double pts, uint8_t *data)> receive_video_frame_callback;
     std::function<void(int level, std::string msg)> log_callback;
 
-    v8::Local<v8::Function> VideoFrameCtor;
+    v8::Global<v8::Function> VideoFrameCtor;
+
+    v8::Global<v8::Value> frame_memory;
+    v8::Global<v8::Function> frame_alloc;
 
     int videoInPads = 1;
+    int videoOutPads = 1;
+    int videoOutFormat = MIPP_PIX_FMT_RGB32;
+    std::vector<uint8_t> egress; // packed output when the surface can't be handed out as is
+    uint64_t frames_out = 0;
+
+    ScriptReloader reloader;
+
+    Watchdog watchdog;
+    std::chrono::microseconds budget{0}, cpu_budget{0};
+    int overrun_policy = MIPP_OVERRUN_PASSTHROUGH;
+    int late_policy = MIPP_OVERRUN_PASSTHROUGH;
+    Scheduler scheduler;
+    std::vector<uint8_t> scratch;  // input converted for passthrough
+    std::vector<uint8_t> last_out; // kept for MIPP_OVERRUN_REPEAT
+    int last_width = 0, last_height = 0;
+    mipp_stats_t stats = {};
+
+    // Output pad 0 scaled for each of Engine::renditions, the filter taps are kept while sizes don't change
+    struct Rendition
+    {
+        int src_width = 0, src_height = 0;
+        std::unique_ptr<kernels::Taps> h, v;
+        std::vector<uint8_t> out;
+    };
+    std::vector<Rendition> rendition_state;
+
+    // Elements the script registered with timeline_add, and the draw callbacks of those
+    // that have one. A script without receive_video_frame is driven by its timeline alone.
+    timeline::Timeline timeline;
+    std::unordered_map<uint32_t, v8::Global<v8::Function>> cues;
+    bool timeline_only = false;
+    std::vector<const timeline::Element *> live;
+
+    // Input frames as received, see keep_history
+    history::Ring history;
+    std::vector<std::pair<const mipp_frame_t *, history::Pixels>> kept; // this batch's, see remember
+
+    // Buffers over the side data of the frames being delivered, see lend_side_data
+    std::vector<v8::Global<v8::ArrayBuffer>> lent;
+
+    // Between log() and log_callback, see logging.hpp. log_thread false drains after each frame
+    logging::Logger logs{[this](int level, const std::string &msg)
+                         { log_callback(level, msg); }};
+    logging::Limiter log_limiter;
+    bool log_thread = true;
+
+    // render_overlay(pts) rendered ahead by a second copy of the script, see prerender.hpp.
+    // is_prerenderer is that copy, prerender_depth 0 renders every overlay on the spot.
+    std::unique_ptr<prerender::Lookahead> lookahead;
+    size_t prerender_depth = 0;
+    bool prerender_allowed = true;
+    bool is_prerenderer = false;
+    double overlay_pts = NAN;
+
+    // See the "profile" options, signal_prefix is empty unless SIGUSR2 toggles profiling
+    std::unique_ptr<profile::Session> profiling;
+    bool profile_heap = false;
+    std::string profile_signal_prefix;
+    uint32_t profile_signals_seen = 0;
+
+    // The script a reload replaced, kept until the new one gets through its first frame
+    struct Previous
+    {
+        v8::Global<v8::Context> context;
+        v8::Global<v8::Function> receive_video_frame_func;
+        v8::Global<v8::Function> receive_video_frames_func;
+        v8::Global<v8::Function> VideoFrameCtor;
+        v8::Global<v8::Value> frame_memory;
+        v8::Global<v8::Function> frame_alloc;
+        timeline::Timeline timeline;
+        std::unordered_map<uint32_t, v8::Global<v8::Function>> cues;
+        bool timeline_only;
+        std::string source;
+        std::string path;
+    };
+    std::unique_ptr<Previous> previous;
+
+    // The text and path of the script the live context runs, which the file on disk (or the
+    // reloader's path, before a reload commits) need not be
+    std::string source;
+    std::string source_path;
+
+    void log(int level, const std::string &msg)
+    {
+        if (!logs.enabled(level))
+        {
+            return;
+        }
+        logs.push(level, msg);
+        if (!logs.threaded())
+        {
+            logs.drain();
+        }
+    }
+
+    std::string describe(const v8::TryCatch &try_catch)
+    {
+        if (try_catch.HasTerminated())
+        {
+            return "script terminated";
+        }
+        std::string what = *v8::String::Utf8Value(isolate.get(), try_catch.Exception());
+        auto message = try_catch.Message();
+        if (message.IsEmpty())
+        {
+            return what;
+        }
+        auto context = isolate->GetCurrentContext();
+        std::string where = *v8::String::Utf8Value(isolate.get(), message->GetScriptResourceName());
+        return where + ":" + std::to_string(message->GetLineNumber(context).FromMaybe(0)) + ": " + what;
+    }
+
+    // Run a compiled script's top level in `context` and pick up its entry points
+    bool install(v8::Local<v8::Context> context, v8::Local<v8::Script> script)
+    {
+        v8::TryCatch try_catch(isolate.get());
+        if (script->Run(context).IsEmpty())
+        {
+            log(16, describe(try_catch));
+            return false;
+        }
+
+        auto func = context->Global()->Get(context, v8::String::NewFromUtf8(isolate.get(), "VideoFrame").ToLocalChecked()).ToLocalChecked();
+        if (func->IsFunction())
+        {
+            VideoFrameCtor.Reset(isolate.get(), func.As<v8::Function>());
+        }
+
+        func = context->Global()->Get(context, v8::String::NewFromUtf8(isolate.get(), "receive_video_frames").ToLocalChecked()).ToLocalChecked();
+        if (func->IsFunction())
+        {
+            receive_video_frames_func.Reset(isolate.get(), func.As<v8::Function>());
+        }
+
+        func = context->Global()->Get(context, v8::String::NewFromUtf8(isolate.get(), "receive_video_frame").ToLocalChecked()).ToLocalChecked();
+        timeline_only = !func->IsFunction() && receive_video_frames_func.IsEmpty() && !timeline.empty();
+        if (timeline_only)
+        {
+            return true;
+        }
+        if (!func->IsFunction() && !receive_video_frames_func.IsEmpty())
+        {
+            return true;
+        }
+        if (!func->IsFunction())
+        {
+            log(16, "receive_video_frame is not defined");
+            return false;
+        }
+        receive_video_frame_func.Reset(isolate.get(), func.As<v8::Function>());
+        return true;
+    }
+
+    // The surface behind a VideoFrame (or loadImage result), nullptr for anything else
+    static cairo *surface_of(v8::Local<v8::Value> value)
+    {
+        if (!value->IsObject() || value.As<v8::Object>()->InternalFieldCount() < 1)
+        {
+            return nullptr;
+        }
+        return reinterpret_cast<cairo *>(v8::Local<v8::External>::Cast(value.As<v8::Object>()->GetInternalField(0))->Value());
+    }
+
+    // An optional {x, y, width, height} argument of the analysis methods, the whole frame by default
+    static analyze::Region region_arg(v8::Local<v8::Context> ctx, const v8::FunctionCallbackInfo<v8::Value> &args, int index, const cairo &canvas)
+    {
+        analyze::Region r = {0, 0, canvas.width(), canvas.height()};
+        if (args.Length() > index && args[index]->IsObject())
+        {
+            auto obj = args[index].As<v8::Object>();
+            auto get = [&](const char *name, int fallback)
+            {
+                auto v = obj->Get(ctx, v8::String::NewFromUtf8(args.GetIsolate(), name).ToLocalChecked()).ToLocalChecked();
+                return v->IsNumber() ? static_cast<int>(v->NumberValue(ctx).FromJust()) : fallback;
+            };
+            r.x = get("x", 0);
+            r.y = get("y", 0);
+            r.width = get("width", canvas.width() - r.x);
+            r.height = get("height", canvas.height() - r.y);
+        }
+        return r.clip(canvas.width(), canvas.height());
+    }
+
+    // timeline_add's argument, throws a TypeError into the script when it doesn't make sense
+    static bool to_element(v8::Isolate *iso, v8::Local<v8::Context> ctx, v8::Local<v8::Value> value, timeline::Element &e, v8::Local<v8::Function> &draw)
+    {
+        auto fail = [iso](const std::string &why)
+        {
+            iso->ThrowException(v8::Exception::TypeError(v8::String::NewFromUtf8(iso, ("timeline_add: " + why).c_str()).ToLocalChecked()));
+            return false;
+        };
+        if (!value->IsObject())
+        {
+            return fail("expected an object");
+        }
+        auto spec = value.As<v8::Object>();
+        auto get = [&](const char *name)
+        {
+            return spec->Get(ctx, v8::String::NewFromUtf8(iso, name).ToLocalChecked()).ToLocalChecked();
+        };
+        auto number = [&](const char *name, double &out)
+        {
+            auto v = get(name);
+            if (!v->IsNumber())
+            {
+                return false;
+            }
+            out = v->NumberValue(ctx).FromJust();
+            return true;
+        };
+
+        double duration = 0;
+        if (!number("start", e.start) || !(number("end", e.end) || (number("duration", duration) && (e.end = e.start + duration, true))) || e.end < e.start)
+        {
+            return fail("needs a start and an end (or duration) after it");
+        }
+        number("fade_in", e.fade_in);
+        number("fade_out", e.fade_out);
+        e.fade_in = std::min(std::max(0.0, e.fade_in), (e.end - e.start) / 2);
+        e.fade_out = std::min(std::max(0.0, e.fade_out), (e.end - e.start) / 2);
+
+        auto curve = get("curve");
+        if (!curve->IsUndefined() && !timeline::curve_from_string(*v8::String::Utf8Value(iso, curve), e.curve))
+        {
+            return fail("unknown curve " + std::string(*v8::String::Utf8Value(iso, curve)));
+        }
+
+        // keyframes: {name: [[seconds since start, value], ...], ...}
+        auto keyframes = get("keyframes");
+        if (keyframes->IsObject())
+        {
+            auto names = keyframes.As<v8::Object>()->GetOwnPropertyNames(ctx).ToLocalChecked();
+            for (uint32_t i = 0; i < names->Length(); i++)
+            {
+                auto name = names->Get(ctx, i).ToLocalChecked();
+                auto keys = keyframes.As<v8::Object>()->Get(ctx, name).ToLocalChecked();
+                timeline::Track track = {*v8::String::Utf8Value(iso, name), {}};
+                if (!keys->IsArray())
+                {
+                    return fail("keyframes for " + track.name + " must be an array of [time, value]");
+                }
+                auto arr = keys.As<v8::Array>();
+                for (uint32_t k = 0; k < arr->Length(); k++)
+                {
+                    auto key = arr->Get(ctx, k).ToLocalChecked();
+                    if (!key->IsArray() || key.As<v8::Array>()->Length() < 2)
+                    {
+                        return fail("keyframes for " + track.name + " must be an array of [time, value]");
+                    }
+                    track.keys.emplace_back(key.As<v8::Array>()->Get(ctx, 0).ToLocalChecked()->NumberValue(ctx).FromMaybe(0.0),
+                                            key.As<v8::Array>()->Get(ctx, 1).ToLocalChecked()->NumberValue(ctx).FromMaybe(0.0));
+                }
+                std::stable_sort(track.keys.begin(), track.keys.end(), [](const std::pair<double, double> &a, const std::pair<double, double> &b)
+                                 { return a.first < b.first; });
+                e.tracks.push_back(std::move(track));
+            }
+        }
+
+        // Plain x and y are constant tracks
+        for (auto name : {"x", "y"})
+        {
+            double v;
+            if (!e.track(name) && number(name, v))
+            {
+                e.tracks.push_back({name, {{0, v}}});
+            }
+        }
+
+        for (auto field : {std::make_pair("text", &e.text), std::make_pair("font", &e.font), std::make_pair("fill", &e.fill)})
+        {
+            auto v = get(field.first);
+            if (v->IsString())
+            {
+                *field.second = *v8::String::Utf8Value(iso, v);
+            }
+        }
+
+        auto fn = get("draw");
+        e.callback = fn->IsFunction();
+        if (e.callback)
+        {
+            draw = fn.As<v8::Function>();
+        }
+        else if (e.text.empty())
+        {
+            return fail("needs a draw function or a text");
+        }
+        return true;
+    }
+
+    void stash()
+    {
+        previous = std::make_unique<Previous>();
+        previous->context = std::move(persistent_context);
+        previous->receive_video_frame_func = std::move(receive_video_frame_func);
+        previous->receive_video_frames_func = std::move(receive_video_frames_func);
+        previous->VideoFrameCtor = std::move(VideoFrameCtor);
+        previous->frame_memory = std::move(frame_memory);
+        previous->frame_alloc = std::move(frame_alloc);
+        previous->timeline = std::move(timeline);
+        previous->cues = std::move(cues);
+        previous->timeline_only = timeline_only;
+        previous->source = std::move(source);
+        previous->path = std::move(source_path);
+        timeline = timeline::Timeline();
+        cues.clear();
+    }
+
+    void restore()
+    {
+        persistent_context = std::move(previous->context);
+        receive_video_frame_func = std::move(previous->receive_video_frame_func);
+        receive_video_frames_func = std::move(previous->receive_video_frames_func);
+        VideoFrameCtor = std::move(previous->VideoFrameCtor);
+        frame_memory = std::move(previous->frame_memory);
+        frame_alloc = std::move(previous->frame_alloc);
+        timeline = std::move(previous->timeline);
+        cues = std::move(previous->cues);
+        timeline_only = previous->timeline_only;
+        source = std::move(previous->source);
+        source_path = std::move(previous->path);
+        reloader.revert(source_path);
+        previous.reset();
+    }
+
+    // Frame boundary: swap in a reloaded script once its background compile is done.
+    // The new script runs in a fresh context, the old one stays around until the new
+    // one has handled a frame.
+    void reload()
+    {
+        auto pads = videoInPads, out_pads = videoOutPads;
+        stash();
+
+        auto context = v8::Context::New(isolate.get(), nullptr, global_templ);
+        context->Global()->SetInternalField(0, v8::External::New(isolate.get(), this));
+        auto context_scope = v8::Context::Scope(context);
+        persistent_context.Reset(isolate.get(), context);
+
+        v8::TryCatch try_catch(isolate.get());
+        v8::Local<v8::Script> script;
+        auto ok = reloader.finish(isolate.get(), context).ToLocal(&script);
+        if (!ok)
+        {
+            log(16, describe(try_catch));
+        }
+        ok = ok && install(context, script);
+
+        // Pads are negotiated with the host once, at init
+        if (videoInPads != pads || videoOutPads != out_pads)
+        {
+            log(24, "reload: make_pads can not change the number of pads of a running filter");
+            videoInPads = pads;
+            videoOutPads = out_pads;
+        }
+
+        if (!ok)
+        {
+            log(16, "reload: " + reloader.script_path() + " failed, keeping the previous script");
+            restore();
+            return;
+        }
+        source = reloader.source_text();
+        source_path = reloader.script_path();
+        log(32, "reload: loaded " + source_path);
+    }
 
 public:
-    int inputPads() const { return videoInPads; }
+    int inputPads() const override { return videoInPads; }
+    int outputPads() const override { return videoOutPads + static_cast<int>(renditions.size()); }
+    // Whether a stand-in may repeat the last output, which then has to be kept: overruns need a
+    // budget and late frames a latency
+    bool may_repeat() const
+    {
+        return (overrun_policy == MIPP_OVERRUN_REPEAT && (budget.count() || cpu_budget.count())) ||
+               (late_policy == MIPP_OVERRUN_REPEAT && scheduler.enabled());
+    }
+
+    void emit(int width, int height, double pts, uint8_t *data, int pad = 0)
+    {
+        auto size = static_cast<size_t>(width) * height * kernels::bytes_per_pixel(videoOutFormat);
+        if (pad == 0 && may_repeat() && data != last_out.data())
+        {
+            last_out.assign(data, data + size);
+            last_width = width;
+            last_height = height;
+        }
+        else if (pad == 0 && !last_out.empty() && !may_repeat())
+        {
+            std::vector<uint8_t>().swap(last_out);
+        }
+        frames_out++;
+        stats.frames_out++;
+        if (pad_callback)
+        {
+            pad_callback(pad, width, height, pts, data);
+        }
+        else if (pad == 0)
+        {
+            receive_video_frame_callback(width, height, pts, data);
+        }
+        if (pad == 0)
+        {
+            fan_out(width, height, pts, data);
+        }
+    }
+
+    // Every rendition from one output, so the script runs once however many there are
+    void fan_out(int width, int height, double pts, const uint8_t *data)
+    {
+        auto bpp = kernels::bytes_per_pixel(videoOutFormat);
+        for (size_t i = 0; i < renditions.size(); i++)
+        {
+            auto &r = rendition_state[i];
+            auto w = renditions[i].first, h = renditions[i].second;
+            if (r.src_width != width || r.src_height != height)
+            {
+                r.h = std::make_unique<kernels::Taps>(width, w);
+                r.v = std::make_unique<kernels::Taps>(height, h);
+                r.src_width = width;
+                r.src_height = height;
+            }
+            r.out.resize(static_cast<size_t>(w) * h * bpp);
+            parallel_rows(h, [&](int y0, int y1)
+                          { kernels::resize(videoOutFormat, data, width * bpp, width, *r.h, *r.v, r.out.data(), w * bpp, w, y0, y1); });
+            emit(w, h, pts, r.out.data(), videoOutPads + static_cast<int>(i));
+        }
+    }
+
+    // False (and the frame counted as dropped) if the host's crop is outside a width x height frame
+    bool crop_fits(int width, int height, double pts)
+    {
+        if (crop.x + crop.width > width || crop.y + crop.height > height)
+        {
+            stats.dropped++;
+            log(24, "crop does not fit the " + std::to_string(width) + "x" + std::to_string(height) + " frame at pts " + std::to_string(pts));
+            return false;
+        }
+        return true;
+    }
+
+    // Output a surface the script is done with, converted to the output format
+    void output(cairo *canvas, double pts, int pad = 0)
+    {
+        auto width = canvas->width(), height = canvas->height();
+        const uint8_t *src = canvas->data();
+        canvas->flush();
+
+        // The host's crop of the script's outputs, only the rectangle is converted
+        if (crop.width > 0 && pad < videoOutPads)
+        {
+            if (!crop_fits(width, height, pts))
+            {
+                return;
+            }
+            src += static_cast<size_t>(crop.y) * canvas->stride() + static_cast<size_t>(crop.x) * (canvas->is_float() ? 16 : 4);
+            width = crop.width;
+            height = crop.height;
+        }
+
+        // 8 bit surfaces already match RGB32 output, everything else is converted
+        auto bpp = kernels::bytes_per_pixel(videoOutFormat);
+        if (!canvas->is_float() && videoOutFormat == MIPP_PIX_FMT_RGB32 && canvas->stride() == width * bpp)
+        {
+            emit(width, height, pts, const_cast<uint8_t *>(src), pad);
+            return;
+        }
+
+        egress.resize(static_cast<size_t>(width) * height * bpp);
+        parallel_rows(height, [&](int y0, int y1)
+                      { kernels::pack(canvas->is_float(), src, canvas->stride(), videoOutFormat, egress.data(), width * bpp, width, y0, y1); });
+        emit(width, height, pts, egress.data(), pad);
+    }
+
+    // Output the host's frame as it came in, converted to the output format, with the
+    // natively drawn timeline elements in `overlay` on top
+    void passthrough(int format, int width, int height, const int *strides, double pts, uint8_t *const *planes, const std::vector<const timeline::Element *> &overlay = {})
+    {
+        auto high_bit_depth = kernels::is_high_bit_depth(format);
+        auto scratch_stride = width * (high_bit_depth ? 16 : 4);
+        auto bpp = kernels::bytes_per_pixel(videoOutFormat);
+        scratch.resize(static_cast<size_t>(scratch_stride) * height);
+        if (overlay.empty())
+        {
+            // Only the rows of the host's crop are unpacked, and only its rectangle packed
+            int x = 0, y = 0, w = width, h = height;
+            if (crop.width > 0)
+            {
+                if (!crop_fits(width, height, pts))
+                {
+                    return;
+                }
+                x = crop.x;
+                y = crop.y;
+                w = crop.width;
+                h = crop.height;
+            }
+            auto origin = scratch.data() + static_cast<size_t>(y) * scratch_stride + static_cast<size_t>(x) * (high_bit_depth ? 16 : 4);
+            egress.resize(static_cast<size_t>(w) * h * bpp);
+            parallel_rows(h, [&](int y0, int y1)
+                          {
+                              kernels::unpack(format, planes, strides, scratch.data(), scratch_stride, width, y + y0, y + y1);
+                              kernels::pack(high_bit_depth, origin, scratch_stride, videoOutFormat, egress.data(), w * bpp, w, y0, y1); });
+            emit(w, h, pts, egress.data());
+            return;
+        }
+
+        parallel_rows(height, [&](int y0, int y1)
+                      { kernels::unpack(format, planes, strides, scratch.data(), scratch_stride, width, y0, y1); });
+        cairo canvas(width, height, scratch.data(), scratch_stride, nullptr, high_bit_depth ? CAIRO_FORMAT_RGBA128F : CAIRO_FORMAT_ARGB32);
+        canvas.mark_dirty();
+        for (auto e : overlay)
+        {
+            draw_text(canvas, *e, pts);
+        }
+        output(&canvas, pts);
+    }
+
+    // A timeline element without a draw callback: its text, faded, at its (keyframed) x, y
+    static void draw_text(cairo &canvas, const timeline::Element &e, double pts)
+    {
+        auto alpha = e.alpha(pts) * e.value("alpha", pts, 1);
+        if (e.text.empty() || alpha <= 0)
+        {
+            return;
+        }
+        auto rgba = color_from_string(e.fill);
+        canvas.save();
+        canvas.set_font(e.font);
+        canvas.fillStyle((rgba >> 24) & 255, (rgba >> 16) & 255, (rgba >> 8) & 255, static_cast<uint8_t>((rgba & 255) * std::min(1.0, alpha)));
+        canvas.fillText(e.text, e.value("x", pts, 0), e.value("y", pts, 0));
+        canvas.restore();
+    }
+
+    // Run the draw callbacks (and natively draw the rest) of the elements live at pts on frame `f`
+    bool run_cues(v8::Local<v8::Context> context, v8::Local<v8::Object> f, cairo *canvas, double pts, const v8::TryCatch &try_catch)
+    {
+        timeline.active(pts, live);
+        if (live.empty())
+        {
+            return true;
+        }
+
+        // Callbacks may add or remove elements, which moves them around
+        std::vector<timeline::Element> current;
+        for (auto e : live)
+        {
+            current.push_back(*e);
+        }
+
+        auto iso = isolate.get();
+        for (auto &e : current)
+        {
+            auto cue = cues.find(e.id);
+            if (!e.callback || cue == cues.end())
+            {
+                draw_text(*canvas, e, pts);
+                continue;
+            }
+
+            auto state = v8::Object::New(iso);
+            state->Set(context, v8::String::NewFromUtf8(iso, "alpha").ToLocalChecked(), v8::Number::New(iso, e.alpha(pts))).FromJust();
+            state->Set(context, v8::String::NewFromUtf8(iso, "progress").ToLocalChecked(), v8::Number::New(iso, e.progress(pts))).FromJust();
+            state->Set(context, v8::String::NewFromUtf8(iso, "elapsed").ToLocalChecked(), v8::Number::New(iso, pts - e.start)).FromJust();
+            for (auto &t : e.tracks)
+            {
+                state->Set(context, v8::String::NewFromUtf8(iso, t.name.c_str()).ToLocalChecked(), v8::Number::New(iso, t.at(pts - e.start, e.curve))).FromJust();
+            }
+
+            v8::Handle<v8::Value> args[] = {f, state};
+            canvas->save();
+            auto ok = !cue->second.Get(iso)->Call(context, context->Global(), 2, args).IsEmpty();
+            canvas->restore();
+            if (!ok)
+            {
+                if (!try_catch.HasTerminated())
+                {
+                    log(16, describe(try_catch));
+                }
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Output something cheap for a frame the script didn't handle, following a mipp_overrun policy
+    void stand_in(int policy, const mipp_frame_t &in)
+    {
+        // Outputs follow pad 0, frames from other pads have nothing to stand in for
+        if (in.in_pad != 0)
+        {
+            return;
+        }
+        if (policy == MIPP_OVERRUN_REPEAT && !last_out.empty())
+        {
+            stats.repeated++;
+            emit(last_width, last_height, in.pts, last_out.data());
+        }
+        else if (policy != MIPP_OVERRUN_DROP)
+        {
+            stats.passed_through++;
+            passthrough(in.format, in.width, in.height, in.strides, in.pts, in.planes);
+        }
+        else
+        {
+            stats.dropped++;
+        }
+    }
+
+    // A batch gets one stand-in, for its pad 0 frame
+    void stand_in(int policy, const mipp_frame_t *frames, int count)
+    {
+        for (int i = 0; i < count; i++)
+        {
+            if (frames[i].in_pad == 0)
+            {
+                stand_in(policy, frames[i]);
+                return;
+            }
+        }
+    }
+
+    void start_prerender()
+    {
+        // The text the live context runs, the file may have changed since or failed to reload
+        auto path = source_path;
+        auto text = source;
+        int level = logs.max_level;
+        auto wall = budget, cpu = cpu_budget;
+        lookahead = std::make_unique<prerender::Lookahead>(
+            [this, path, text, level, wall, cpu](const prerender::Publish &publish)
+            {
+                auto helper = std::make_shared<Mipp>(
+                    path, [](int, int, double, uint8_t *) {},
+                    [this](int level, std::string msg)
+                    { logs.push(level, "prerender: " + msg); },
+                    [&publish](v8::Isolate *iso)
+                    { publish([iso]
+                              { iso->TerminateExecution(); }); },
+                    text);
+                helper->logs.max_level = level;
+                helper->budget = wall;
+                helper->cpu_budget = cpu;
+                return prerender::Renderer{
+                    [helper](double pts, prerender::Surface &out)
+                    { return helper->render_overlay_at(pts, out); }};
+            },
+            prerender_depth);
+    }
+
+    // On the prerenderer's thread: render_overlay(pts), copied out packed
+    bool render_overlay_at(double pts, prerender::Surface &out)
+    {
+        auto scope = v8::HandleScope(isolate.get());
+        auto context = v8::Local<v8::Context>::New(isolate.get(), persistent_context);
+        auto context_scope = v8::Context::Scope(context);
+        v8::TryCatch try_catch(isolate.get());
+
+        watchdog.arm(budget, cpu_budget);
+        v8::Local<v8::Value> func, frame;
+        v8::Local<v8::Value> args[] = {v8::Number::New(isolate.get(), pts)};
+        auto ok = context->Global()->Get(context, v8::String::NewFromUtf8(isolate.get(), "render_overlay").ToLocalChecked()).ToLocal(&func) &&
+                  func->IsFunction() && func.As<v8::Function>()->Call(context, context->Global(), 1, args).ToLocal(&frame);
+        watchdog.disarm();
+
+        auto canvas = ok ? surface_of(frame) : nullptr;
+        if (canvas)
+        {
+            canvas->flush();
+            auto row = static_cast<size_t>(canvas->width()) * (canvas->is_float() ? 16 : 4);
+            out.width = canvas->width();
+            out.height = canvas->height();
+            out.is_float = canvas->is_float();
+            out.pixels = std::make_shared<std::vector<uint8_t>>(row * out.height);
+            for (int y = 0; y < out.height; y++)
+            {
+                std::memcpy(out.pixels->data() + y * row, canvas->data() + static_cast<size_t>(y) * canvas->stride(), row);
+            }
+        }
+        else if (try_catch.HasCaught() && !try_catch.HasTerminated())
+        {
+            log(16, describe(try_catch));
+        }
+        else if (ok)
+        {
+            log(16, "render_overlay must return a VideoFrame");
+        }
+        logs.drain();
+        return canvas != nullptr;
+    }
+
+    void start_profile(const std::string &prefix)
+    {
+        stop_profile();
+        profiling = std::make_unique<profile::Session>(isolate.get(), prefix, profile_heap);
+        log(32, "profiling to " + profiling->prefix());
+    }
+
+    void stop_profile()
+    {
+        if (!profiling)
+        {
+            return;
+        }
+        if (profiling->finish())
+            log(32, "profile written to " + profiling->prefix() + (profile_heap ? ".cpuprofile and .heapprofile" : ".cpuprofile"));
+        else
+            log(16, "could not write profile " + profiling->prefix());
+        profiling.reset();
+    }
+
+    int set_option(const std::string &key, const std::string &value) override
+    {
+        if (key == "watch")
+        {
+            // Milliseconds between checks of the script's mtime, 0 stops watching
+            reloader.watch(std::chrono::milliseconds(std::atoi(value.c_str())));
+            return 0;
+        }
+        if (key == "budget_ms" || key == "budget_cpu_ms")
+        {
+            auto us = std::chrono::microseconds(static_cast<int64_t>(std::max(0.0, std::atof(value.c_str())) * 1000));
+            if (key == "budget_cpu_ms" && us.count() && !Watchdog::has_cpu_clock)
+            {
+                return -1;
+            }
+            (key == "budget_ms" ? budget : cpu_budget) = us;
+            return 0;
+        }
+        if (key == "overrun" || key == "late")
+        {
+            auto &policy = key == "overrun" ? overrun_policy : late_policy;
+            if (value == "passthrough")
+                policy = MIPP_OVERRUN_PASSTHROUGH;
+            else if (value == "repeat")
+                policy = MIPP_OVERRUN_REPEAT;
+            else if (value == "drop")
+                policy = MIPP_OVERRUN_DROP;
+            else
+                return -1;
+            return 0;
+        }
+        if (key == "renditions")
+        {
+            if (!parse_renditions(value, renditions))
+            {
+                return -1;
+            }
+            rendition_state.clear();
+            rendition_state.resize(renditions.size());
+            return 0;
+        }
+        if (key == "profile")
+        {
+            value.empty() ? stop_profile() : start_profile(value);
+            return 0;
+        }
+        if (key == "profile_heap")
+        {
+            profile_heap = value == "1";
+            return 0;
+        }
+        if (key == "profile_signal")
+        {
+            if (!value.empty())
+            {
+                profile::install_signal();
+                profile_signals_seen = profile::signals().load();
+            }
+            profile_signal_prefix = value;
+            return 0;
+        }
+        if (key == "crop")
+        {
+            return parse_crop(value, crop) ? 0 : -1;
+        }
+        if (key == "prerender")
+        {
+            prerender_allowed = value != "0";
+            if (!prerender_allowed)
+            {
+                lookahead.reset();
+            }
+            return 0;
+        }
+        if (key == "log_level")
+        {
+            logs.max_level = std::atoi(value.c_str());
+            return 0;
+        }
+        if (key == "log_rate")
+        {
+            log_limiter.set_rate(std::max(0.0, std::atof(value.c_str())));
+            return 0;
+        }
+        if (key == "log_thread")
+        {
+            log_thread = value != "0";
+            if (!log_thread)
+            {
+                logs.stop();
+            }
+            return 0;
+        }
+        if (key == "history_mb")
+        {
+            history.set_budget(static_cast<uint64_t>(std::max(0.0, std::atof(value.c_str())) * (1 << 20)));
+            return 0;
+        }
+        if (key == "render_cache_mb")
+        {
+            rendercache::limit() = static_cast<uint64_t>(std::max(0.0, std::atof(value.c_str())) * (1 << 20));
+            return 0;
+        }
+        if (key == "latency_ms")
+        {
+            scheduler.set_latency(Scheduler::ms(std::max(0.0, std::atof(value.c_str()))));
+            return 0;
+        }
+        return -1;
+    }
+
+    void get_stats(mipp_stats_t *out) override
+    {
+        *out = stats;
+        auto &s = scheduler.stats();
+        out->skipped = s.skipped;
+        out->late = s.late;
+        out->max_lateness_ms = s.max_lateness_ms;
+        out->avg_cost_ms = s.avg_cost_ms;
+        out->frame_interval_ms = s.frame_interval_ms;
+        out->log_dropped = logs.dropped;
+        out->log_suppressed = logs.suppressed;
+    }
+
+    void request_reload(const std::string &path) override
+    {
+        reloader.request(path);
+    }
+
+    int set_video_out_format(int format) override
+    {
+        if (!kernels::bytes_per_pixel(format))
+        {
+            return -1;
+        }
+        videoOutFormat = format;
+        return 0;
+    }
+
     int send_video_frame(int width, int height, int stride, double pts, uint8_t *data, int in_pad_index)
+    {
+        return send_video_frame(MIPP_PIX_FMT_RGB32, width, height, &stride, pts, &data, in_pad_index);
+    }
+
+    int send_video_frame(int format, int width, int height, const int *strides, double pts, uint8_t *const *planes, int in_pad_index) override
+    {
+        if (format < MIPP_PIX_FMT_RGB32 || format > MIPP_PIX_FMT_P010)
+        {
+            return -1;
+        }
+        mipp_frame_t frame = {format, width, height, {}, {}, pts, in_pad_index};
+        for (int i = 0; i < kernels::plane_count(format); i++)
+        {
+            frame.strides[i] = strides[i];
+            frame.planes[i] = planes[i];
+        }
+        return submit(&frame, 1);
+    }
+
+    int send_video_frames(const mipp_frame_t *frames, int count) override
+    {
+        for (int i = 0; i < count; i++)
+        {
+            if (frames[i].format < MIPP_PIX_FMT_RGB32 || frames[i].format > MIPP_PIX_FMT_P010)
+            {
+                return -1;
+            }
+        }
+        return count > 0 ? submit(frames, count) : 0;
+    }
+
+    // One event's frames: reloads, scheduling and the frame budget apply to the batch as a whole
+    int submit(const mipp_frame_t *frames, int count)
+    {
+        auto scope = v8::HandleScope(isolate.get());
+        if (log_thread && !logs.threaded())
+        {
+            logs.start();
+        }
+        if (!profile_signal_prefix.empty())
+        {
+            auto signals = profile::signals().load(std::memory_order_relaxed);
+            if (signals != profile_signals_seen)
+            {
+                profile_signals_seen = signals;
+                profiling ? stop_profile() : start_profile(profile_signal_prefix);
+            }
+        }
+        if (profiling)
+        {
+            profiling->mark(stats.frames_in, frames[0].pts);
+        }
+        stats.frames_in += count;
+        if (reloader.poll(isolate.get()))
+        {
+            watchdog.arm(budget, cpu_budget);
+            reload();
+            watchdog.disarm();
+        }
+
+        remember(frames, count);
+
+        auto pts = frames[0].pts;
+        if (!scheduler.admit(pts))
+        {
+            kept.clear();
+            stand_in(late_policy, frames, count);
+            return 0;
+        }
+
+        auto started = Scheduler::clock::now();
+        auto emitted = frames_out;
+        watchdog.arm(budget, cpu_budget);
+        auto ret = deliver(frames, count);
+        auto terminated = watchdog.disarm();
+        if (previous)
+        {
+            if (ret < 0 || terminated)
+            {
+                log(16, "reload: first frame failed, keeping the previous script");
+                restore();
+                if (frames_out == emitted)
+                {
+                    watchdog.arm(budget, cpu_budget);
+                    ret = deliver(frames, count);
+                    terminated = watchdog.disarm();
+                }
+            }
+            else
+            {
+                previous.reset();
+                // The next overlay() starts one on the script that just committed
+                lookahead.reset();
+            }
+        }
+
+        scheduler.finished(pts, started);
+        kept.clear();
+
+        if (terminated)
+        {
+            stats.overruns++;
+            log(24, "script ran out of its frame budget at pts " + std::to_string(pts));
+            if (frames_out == emitted)
+            {
+                stand_in(overrun_policy, frames, count);
+            }
+            return 0;
+        }
+        if (ret < 0)
+        {
+            stats.script_errors++;
+        }
+        return ret;
+    }
+
+    // Every input frame goes into history as it arrived, whether the script gets to see it or
+    // not. make_frame copies the unpacked rows from here instead of unpacking them again.
+    void remember(const mipp_frame_t *frames, int count)
+    {
+        kept.clear();
+        if (!history.enabled())
+        {
+            return;
+        }
+        for (int i = 0; i < count; i++)
+        {
+            auto &in = frames[i];
+            auto high_bit_depth = kernels::is_high_bit_depth(in.format);
+            auto data = history.push(in.in_pad, in.width, in.height, high_bit_depth, in.pts);
+            if (!data)
+            {
+                continue;
+            }
+            auto stride = in.width * (high_bit_depth ? 16 : 4);
+            parallel_rows(in.height, [&](int y0, int y1)
+                          { kernels::unpack(in.format, in.planes, in.strides, data, stride, in.width, y0, y1); });
+            kept.emplace_back(&in, history.at(in.in_pad, 0)->pixels);
+        }
+    }
+
+    // Enter the script once for the whole batch, side data lent to it is taken back after
+    int deliver(const mipp_frame_t *frames, int count)
+    {
+        auto ret = enter(frames, count);
+        if (!logs.threaded())
+        {
+            logs.drain();
+        }
+        if (!lent.empty())
+        {
+            auto scope = v8::HandleScope(isolate.get());
+            for (auto &buffer : lent)
+            {
+                // Views the script kept read as empty from now on
+                buffer.Get(isolate.get())->Detach(v8::Local<v8::Value>()).FromMaybe(false);
+            }
+            lent.clear();
+        }
+        return ret;
+    }
+
+    // Scripts with receive_video_frames get the batch in one call, the others (and timeline
+    // driven ones) one receive_video_frame call per entry
+    int enter(const mipp_frame_t *frames, int count)
     {
         auto scope = v8::HandleScope(isolate.get());
         auto context = v8::Local<v8::Context>::New(isolate.get(), persistent_context);
         auto context_scope = v8::Context::Scope(context);
+        v8::TryCatch try_catch(isolate.get());
+
+        auto batched = !timeline_only && !receive_video_frames_func.IsEmpty() && (count > 1 || receive_video_frame_func.IsEmpty());
+        if (!batched)
+        {
+            auto ret = 0;
+            for (int i = 0; i < count && !try_catch.HasTerminated(); i++)
+            {
+                auto frame_scope = v8::HandleScope(isolate.get());
+                ret = std::min(ret, deliver(context, try_catch, frames[i]));
+            }
+            return ret;
+        }
 
-        if (receive_video_frame_func.IsEmpty())
+        auto list = v8::Array::New(isolate.get(), count);
+        auto pads = v8::Array::New(isolate.get(), count);
+        for (int i = 0; i < count; i++)
         {
+            v8::Local<v8::Object> f;
+            cairo *canvas;
+            if (!make_frame(context, try_catch, frames[i], f, canvas))
+            {
+                return -1;
+            }
+            if (!timeline.empty() && frames[i].in_pad == 0 && !run_cues(context, f, canvas, frames[i].pts, try_catch))
+            {
+                return -1;
+            }
+            list->Set(context, i, f).FromJust();
+            pads->Set(context, i, v8::Number::New(isolate.get(), frames[i].in_pad)).FromJust();
+        }
+
+        v8::Handle<v8::Value> args[] = {list, pads};
+        if (receive_video_frames_func.Get(isolate.get())->Call(context, context->Global(), 2, args).IsEmpty())
+        {
+            if (!try_catch.HasTerminated())
+            {
+                log(16, describe(try_catch));
+            }
             return -1;
         }
+        return 0;
+    }
 
-        // Create AVFrame in JS and copy pixel data to it
+    // A VideoFrame holding a copy of `in`, logs and returns false on failure
+    bool make_frame(v8::Local<v8::Context> context, v8::TryCatch &try_catch, const mipp_frame_t &in, v8::Local<v8::Object> &f, cairo *&canvas)
+    {
+        auto high_bit_depth = kernels::is_high_bit_depth(in.format);
+        int frameArgc = 3;
         v8::Handle<v8::Value> frameArgs[] = {
-            v8::Number::New(isolate.get(), width),
-            v8::Number::New(isolate.get(), height),
-            v8::Number::New(isolate.get(), pts)};
-        auto f = VideoFrameCtor->NewInstance(context, 3, frameArgs).ToLocalChecked();
-        auto obj = v8::Local<v8::Object>::Cast(f);
-        auto buffer = obj->Get(context, v8::String::NewFromUtf8(isolate.get(), "data").ToLocalChecked()).ToLocalChecked().As<v8::Uint32Array>();
+            v8::Number::New(isolate.get(), in.width),
+            v8::Number::New(isolate.get(), in.height),
+            v8::Number::New(isolate.get(), in.pts),
+            v8::Undefined(isolate.get()),
+            v8::Undefined(isolate.get()),
+            v8::Undefined(isolate.get())};
+
+        // Land the frame directly in the script's wasm memory, see set_frame_memory
+        if (!frame_alloc.IsEmpty())
+        {
+            v8::Handle<v8::Value> allocArgs[] = {
+                v8::Number::New(isolate.get(), in.in_pad),
+                v8::Number::New(isolate.get(), in.width * in.height * (high_bit_depth ? 16 : 4))};
+            if (!frame_alloc.Get(isolate.get())->Call(context, context->Global(), 2, allocArgs).ToLocal(&frameArgs[4]))
+            {
+                log(16, describe(try_catch));
+                return false;
+            }
+            frameArgs[3] = frame_memory.Get(isolate.get());
+            frameArgc = 5;
+        }
+
+        if (high_bit_depth)
+        {
+            frameArgs[frameArgc++] = v8::String::NewFromUtf8(isolate.get(), "rgba128f").ToLocalChecked();
+        }
 
-        for (int y = 0; y < height; y++)
+        if (!VideoFrameCtor.Get(isolate.get())->NewInstance(context, frameArgc, frameArgs).ToLocal(&f))
         {
-            auto src = reinterpret_cast<uint8_t *>(data) + y * stride;
-            auto dest = reinterpret_cast<uint8_t *>(buffer->Buffer()->Data()) + y * width * 4;
-            std::memcpy(dest, src, width * 4);
+            log(16, describe(try_catch));
+            return false;
         }
 
-        v8::Handle<v8::Value> args[] = {f, v8::Number::New(isolate.get(), in_pad_index)};
-        auto result = receive_video_frame_func->Call(context, context->Global(), 2, args);
-        return 0; // TODO return value
+        if (in.side_data_count > 0)
+        {
+            lend_side_data(context, in, f);
+        }
+
+        canvas = reinterpret_cast<cairo *>(v8::Local<v8::External>::Cast(f->GetInternalField(0))->Value());
+        const uint8_t *copy = nullptr;
+        for (auto &k : kept)
+        {
+            if (k.first == &in)
+            {
+                copy = k.second->data();
+            }
+        }
+        auto row = static_cast<size_t>(in.width) * (high_bit_depth ? 16 : 4);
+        parallel_rows(in.height, [&](int y0, int y1)
+                      {
+                          if (!copy)
+                          {
+                              kernels::unpack(in.format, in.planes, in.strides, canvas->data(), canvas->stride(), in.width, y0, y1);
+                              return;
+                          }
+                          // Already unpacked into history, see remember
+                          for (int y = y0; y < y1; y++)
+                          {
+                              std::memcpy(canvas->data() + static_cast<size_t>(y) * canvas->stride(), copy + y * row, row);
+                          } });
+        canvas->mark_dirty();
+        return true;
+    }
+
+    // frame.sideData: a Uint8Array over each block of the host's side data, no copy. The
+    // buffers are detached once the script returns, see deliver.
+    void lend_side_data(v8::Local<v8::Context> context, const mipp_frame_t &in, v8::Local<v8::Object> f)
+    {
+        static const char *names[MIPP_SIDE_DATA_TYPES] = {"motionVectors", "regionsOfInterest", "closedCaptions", "seiUnregistered"};
+        auto iso = isolate.get();
+        auto side_data = v8::Object::New(iso);
+        for (int i = 0; i < in.side_data_count; i++)
+        {
+            auto &sd = in.side_data[i];
+            if (sd.type < 0 || sd.type >= MIPP_SIDE_DATA_TYPES || !sd.data)
+            {
+                continue;
+            }
+            auto store = v8::ArrayBuffer::NewBackingStore(const_cast<uint8_t *>(sd.data), sd.size, v8::BackingStore::EmptyDeleter, nullptr);
+            auto buffer = v8::ArrayBuffer::New(iso, std::move(store));
+            lent.emplace_back(iso, buffer);
+            side_data->Set(context, v8::String::NewFromUtf8(iso, names[sd.type]).ToLocalChecked(), v8::Uint8Array::New(buffer, 0, sd.size)).FromJust();
+        }
+        f->Set(context, v8::String::NewFromUtf8(iso, "sideData").ToLocalChecked(), side_data).FromJust();
+    }
+
+    int deliver(v8::Local<v8::Context> context, v8::TryCatch &try_catch, const mipp_frame_t &in)
+    {
+        if (timeline_only)
+        {
+            // Outputs follow pad 0
+            if (in.in_pad != 0)
+            {
+                stats.dropped++;
+                return 0;
+            }
+
+            // Frames with nothing live, or only natively drawn elements, never reach JS
+            timeline.active(in.pts, live);
+            if (std::none_of(live.begin(), live.end(), [this](const timeline::Element *e)
+                             { return e->callback && cues.count(e->id); }))
+            {
+                if (live.empty())
+                {
+                    stats.idle++;
+                }
+                passthrough(in.format, in.width, in.height, in.strides, in.pts, in.planes, live);
+                return 0;
+            }
+        }
+        else if (receive_video_frame_func.IsEmpty())
+        {
+            return -1;
+        }
+
+        // Create AVFrame in JS and copy pixel data to it
+        v8::Local<v8::Object> f;
+        cairo *canvas;
+        if (!make_frame(context, try_catch, in, f, canvas))
+        {
+            return -1;
+        }
+
+        if (!timeline.empty() && in.in_pad == 0 && !run_cues(context, f, canvas, in.pts, try_catch))
+        {
+            return -1;
+        }
+        if (timeline_only)
+        {
+            output(canvas, in.pts);
+            return 0;
+        }
+
+        v8::Handle<v8::Value> args[] = {f, v8::Number::New(isolate.get(), in.in_pad)};
+        if (receive_video_frame_func.Get(isolate.get())->Call(context, context->Global(), 2, args).IsEmpty())
+        {
+            if (!try_catch.HasTerminated())
+            {
+                log(16, describe(try_catch));
+            }
+            return -1;
+        }
+        return 0;
     };
 
     Mipp(const std::string &script_path,
          std::function<void(int width, int height, double pts, uint8_t *data)> receive_video_frame_callback,
-         std::function<void(int level, std::string msg)> log_callback)
+         std::function<void(int level, std::string msg)> log_callback,
+         std::function<void(v8::Isolate *)> prerenderer = nullptr,
+         std::string script_source = {})
         : isolate(std::unique_ptr<v8::Isolate, void (*)(v8::Isolate *)>(
               v8::Isolate::New(ezv8::make_params()),
               [](v8::Isolate *i)
               { i->Dispose(); })),
-          handle_scope(isolate.get()), global_templ(v8::ObjectTemplate::New(isolate.get())) // I dont think we need to save this in the object?
+          handle_scope(isolate.get()), global_templ(v8::ObjectTemplate::New(isolate.get())) // kept for the fresh contexts made by reload
           ,
-          receive_video_frame_callback(receive_video_frame_callback), log_callback(log_callback)
+          receive_video_frame_callback(receive_video_frame_callback), log_callback(log_callback), reloader(script_path), watchdog(isolate.get())
     {
+        // The prerenderer's copy can be interrupted from here on, running the script included
+        is_prerenderer = static_cast<bool>(prerenderer);
+        if (prerenderer)
+        {
+            prerenderer(isolate.get());
+        }
         isolate->Enter();                       // manually enter and exit the isolate
+        isolate->SetWasmStreamingCallback(wasm::streaming_callback);
         global_templ->SetInternalFieldCount(1); // Used to track `this` for callbacks
 
         auto receive_video_frame = v8::FunctionTemplate::New(isolate.get(), [](const v8::FunctionCallbackInfo<v8::Value> &args)
@@ -97,24 +1306,37 @@ public:
                                                                  auto iso = args.GetIsolate();
                                                                  auto ctx = iso->GetCurrentContext();
                                                                  auto scope = v8::HandleScope(iso);
+                                                                 if (args.Length() < 1 || !args[0]->IsObject() || args[0].As<v8::Object>()->InternalFieldCount() < 1)
+                                                                 {
+                                                                     iso->ThrowException(v8::Exception::TypeError(v8::String::NewFromUtf8(iso, "send_video_frame: expected a VideoFrame").ToLocalChecked()));
+                                                                     return;
+                                                                 }
+
                                                                  auto obj = v8::Local<v8::Object>::Cast(args[0]);
 
-                                                                 auto width = obj->Get(ctx, v8::String::NewFromUtf8(args.GetIsolate(), "_width").ToLocalChecked()).ToLocalChecked()->NumberValue(ctx).FromJust();
-                                                                 auto height = obj->Get(ctx, v8::String::NewFromUtf8(args.GetIsolate(), "_height").ToLocalChecked()).ToLocalChecked()->NumberValue(ctx).FromJust();
                                                                  auto pts = obj->Get(ctx, v8::String::NewFromUtf8(args.GetIsolate(), "pts").ToLocalChecked()).ToLocalChecked()->NumberValue(ctx).FromJust();
-                                                                 auto data = obj->Get(ctx, v8::String::NewFromUtf8(args.GetIsolate(), "data").ToLocalChecked()).ToLocalChecked().As<v8::Uint32Array>();
-                                                                 auto buffer = data->Buffer();
-
-                                                                 // TODO validate values
-                                                                 auto expectedLength = static_cast<int>(width * height * 4);
-                                                                 if (expectedLength == 0 || buffer->ByteLength() != expectedLength)
+                                                                 auto mipp = reinterpret_cast<Mipp *>(v8::Local<v8::External>::Cast(args.Holder()->GetInternalField(0))->Value());
+                                                                 auto canvas = reinterpret_cast<cairo *>(v8::Local<v8::External>::Cast(obj->GetInternalField(0))->Value());
+                                                                 auto pad = args.Length() >= 2 ? static_cast<int>(args[1]->NumberValue(ctx).FromMaybe(-1.0)) : 0;
+                                                                 if (pad < 0 || pad >= mipp->videoOutPads)
                                                                  {
-                                                                     std::cerr << "send_frame: invalid frame size " << expectedLength << " != " << buffer->ByteLength() << std::endl;
-                                                                     exit(-1);
+                                                                     iso->ThrowException(v8::Exception::RangeError(v8::String::NewFromUtf8(iso, "send_video_frame: no such output pad, see make_pads").ToLocalChecked()));
+                                                                     return;
                                                                  }
 
-                                                                 auto mipp = reinterpret_cast<Mipp *>(v8::Local<v8::External>::Cast(args.Holder()->GetInternalField(0))->Value());
-                                                                 mipp->receive_video_frame_callback(width, height, pts, reinterpret_cast<uint8_t *>(buffer->Data()));
+                                                                 // Key/values from frame.setMetadata go out just ahead of the frame
+                                                                 auto metadata = obj->Get(ctx, v8::String::NewFromUtf8(iso, "metadata").ToLocalChecked()).ToLocalChecked();
+                                                                 if (mipp->metadata_callback && metadata->IsObject())
+                                                                 {
+                                                                     auto keys = metadata.As<v8::Object>()->GetOwnPropertyNames(ctx).ToLocalChecked();
+                                                                     for (uint32_t i = 0; i < keys->Length(); i++)
+                                                                     {
+                                                                         auto key = keys->Get(ctx, i).ToLocalChecked();
+                                                                         auto value = metadata.As<v8::Object>()->Get(ctx, key).ToLocalChecked();
+                                                                         mipp->metadata_callback(pts, *v8::String::Utf8Value(iso, key), *v8::String::Utf8Value(iso, value));
+                                                                     }
+                                                                 }
+                                                                 mipp->output(canvas, pts, pad);
                                                                  // TODO return value
                                                              });
 
@@ -131,29 +1353,86 @@ public:
                                                                 pts = args[2]->NumberValue(ctx).FromJust();
                                                             }
 
-                                                            auto arrayBuffer = v8::Uint32Array::New(v8::ArrayBuffer::New(iso, width * height * 4), 0, width * height);
+                                                            // A trailing "rgba128f" argument makes a float frame for high bit depth video,
+                                                            // its `data` is a Float32Array of premultiplied R, G, B, A
+                                                            auto format = CAIRO_FORMAT_ARGB32;
+                                                            if (args.Length() >= 4 && args[args.Length() - 1]->IsString())
+                                                            {
+                                                                auto name = ezv8::to_type(ctx, ezv8::tag<std::string>, args[args.Length() - 1]);
+                                                                if (name != "rgba128f" && name != "rgb32")
+                                                                {
+                                                                    iso->ThrowException(v8::Exception::TypeError(v8::String::NewFromUtf8(iso, ("VideoFrame: unknown format " + name).c_str()).ToLocalChecked()));
+                                                                    return;
+                                                                }
+                                                                format = name == "rgba128f" ? CAIRO_FORMAT_RGBA128F : CAIRO_FORMAT_ARGB32;
+                                                            }
+                                                            auto bpp = format == CAIRO_FORMAT_RGBA128F ? 16 : 4;
+
+                                                            // new VideoFrame(w, h, pts, buffer, byteOffset[, byteStride]) aliases pixels already
+                                                            // living in an ArrayBuffer or WebAssembly.Memory instead of allocating new ones
+                                                            size_t offset = 0;
+                                                            int stride = width * bpp;
+                                                            v8::Local<v8::ArrayBuffer> buffer;
+                                                            std::shared_ptr<v8::BackingStore> keepalive;
+                                                            auto alias = args.Length() >= 4 && (args[3]->IsArrayBuffer() || args[3]->IsWasmMemoryObject());
+                                                            if (alias)
+                                                            {
+                                                                buffer = args[3]->IsWasmMemoryObject() ? args[3].As<v8::WasmMemoryObject>()->Buffer() : args[3].As<v8::ArrayBuffer>();
+                                                                int64_t start = args.Length() >= 5 ? args[4]->IntegerValue(ctx).FromMaybe(-1) : 0;
+                                                                if (args.Length() >= 6 && args[5]->IsNumber())
+                                                                {
+                                                                    stride = args[5]->Int32Value(ctx).FromMaybe(0);
+                                                                }
+                                                                // (h - 1) * stride + w * bpp <= length - offset, in 64 bits so none of it can wrap
+                                                                auto length = buffer->ByteLength();
+                                                                if (width < 0 || height < 0 || start < 0 || static_cast<uint64_t>(start) > length || start % 4 != 0 ||
+                                                                    stride % 4 != 0 || static_cast<int64_t>(stride) < static_cast<int64_t>(width) * bpp ||
+                                                                    (width > 0 && height > 0 &&
+                                                                     static_cast<uint64_t>(height - 1) * static_cast<uint64_t>(stride) + static_cast<uint64_t>(width) * bpp > length - static_cast<uint64_t>(start)))
+                                                                {
+                                                                    iso->ThrowException(v8::Exception::RangeError(v8::String::NewFromUtf8(iso, "VideoFrame: frame does not fit in buffer").ToLocalChecked()));
+                                                                    return;
+                                                                }
+                                                                offset = static_cast<size_t>(start);
+                                                                keepalive = buffer->GetBackingStore();
+                                                            }
+                                                            else
+                                                            {
+                                                                if (width < 0 || height < 0 || static_cast<uint64_t>(width) * bpp > std::numeric_limits<int>::max() ||
+                                                                    (height > 0 && static_cast<uint64_t>(width) * height * bpp > v8::TypedArray::kMaxLength))
+                                                                {
+                                                                    iso->ThrowException(v8::Exception::RangeError(v8::String::NewFromUtf8(iso, "VideoFrame: frame is too large").ToLocalChecked()));
+                                                                    return;
+                                                                }
+                                                                buffer = v8::ArrayBuffer::New(iso, static_cast<size_t>(width) * height * bpp);
+                                                            }
+
+                                                            // `data` spans the rows, `stride` is its elements per row (the width unless aliased)
+                                                            auto span = width > 0 && height > 0 ? (static_cast<size_t>(height - 1) * stride + static_cast<size_t>(width) * bpp) / 4 : 0;
+                                                            v8::Local<v8::TypedArray> arrayBuffer;
+                                                            if (format == CAIRO_FORMAT_RGBA128F)
+                                                                arrayBuffer = v8::Float32Array::New(buffer, offset, span);
+                                                            else
+                                                                arrayBuffer = v8::Uint32Array::New(buffer, offset, span);
                                                             args.This()->Set(ctx, v8::String::NewFromUtf8(iso, "_width").ToLocalChecked(), v8::Number::New(args.GetIsolate(), width)).FromJust();
                                                             args.This()->Set(ctx, v8::String::NewFromUtf8(iso, "_height").ToLocalChecked(), v8::Number::New(args.GetIsolate(), height)).FromJust();
                                                             args.This()->Set(ctx, v8::String::NewFromUtf8(iso, "pts").ToLocalChecked(), v8::Number::New(args.GetIsolate(), pts)).FromJust();
                                                             args.This()->Set(ctx, v8::String::NewFromUtf8(iso, "data").ToLocalChecked(), arrayBuffer).FromJust();
-                                                            auto data = reinterpret_cast<uint8_t *>(arrayBuffer->Buffer()->Data());
-                                                            auto c = new cairo(width, height, data);
+                                                            args.This()->Set(ctx, v8::String::NewFromUtf8(iso, "stride").ToLocalChecked(), v8::Number::New(iso, stride / 4)).FromJust();
+                                                            args.This()->Set(ctx, v8::String::NewFromUtf8(iso, "format").ToLocalChecked(), v8::String::NewFromUtf8(iso, bpp == 16 ? "rgba128f" : "rgb32").ToLocalChecked()).FromJust();
+                                                            auto data = reinterpret_cast<uint8_t *>(buffer->Data()) + offset;
+                                                            auto c = new cairo(width, height, data, stride, keepalive, format);
                                                             args.This()->SetInternalField(0, v8::External::New(iso, c));
 
-                                                            if (args.Length() >= 4)
+                                                            if (args.Length() >= 4 && !alias && !args[3]->IsString())
                                                             {
                                                                 // TODO more checks
                                                                 auto srcFrame = v8::Local<v8::Object>::Cast(args[3]);
-                                                                if (srcFrame->IsObject())
+                                                                if (srcFrame->IsObject() && srcFrame->InternalFieldCount() >= 1)
                                                                 {
-                                                                    auto srcWidth = srcFrame->Get(ctx, v8::String::NewFromUtf8(iso, "_width").ToLocalChecked()).ToLocalChecked()->NumberValue(ctx).FromJust();
-                                                                    auto srcHeight = srcFrame->Get(ctx, v8::String::NewFromUtf8(iso, "_height").ToLocalChecked()).ToLocalChecked()->NumberValue(ctx).FromJust();
-                                                                    auto srcPts = srcFrame->Get(ctx, v8::String::NewFromUtf8(iso, "pts").ToLocalChecked()).ToLocalChecked()->NumberValue(ctx).FromJust();
-                                                                    auto srcData = srcFrame->Get(ctx, v8::String::NewFromUtf8(iso, "data").ToLocalChecked()).ToLocalChecked().As<v8::Uint32Array>();
-
-                                                                    // Make a temp canvas sharing the same buffer as the source frame
-                                                                    auto tmp = cairo(srcWidth, srcHeight, reinterpret_cast<uint8_t *>(srcData->Buffer()->Data()));
-                                                                    c->drawImage(&tmp, 0, 0, srcWidth, srcHeight);
+                                                                    // Draw straight from the source frame's surface, whatever its format or backing memory
+                                                                    auto src = reinterpret_cast<cairo *>(v8::Local<v8::External>::Cast(srcFrame->GetInternalField(0))->Value());
+                                                                    c->drawImage(src, 0, 0, src->width(), src->height());
                                                                 }
                                                             }
                                                             args.GetReturnValue().Set(args.This());
@@ -170,6 +1449,8 @@ public:
         ezv8::NewAccessor(isolate.get(), VideoFrameTmpl, "fillStyle", &cairo::get_fillStyle, &cairo::set_fillStyle);
         ezv8::NewAccessor(isolate.get(), VideoFrameTmpl, "strokeStyle", &cairo::get_strokeStyle, &cairo::set_strokeStyle);
         ezv8::NewAccessor(isolate.get(), VideoFrameTmpl, "font", &cairo::get_font, &cairo::set_font);
+        // "native" (default) draws pixel aligned rectangles and unscaled images without cairo, "cairo" always uses cairo
+        ezv8::NewAccessor(isolate.get(), VideoFrameTmpl, "backend", &cairo::get_backend, &cairo::set_backend);
         ezv8::NewObjectMethod(isolate.get(), VideoFrameTmpl, "rotate", &cairo::rotate);
         ezv8::NewObjectMethod(isolate.get(), VideoFrameTmpl, "translate", &cairo::translate);
         ezv8::NewObjectMethod(isolate.get(), VideoFrameTmpl, "save", &cairo::save);
@@ -189,30 +1470,277 @@ public:
         ezv8::NewObjectMethod(isolate.get(), VideoFrameTmpl, "strokeText", &cairo::strokeText);
         ezv8::NewObjectMethod(isolate.get(), VideoFrameTmpl, "scale", &cairo::scale);
 
-        // hack
-        // ezv8::NewObjectMethod(isolate.get(), VideoFrameTmpl, "setStrokeStyle", &cairo::strokeStyle);
+        // hack
+        // ezv8::NewObjectMethod(isolate.get(), VideoFrameTmpl, "setStrokeStyle", &cairo::strokeStyle);
+
+        VideoFrameTmpl->InstanceTemplate()->Set(
+            v8::String::NewFromUtf8(isolate.get(), "draw").ToLocalChecked(),
+            v8::FunctionTemplate::New(
+                isolate.get(), [](const v8::FunctionCallbackInfo<v8::Value> &args)
+                {
+                    if (args.Length() != 5) {
+                        return;
+                    }
+
+                    int x = 0, y = 0, w = 0, h = 0;
+                    x = args[1]->NumberValue(args.GetIsolate()->GetCurrentContext()).FromJust();
+                    y = args[2]->NumberValue(args.GetIsolate()->GetCurrentContext()).FromJust();
+                    w = args[3]->NumberValue(args.GetIsolate()->GetCurrentContext()).FromJust();
+                    h = args[4]->NumberValue(args.GetIsolate()->GetCurrentContext()).FromJust();
+                    // TODO security issues? I think yes
+                    auto canvas = reinterpret_cast<cairo*>(v8::Local<v8::External>::Cast(args.Holder()->GetInternalField(0))->Value());
+                    auto source = reinterpret_cast<cairo*>(v8::Local<v8::External>::Cast(args[0]->ToObject(args.GetIsolate()->GetCurrentContext()).ToLocalChecked()->GetInternalField(0))->Value());
+                    canvas->drawImage(source, x, y, w, h); }));
+
+        // frame.shade(expr, uniforms, sources), see shade.hpp
+        VideoFrameTmpl->InstanceTemplate()->Set(
+            v8::String::NewFromUtf8(isolate.get(), "shade").ToLocalChecked(),
+            v8::FunctionTemplate::New(
+                isolate.get(), [](const v8::FunctionCallbackInfo<v8::Value> &args)
+                {
+                    auto iso = args.GetIsolate();
+                    auto ctx = iso->GetCurrentContext();
+                    if (args.Length() < 1 || !args[0]->IsString()) {
+                        return;
+                    }
+
+                    std::shared_ptr<const Shader> shader;
+                    try {
+                        shader = Shader::compile(*v8::String::Utf8Value(iso, args[0]));
+                    } catch (const std::exception &e) {
+                        iso->ThrowException(v8::Exception::SyntaxError(v8::String::NewFromUtf8(iso, e.what()).ToLocalChecked()));
+                        return;
+                    }
+
+                    std::vector<float> uniforms;
+                    if (args.Length() >= 2 && args[1]->IsObject()) {
+                        auto obj = args[1].As<v8::Object>();
+                        for (auto &name : shader->uniforms()) {
+                            auto v = obj->Get(ctx, v8::String::NewFromUtf8(iso, name.c_str()).ToLocalChecked()).ToLocalChecked();
+                            uniforms.push_back(v->IsUndefined() ? 0.0f : v->NumberValue(ctx).FromMaybe(0.0));
+                        }
+                    }
+
+                    std::vector<Shader::Source> sources;
+                    if (args.Length() >= 3 && args[2]->IsArray()) {
+                        auto arr = args[2].As<v8::Array>();
+                        for (uint32_t i = 0; i < arr->Length(); i++) {
+                            auto src = arr->Get(ctx, i).ToLocalChecked();
+                            if (!src->IsObject() || src.As<v8::Object>()->InternalFieldCount() < 1) {
+                                iso->ThrowException(v8::Exception::TypeError(v8::String::NewFromUtf8(iso, "shade: sources must be VideoFrames").ToLocalChecked()));
+                                return;
+                            }
+                            auto c = reinterpret_cast<cairo *>(v8::Local<v8::External>::Cast(src.As<v8::Object>()->GetInternalField(0))->Value());
+                            if (c->is_float()) {
+                                iso->ThrowException(v8::Exception::TypeError(v8::String::NewFromUtf8(iso, "shade: only rgb32 frames can be sampled").ToLocalChecked()));
+                                return;
+                            }
+                            if (c->width() <= 0 || c->height() <= 0) {
+                                iso->ThrowException(v8::Exception::RangeError(v8::String::NewFromUtf8(iso, "shade: sources must not be empty").ToLocalChecked()));
+                                return;
+                            }
+                            c->flush();
+                            sources.push_back({c->data(), c->width(), c->height(), c->stride()});
+                        }
+                    }
+
+                    auto canvas = reinterpret_cast<cairo *>(v8::Local<v8::External>::Cast(args.Holder()->GetInternalField(0))->Value());
+                    if (canvas->is_float()) {
+                        iso->ThrowException(v8::Exception::TypeError(v8::String::NewFromUtf8(iso, "shade: only rgb32 frames can be shaded").ToLocalChecked()));
+                        return;
+                    }
+                    auto pts = args.Holder()->Get(ctx, v8::String::NewFromUtf8(iso, "pts").ToLocalChecked()).ToLocalChecked()->NumberValue(ctx).FromMaybe(0.0);
+                    canvas->flush();
+
+                    // Sources sharing memory with the output (itself, its parent or a view of it) are
+                    // read from a snapshot, rows are written by other threads while they are sampled
+                    auto extent = [](const uint8_t *data, int height, int stride, int width) {
+                        return std::make_pair(data, data + static_cast<size_t>(height - 1) * stride + static_cast<size_t>(width) * 4);
+                    };
+                    auto out = extent(canvas->data(), canvas->height(), canvas->stride(), canvas->width());
+                    std::vector<std::vector<uint8_t>> snapshots;
+                    for (auto &src : sources) {
+                        auto in = extent(src.data, src.height, src.stride, src.width);
+                        if (shader->samples() && in.first < out.second && out.first < in.second) {
+                            snapshots.emplace_back(static_cast<size_t>(src.width) * src.height * 4);
+                            for (int y = 0; y < src.height; y++) {
+                                std::memcpy(snapshots.back().data() + static_cast<size_t>(y) * src.width * 4, src.data + static_cast<size_t>(y) * src.stride, static_cast<size_t>(src.width) * 4);
+                            }
+                            src.data = snapshots.back().data();
+                            src.stride = src.width * 4;
+                        }
+                    }
+                    shader->run(canvas->data(), canvas->width(), canvas->height(), canvas->stride(), pts, uniforms, sources);
+                    canvas->mark_dirty(); }));
+
+        // Analysis, see analyze.hpp. `region` is an optional {x, y, width, height}, values are 8 bit code values.
+        // frame.histogram(channel, region) returns a Uint32Array(256), channel "luma" (default), "r", "g" or "b"
+        VideoFrameTmpl->InstanceTemplate()->Set(
+            v8::String::NewFromUtf8(isolate.get(), "histogram").ToLocalChecked(),
+            v8::FunctionTemplate::New(
+                isolate.get(), [](const v8::FunctionCallbackInfo<v8::Value> &args)
+                {
+                    auto iso = args.GetIsolate();
+                    auto ctx = iso->GetCurrentContext();
+                    auto canvas = surface_of(args.Holder());
+                    auto channel = analyze::LUMA;
+                    if (args.Length() >= 1 && args[0]->IsString()) {
+                        auto name = ezv8::to_type(ctx, ezv8::tag<std::string>, args[0]);
+                        if (name == "r") channel = analyze::RED;
+                        else if (name == "g") channel = analyze::GREEN;
+                        else if (name == "b") channel = analyze::BLUE;
+                        else if (name != "luma") {
+                            iso->ThrowException(v8::Exception::TypeError(v8::String::NewFromUtf8(iso, ("histogram: unknown channel " + name).c_str()).ToLocalChecked()));
+                            return;
+                        }
+                    }
+                    canvas->flush();
+                    auto h = analyze::histogram(*canvas, region_arg(ctx, args, 1, *canvas), channel);
+                    auto out = v8::Uint32Array::New(v8::ArrayBuffer::New(iso, sizeof(h)), 0, h.size());
+                    std::memcpy(out->Buffer()->Data(), h.data(), sizeof(h));
+                    args.GetReturnValue().Set(out); }));
+
+        // frame.stats(region) returns {luma, r, g, b}, each {mean, variance}
+        VideoFrameTmpl->InstanceTemplate()->Set(
+            v8::String::NewFromUtf8(isolate.get(), "stats").ToLocalChecked(),
+            v8::FunctionTemplate::New(
+                isolate.get(), [](const v8::FunctionCallbackInfo<v8::Value> &args)
+                {
+                    auto iso = args.GetIsolate();
+                    auto ctx = iso->GetCurrentContext();
+                    auto canvas = surface_of(args.Holder());
+                    canvas->flush();
+                    auto m = analyze::moments(*canvas, region_arg(ctx, args, 0, *canvas));
+                    auto out = v8::Object::New(iso);
+                    const char *names[] = {"luma", "r", "g", "b"};
+                    for (int c = 0; c < 4; c++) {
+                        auto channel = v8::Object::New(iso);
+                        channel->Set(ctx, v8::String::NewFromUtf8(iso, "mean").ToLocalChecked(), v8::Number::New(iso, m.mean[c])).FromJust();
+                        channel->Set(ctx, v8::String::NewFromUtf8(iso, "variance").ToLocalChecked(), v8::Number::New(iso, m.variance[c])).FromJust();
+                        out->Set(ctx, v8::String::NewFromUtf8(iso, names[c]).ToLocalChecked(), channel).FromJust();
+                    }
+                    args.GetReturnValue().Set(out); }));
+
+        // frame.compare(other, region) returns {sad, mse, psnr} over R, G and B
+        VideoFrameTmpl->InstanceTemplate()->Set(
+            v8::String::NewFromUtf8(isolate.get(), "compare").ToLocalChecked(),
+            v8::FunctionTemplate::New(
+                isolate.get(), [](const v8::FunctionCallbackInfo<v8::Value> &args)
+                {
+                    auto iso = args.GetIsolate();
+                    auto ctx = iso->GetCurrentContext();
+                    auto canvas = surface_of(args.Holder());
+                    auto other = args.Length() >= 1 ? surface_of(args[0]) : nullptr;
+                    if (!other) {
+                        iso->ThrowException(v8::Exception::TypeError(v8::String::NewFromUtf8(iso, "compare: expected a VideoFrame").ToLocalChecked()));
+                        return;
+                    }
+                    canvas->flush();
+                    other->flush();
+                    auto r = region_arg(ctx, args, 1, *canvas).clip(other->width(), other->height());
+                    auto d = analyze::compare(*canvas, *other, r);
+                    auto out = v8::Object::New(iso);
+                    out->Set(ctx, v8::String::NewFromUtf8(iso, "sad").ToLocalChecked(), v8::Number::New(iso, d.sad)).FromJust();
+                    out->Set(ctx, v8::String::NewFromUtf8(iso, "mse").ToLocalChecked(), v8::Number::New(iso, d.mse)).FromJust();
+                    out->Set(ctx, v8::String::NewFromUtf8(iso, "psnr").ToLocalChecked(), v8::Number::New(iso, d.psnr)).FromJust();
+                    args.GetReturnValue().Set(out); }));
+
+        // frame.thumbnail(width, height, region) returns a new, box filtered rgb32 VideoFrame
+        VideoFrameTmpl->InstanceTemplate()->Set(
+            v8::String::NewFromUtf8(isolate.get(), "thumbnail").ToLocalChecked(),
+            v8::FunctionTemplate::New(
+                isolate.get(), [](const v8::FunctionCallbackInfo<v8::Value> &args)
+                {
+                    auto iso = args.GetIsolate();
+                    auto ctx = iso->GetCurrentContext();
+                    auto canvas = surface_of(args.Holder());
+                    int width = args.Length() >= 1 ? args[0]->NumberValue(ctx).FromMaybe(0.0) : 0;
+                    int height = args.Length() >= 2 ? args[1]->NumberValue(ctx).FromMaybe(0.0) : 0;
+                    auto r = region_arg(ctx, args, 2, *canvas);
+                    if (width <= 0 || height <= 0 || r.width <= 0 || r.height <= 0) {
+                        iso->ThrowException(v8::Exception::RangeError(v8::String::NewFromUtf8(iso, "thumbnail: empty size or region").ToLocalChecked()));
+                        return;
+                    }
+
+                    auto mipp = reinterpret_cast<Mipp *>(v8::Local<v8::External>::Cast(ctx->Global()->GetInternalField(0))->Value());
+                    v8::Handle<v8::Value> frameArgs[] = {v8::Number::New(iso, width), v8::Number::New(iso, height), args.Holder()->Get(ctx, v8::String::NewFromUtf8(iso, "pts").ToLocalChecked()).ToLocalChecked()};
+                    v8::Local<v8::Object> thumb;
+                    if (!mipp->VideoFrameCtor.Get(iso)->NewInstance(ctx, 3, frameArgs).ToLocal(&thumb)) {
+                        return;
+                    }
+                    auto dst = surface_of(thumb);
+                    canvas->flush();
+                    analyze::thumbnail(*canvas, r, reinterpret_cast<uint32_t *>(dst->data()), width, height);
+                    dst->mark_dirty();
+                    args.GetReturnValue().Set(thumb); }));
 
+        // frame.view(x, y, w, h) is a VideoFrame over that rectangle of the frame's pixels, nothing
+        // is copied: drawing on either shows in both, and sending the view emits just the rectangle
         VideoFrameTmpl->InstanceTemplate()->Set(
-            v8::String::NewFromUtf8(isolate.get(), "draw").ToLocalChecked(),
+            v8::String::NewFromUtf8(isolate.get(), "view").ToLocalChecked(),
             v8::FunctionTemplate::New(
                 isolate.get(), [](const v8::FunctionCallbackInfo<v8::Value> &args)
                 {
-                    if (args.Length() != 5) {
+                    auto iso = args.GetIsolate();
+                    auto ctx = iso->GetCurrentContext();
+                    auto canvas = surface_of(args.Holder());
+                    auto r = region_arg(ctx, args, 0, *canvas);
+                    if (args.Length() >= 4) {
+                        r.x = args[0]->NumberValue(ctx).FromMaybe(0.0);
+                        r.y = args[1]->NumberValue(ctx).FromMaybe(0.0);
+                        r.width = args[2]->NumberValue(ctx).FromMaybe(0.0);
+                        r.height = args[3]->NumberValue(ctx).FromMaybe(0.0);
+                    }
+                    auto clipped = r.clip(canvas->width(), canvas->height());
+                    if (r.width <= 0 || r.height <= 0 || clipped.x != r.x || clipped.y != r.y || clipped.width != r.width || clipped.height != r.height) {
+                        iso->ThrowException(v8::Exception::RangeError(v8::String::NewFromUtf8(iso, "view: rectangle must be inside the frame").ToLocalChecked()));
                         return;
                     }
 
-                    int x = 0, y = 0, w = 0, h = 0;
-                    x = args[1]->NumberValue(args.GetIsolate()->GetCurrentContext()).FromJust();
-                    y = args[2]->NumberValue(args.GetIsolate()->GetCurrentContext()).FromJust();
-                    w = args[3]->NumberValue(args.GetIsolate()->GetCurrentContext()).FromJust();
-                    h = args[4]->NumberValue(args.GetIsolate()->GetCurrentContext()).FromJust();
-                    // TODO security issues? I think yes
-                    auto canvas = reinterpret_cast<cairo*>(v8::Local<v8::External>::Cast(args.Holder()->GetInternalField(0))->Value());
-                    auto source = reinterpret_cast<cairo*>(v8::Local<v8::External>::Cast(args[0]->ToObject(args.GetIsolate()->GetCurrentContext()).ToLocalChecked()->GetInternalField(0))->Value());
-                    canvas->drawImage(source, x, y, w, h); }));
+                    auto data = args.Holder()->Get(ctx, v8::String::NewFromUtf8(iso, "data").ToLocalChecked()).ToLocalChecked();
+                    if (!data->IsTypedArray()) {
+                        iso->ThrowException(v8::Exception::TypeError(v8::String::NewFromUtf8(iso, "view: expected a VideoFrame").ToLocalChecked()));
+                        return;
+                    }
+                    auto bpp = canvas->is_float() ? 16 : 4;
+                    auto offset = data.As<v8::TypedArray>()->ByteOffset() + static_cast<size_t>(r.y) * canvas->stride() + static_cast<size_t>(r.x) * bpp;
+                    auto mipp = reinterpret_cast<Mipp *>(v8::Local<v8::External>::Cast(ctx->Global()->GetInternalField(0))->Value());
+                    v8::Handle<v8::Value> frameArgs[] = {
+                        v8::Number::New(iso, r.width),
+                        v8::Number::New(iso, r.height),
+                        args.Holder()->Get(ctx, v8::String::NewFromUtf8(iso, "pts").ToLocalChecked()).ToLocalChecked(),
+                        data.As<v8::TypedArray>()->Buffer(),
+                        v8::Number::New(iso, offset),
+                        v8::Number::New(iso, canvas->stride()),
+                        v8::String::NewFromUtf8(iso, canvas->is_float() ? "rgba128f" : "rgb32").ToLocalChecked()};
+                    v8::Local<v8::Object> view;
+                    canvas->flush();
+                    if (mipp->VideoFrameCtor.Get(iso)->NewInstance(ctx, 7, frameArgs).ToLocal(&view)) {
+                        args.GetReturnValue().Set(view);
+                    } }));
+
+        // frame.setMetadata(key, value) attaches a key/value to the frame's output, see mipp_set_metadata_callback
+        VideoFrameTmpl->InstanceTemplate()->Set(
+            v8::String::NewFromUtf8(isolate.get(), "setMetadata").ToLocalChecked(),
+            v8::FunctionTemplate::New(
+                isolate.get(), [](const v8::FunctionCallbackInfo<v8::Value> &args)
+                {
+                    auto iso = args.GetIsolate();
+                    auto ctx = iso->GetCurrentContext();
+                    if (args.Length() < 2) {
+                        return;
+                    }
+                    auto key = v8::String::NewFromUtf8(iso, "metadata").ToLocalChecked();
+                    auto metadata = args.Holder()->Get(ctx, key).ToLocalChecked();
+                    if (!metadata->IsObject()) {
+                        metadata = v8::Object::New(iso);
+                        args.Holder()->Set(ctx, key, metadata).FromJust();
+                    }
+                    metadata.As<v8::Object>()->Set(ctx, args[0], args[1]).FromJust(); }));
 
         global_templ->Set(v8::String::NewFromUtf8(isolate.get(), "VideoFrame").ToLocalChecked(), VideoFrameTmpl);
 
+        // make_pads(inputs, outputs), send_video_frame(frame, pad) targets an output
         global_templ->Set(v8::String::NewFromUtf8(isolate.get(), "make_pads").ToLocalChecked(),
                           v8::FunctionTemplate::New(isolate.get(), [](const v8::FunctionCallbackInfo<v8::Value> &args)
                                                     {
@@ -221,8 +1749,238 @@ public:
                 auto mipp = reinterpret_cast<Mipp*>(v8::Local<v8::External>::Cast(args.Holder()->GetInternalField(0))->Value());
                 if (args.Length() >= 1) {
                     mipp->videoInPads = args[0]->NumberValue(ctx).FromJust();
+                }
+                if (args.Length() >= 2) {
+                    mipp->videoOutPads = std::max(1.0, args[1]->NumberValue(ctx).FromJust());
+                } }));
+
+        // keep_history(frames) keeps the last `frames` input frames of every pad as they arrived,
+        // history(pad, k) returns the one k frames back (0 is the current one) as a read only
+        // frame that can be drawn from, or undefined. The "history_mb" option bounds the memory.
+        global_templ->Set(v8::String::NewFromUtf8(isolate.get(), "keep_history").ToLocalChecked(),
+                          v8::FunctionTemplate::New(isolate.get(), [](const v8::FunctionCallbackInfo<v8::Value> &args)
+                                                    {
+                auto iso = args.GetIsolate();
+                auto mipp = reinterpret_cast<Mipp*>(v8::Local<v8::External>::Cast(args.Holder()->GetInternalField(0))->Value());
+                auto frames = args.Length() ? args[0]->NumberValue(iso->GetCurrentContext()).FromMaybe(0) : 0;
+                mipp->history.set_depth(static_cast<size_t>(std::max(0.0, frames))); }));
+
+        global_templ->Set(v8::String::NewFromUtf8(isolate.get(), "history").ToLocalChecked(),
+                          v8::FunctionTemplate::New(isolate.get(), [](const v8::FunctionCallbackInfo<v8::Value> &args)
+                                                    {
+                auto iso = args.GetIsolate();
+                auto ctx = iso->GetCurrentContext();
+                auto mipp = reinterpret_cast<Mipp*>(v8::Local<v8::External>::Cast(args.Holder()->GetInternalField(0))->Value());
+                auto pad = args.Length() > 0 ? args[0]->Int32Value(ctx).FromMaybe(0) : 0;
+                auto k = args.Length() > 1 ? args[1]->Int32Value(ctx).FromMaybe(0) : 0;
+                auto e = mipp->history.at(pad, k);
+                v8::Local<v8::Object> frame;
+                if (e && history::wrap(iso, ctx, *e).ToLocal(&frame)) {
+                    args.GetReturnValue().Set(frame);
+                } }));
+
+        // set_frame_memory(memory, alloc) makes incoming frames land inside `memory` (a
+        // WebAssembly.Memory or ArrayBuffer) at the byte offset returned by alloc(pad, byteLength),
+        // so wasm kernels can work on them in place. set_frame_memory() goes back to JS heap frames.
+        global_templ->Set(v8::String::NewFromUtf8(isolate.get(), "set_frame_memory").ToLocalChecked(),
+                          v8::FunctionTemplate::New(isolate.get(), [](const v8::FunctionCallbackInfo<v8::Value> &args)
+                                                    {
+                auto iso = args.GetIsolate();
+                auto mipp = reinterpret_cast<Mipp*>(v8::Local<v8::External>::Cast(args.Holder()->GetInternalField(0))->Value());
+                if (args.Length() < 2) {
+                    mipp->frame_memory.Reset();
+                    mipp->frame_alloc.Reset();
+                    return;
+                }
+                if (!(args[0]->IsWasmMemoryObject() || args[0]->IsArrayBuffer()) || !args[1]->IsFunction()) {
+                    iso->ThrowException(v8::Exception::TypeError(v8::String::NewFromUtf8(iso, "set_frame_memory: expected (memory, alloc)").ToLocalChecked()));
+                    return;
+                }
+                mipp->frame_memory.Reset(iso, args[0]);
+                mipp->frame_alloc.Reset(iso, args[1].As<v8::Function>()); }));
+
+        // loadWasm(path) returns a compiled WebAssembly.Module, see wasm.hpp
+        global_templ->Set(v8::String::NewFromUtf8(isolate.get(), "loadWasm").ToLocalChecked(),
+                          v8::FunctionTemplate::New(isolate.get(), [](const v8::FunctionCallbackInfo<v8::Value> &args)
+                                                    {
+                auto iso = args.GetIsolate();
+                if (args.Length() < 1) {
+                    return;
+                }
+                v8::Local<v8::WasmModuleObject> module;
+                if (wasm::load(iso, iso->GetCurrentContext(), *v8::String::Utf8Value(iso, args[0])).ToLocal(&module)) {
+                    args.GetReturnValue().Set(module);
+                } }));
+
+        // loadImage(path) decodes a PNG or JPEG (cached, see image.hpp) into something frame.draw can draw
+        global_templ->Set(v8::String::NewFromUtf8(isolate.get(), "loadImage").ToLocalChecked(),
+                          v8::FunctionTemplate::New(isolate.get(), [](const v8::FunctionCallbackInfo<v8::Value> &args)
+                                                    {
+                auto iso = args.GetIsolate();
+                if (args.Length() < 1) {
+                    return;
+                }
+                auto pixels = image::load(iso, *v8::String::Utf8Value(iso, args[0]));
+                v8::Local<v8::Object> img;
+                if (pixels && image::wrap(iso, iso->GetCurrentContext(), pixels).ToLocal(&img)) {
+                    args.GetReturnValue().Set(img);
+                } }));
+
+        // cached(key, render) returns the frame render() returns, stored under `key` so that later
+        // calls with that key, from this run or any other, map it instead of rendering again
+        // (see rendercache.hpp). The key must name everything the rendering depends on.
+        global_templ->Set(v8::String::NewFromUtf8(isolate.get(), "cached").ToLocalChecked(),
+                          v8::FunctionTemplate::New(isolate.get(), [](const v8::FunctionCallbackInfo<v8::Value> &args)
+                                                    {
+                auto iso = args.GetIsolate();
+                auto ctx = iso->GetCurrentContext();
+                auto mipp = reinterpret_cast<Mipp*>(v8::Local<v8::External>::Cast(args.Holder()->GetInternalField(0))->Value());
+                if (args.Length() < 2 || !args[1]->IsFunction()) {
+                    iso->ThrowException(v8::Exception::TypeError(v8::String::NewFromUtf8(iso, "cached: expected a key and a render function").ToLocalChecked()));
+                    return;
+                }
+                std::string key = *v8::String::Utf8Value(iso, args[0]);
+
+                rendercache::Hit hit;
+                if (rendercache::lookup(key, hit)) {
+                    auto &h = hit.header;
+                    auto mapping = hit.mapping.release();
+                    auto store = v8::ArrayBuffer::NewBackingStore(mapping->data, mapping->size, [](void *, size_t, void *m)
+                                                                  { delete static_cast<rendercache::Mapping *>(m); }, mapping);
+                    v8::Local<v8::Value> frameArgs[] = {
+                        v8::Number::New(iso, h.width),
+                        v8::Number::New(iso, h.height),
+                        v8::Number::New(iso, h.pts),
+                        v8::ArrayBuffer::New(iso, std::move(store)),
+                        v8::Number::New(iso, h.pixels),
+                        v8::String::NewFromUtf8(iso, h.is_float ? "rgba128f" : "rgb32").ToLocalChecked()};
+                    v8::Local<v8::Object> frame;
+                    if (mipp->VideoFrameCtor.Get(iso)->NewInstance(ctx, 6, frameArgs).ToLocal(&frame)) {
+                        args.GetReturnValue().Set(frame);
+                    }
+                    return;
+                }
+
+                v8::Local<v8::Value> frame;
+                if (!args[1].As<v8::Function>()->Call(ctx, ctx->Global(), 0, nullptr).ToLocal(&frame)) {
+                    return;
+                }
+                auto canvas = surface_of(frame);
+                if (!canvas) {
+                    iso->ThrowException(v8::Exception::TypeError(v8::String::NewFromUtf8(iso, "cached: render must return a VideoFrame").ToLocalChecked()));
+                    return;
+                }
+                auto pts = frame.As<v8::Object>()->Get(ctx, v8::String::NewFromUtf8(iso, "pts").ToLocalChecked()).ToLocalChecked()->NumberValue(ctx).FromMaybe(0);
+                if (!rendercache::store(key, *canvas, pts)) {
+                    mipp->log(32, "cached: could not store " + key);
+                }
+                args.GetReturnValue().Set(frame); }));
+
+        // prerender(frames) has a second copy of the script render render_overlay(pts) for the
+        // next `frames` frames on a spare core, see prerender.hpp. render_overlay must depend on
+        // nothing but pts: the copy shares no state with this one. 0 stops.
+        global_templ->Set(v8::String::NewFromUtf8(isolate.get(), "prerender").ToLocalChecked(),
+                          v8::FunctionTemplate::New(isolate.get(), [](const v8::FunctionCallbackInfo<v8::Value> &args)
+                                                    {
+                auto iso = args.GetIsolate();
+                auto mipp = reinterpret_cast<Mipp*>(v8::Local<v8::External>::Cast(args.Holder()->GetInternalField(0))->Value());
+                if (mipp->is_prerenderer) {
+                    return;
+                }
+                auto frames = args.Length() ? args[0]->NumberValue(iso->GetCurrentContext()).FromMaybe(0) : 0;
+                mipp->lookahead.reset();
+                mipp->prerender_depth = static_cast<size_t>(std::clamp(frames, 0.0, 64.0)); }));
+
+        // overlay(pts) returns render_overlay(pts), from the prerendered ones when it is ready
+        // and by calling it here otherwise
+        global_templ->Set(v8::String::NewFromUtf8(isolate.get(), "overlay").ToLocalChecked(),
+                          v8::FunctionTemplate::New(isolate.get(), [](const v8::FunctionCallbackInfo<v8::Value> &args)
+                                                    {
+                auto iso = args.GetIsolate();
+                auto ctx = iso->GetCurrentContext();
+                auto mipp = reinterpret_cast<Mipp*>(v8::Local<v8::External>::Cast(args.Holder()->GetInternalField(0))->Value());
+                auto pts = args.Length() ? args[0]->NumberValue(ctx).FromMaybe(0) : 0;
+
+                if (mipp->prerender_depth > 0 && mipp->prerender_allowed && !mipp->is_prerenderer) {
+                    if (!mipp->lookahead) {
+                        mipp->start_prerender();
+                    }
+                    prerender::Surface s;
+                    auto hit = mipp->lookahead->take(pts, s);
+                    mipp->lookahead->ahead(pts, pts - mipp->overlay_pts);
+                    mipp->overlay_pts = pts;
+                    if (hit) {
+                        auto ref = new std::shared_ptr<std::vector<uint8_t>>(s.pixels);
+                        auto store = v8::ArrayBuffer::NewBackingStore(s.pixels->data(), s.pixels->size(), [](void *, size_t, void *ref)
+                                                                      { delete static_cast<std::shared_ptr<std::vector<uint8_t>> *>(ref); }, ref);
+                        v8::Local<v8::Value> frameArgs[] = {
+                            v8::Number::New(iso, s.width),
+                            v8::Number::New(iso, s.height),
+                            v8::Number::New(iso, pts),
+                            v8::ArrayBuffer::New(iso, std::move(store)),
+                            v8::Number::New(iso, 0),
+                            v8::String::NewFromUtf8(iso, s.is_float ? "rgba128f" : "rgb32").ToLocalChecked()};
+                        v8::Local<v8::Object> frame;
+                        if (mipp->VideoFrameCtor.Get(iso)->NewInstance(ctx, 6, frameArgs).ToLocal(&frame)) {
+                            mipp->stats.prerendered++;
+                            args.GetReturnValue().Set(frame);
+                        }
+                        return;
+                    }
+                }
+
+                v8::Local<v8::Value> func, frame;
+                if (!ctx->Global()->Get(ctx, v8::String::NewFromUtf8(iso, "render_overlay").ToLocalChecked()).ToLocal(&func) || !func->IsFunction()) {
+                    iso->ThrowException(v8::Exception::TypeError(v8::String::NewFromUtf8(iso, "overlay: render_overlay is not defined").ToLocalChecked()));
+                    return;
+                }
+                v8::Local<v8::Value> renderArgs[] = {v8::Number::New(iso, pts)};
+                if (func.As<v8::Function>()->Call(ctx, ctx->Global(), 1, renderArgs).ToLocal(&frame)) {
+                    args.GetReturnValue().Set(frame);
                 } }));
 
+        // timeline_add({start, end | duration, fade_in, fade_out, curve, keyframes, x, y, text, font, fill, draw})
+        // registers an element live from start to end (seconds of pts) and returns its id, see
+        // timeline.hpp. Elements with a text are drawn natively, draw(frame, state) is called
+        // with state.alpha, state.progress, state.elapsed and the keyframed values otherwise.
+        global_templ->Set(v8::String::NewFromUtf8(isolate.get(), "timeline_add").ToLocalChecked(),
+                          v8::FunctionTemplate::New(isolate.get(), [](const v8::FunctionCallbackInfo<v8::Value> &args)
+                                                    {
+                auto iso = args.GetIsolate();
+                auto ctx = iso->GetCurrentContext();
+                auto mipp = reinterpret_cast<Mipp*>(v8::Local<v8::External>::Cast(args.Holder()->GetInternalField(0))->Value());
+                timeline::Element e;
+                v8::Local<v8::Function> draw;
+                if (!to_element(iso, ctx, args.Length() ? args[0] : v8::Undefined(iso).As<v8::Value>(), e, draw)) {
+                    return;
+                }
+                auto id = mipp->timeline.add(std::move(e));
+                if (!draw.IsEmpty()) {
+                    mipp->cues[id].Reset(iso, draw);
+                }
+                args.GetReturnValue().Set(v8::Number::New(iso, id)); }));
+
+        global_templ->Set(v8::String::NewFromUtf8(isolate.get(), "timeline_remove").ToLocalChecked(),
+                          v8::FunctionTemplate::New(isolate.get(), [](const v8::FunctionCallbackInfo<v8::Value> &args)
+                                                    {
+                auto mipp = reinterpret_cast<Mipp*>(v8::Local<v8::External>::Cast(args.Holder()->GetInternalField(0))->Value());
+                if (args.Length() >= 1) {
+                    auto id = static_cast<uint32_t>(args[0]->NumberValue(args.GetIsolate()->GetCurrentContext()).FromMaybe(0.0));
+                    mipp->timeline.remove(id);
+                    mipp->cues.erase(id);
+                } }));
+
+        global_templ->Set(v8::String::NewFromUtf8(isolate.get(), "timeline_clear").ToLocalChecked(),
+                          v8::FunctionTemplate::New(isolate.get(), [](const v8::FunctionCallbackInfo<v8::Value> &args)
+                                                    {
+                auto mipp = reinterpret_cast<Mipp*>(v8::Local<v8::External>::Cast(args.Holder()->GetInternalField(0))->Value());
+                mipp->timeline.clear();
+                mipp->cues.clear(); }));
+
+        // log([level, ]...values[, fields]) queues the values, concatenated, for the host's log
+        // callback. A trailing plain object is appended as logfmt key=value fields. Messages
+        // above the "log_level" option or over the "log_rate" of their line are dropped before
+        // anything is converted to a string.
         global_templ->Set(v8::String::NewFromUtf8(isolate.get(), "log").ToLocalChecked(),
                           v8::FunctionTemplate::New(isolate.get(), [](const v8::FunctionCallbackInfo<v8::Value> &args)
                                                     {
@@ -230,17 +1988,69 @@ public:
                     return;
                 }
 
-                std::string txt;
+                auto iso = args.GetIsolate();
+                auto ctx = iso->GetCurrentContext();
+                auto mipp = reinterpret_cast<Mipp*>(v8::Local<v8::External>::Cast(args.Holder()->GetInternalField(0))->Value());
                 int level = 48;
-                for (int i = 0; i < args.Length(); i++) {
-                    if (i == 0 && args[0]->IsNumber()) {
-                        level = args[0]->NumberValue(args.GetIsolate()->GetCurrentContext()).FromJust();
-                        continue;
+                int first = 0;
+                if (args[0]->IsNumber()) {
+                    level = args[0]->NumberValue(ctx).FromJust();
+                    first = 1;
+                }
+                if (!mipp->logs.enabled(level)) {
+                    return;
+                }
+
+                uint64_t suppressed = 0;
+                if (mipp->log_limiter.rate() > 0) {
+                    auto trace = v8::StackTrace::CurrentStackTrace(iso, 1, static_cast<v8::StackTrace::StackTraceOptions>(v8::StackTrace::kColumnOffset | v8::StackTrace::kScriptId));
+                    uint64_t site = 0;
+                    if (trace->GetFrameCount() > 0) {
+                        auto frame = trace->GetFrame(iso, 0);
+                        site = static_cast<uint64_t>(frame->GetScriptId()) << 48 ^ static_cast<uint64_t>(frame->GetLineNumber()) << 20 ^ frame->GetColumn();
+                    }
+                    if (!mipp->log_limiter.admit(site, suppressed)) {
+                        mipp->logs.suppressed++;
+                        return;
                     }
-                    txt += *v8::String::Utf8Value(args.GetIsolate(), args[i]);
                 }
-                auto mipp = reinterpret_cast<Mipp*>(v8::Local<v8::External>::Cast(args.Holder()->GetInternalField(0))->Value());
-                mipp->log_callback(level, txt); }));
+
+                auto last = args.Length();
+                v8::Local<v8::Object> fields;
+                if (last - first > 1 && args[last - 1]->IsObject() && !args[last - 1]->IsArray()) {
+                    auto obj = args[last - 1].As<v8::Object>();
+                    if (obj->GetConstructorName()->StringEquals(v8::String::NewFromUtf8Literal(iso, "Object"))) {
+                        fields = obj;
+                        last--;
+                    }
+                }
+
+                std::string txt;
+                for (int i = first; i < last; i++) {
+                    txt += *v8::String::Utf8Value(iso, args[i]);
+                }
+                if (!fields.IsEmpty()) {
+                    auto keys = fields->GetOwnPropertyNames(ctx).ToLocalChecked();
+                    for (uint32_t i = 0; i < keys->Length(); i++) {
+                        auto key = keys->Get(ctx, i).ToLocalChecked();
+                        std::string value = *v8::String::Utf8Value(iso, fields->Get(ctx, key).ToLocalChecked());
+                        if (value.empty() || value.find_first_of(" \"=") != std::string::npos) {
+                            std::string quoted = "\"";
+                            for (auto c : value) {
+                                if (c == '"' || c == '\\') {
+                                    quoted += '\\';
+                                }
+                                quoted += c;
+                            }
+                            value = quoted + "\"";
+                        }
+                        txt += std::string(" ") + *v8::String::Utf8Value(iso, key) + "=" + value;
+                    }
+                }
+                if (suppressed) {
+                    txt += " (" + std::to_string(suppressed) + " more from this line suppressed)";
+                }
+                mipp->logs.push(level, std::move(txt)); }));
 
         global_templ->Set(v8::String::NewFromUtf8(isolate.get(), "send_video_frame").ToLocalChecked(), receive_video_frame);
 
@@ -250,27 +2060,34 @@ public:
         persistent_context.Reset(isolate.get(), context);
         auto context_scope = v8::Context::Scope(context);
 
-        std::string js = load_script(script_path);
-        v8::Local<v8::String> source = v8::String::NewFromUtf8(isolate.get(), js.c_str(), v8::NewStringType::kNormal).ToLocalChecked();
-
-        auto script = v8::Script::Compile(context, source).ToLocalChecked(); // Compile the source code.
-        v8::Local<v8::Value> result = script->Run(context).ToLocalChecked(); // Run the script to get the result.
+        // A prerenderer is given the text its parent runs, everyone else reads the file
+        source = prerenderer ? std::move(script_source) : load_script(script_path);
+        source_path = script_path;
+        v8::Local<v8::String> js = v8::String::NewFromUtf8(isolate.get(), source.c_str(), v8::NewStringType::kNormal, source.size()).ToLocalChecked();
+        auto origin = v8::ScriptOrigin(isolate.get(), v8::String::NewFromUtf8(isolate.get(), script_path.c_str()).ToLocalChecked());
 
-        auto func = context->Global()->Get(context, v8::String::NewFromUtf8(isolate.get(), "VideoFrame").ToLocalChecked()).ToLocalChecked();
-        if (func->IsFunction())
-        {
-            VideoFrameCtor = v8::Handle<v8::Function>::Cast(func);
-        }
-
-        func = context->Global()->Get(context, v8::String::NewFromUtf8(isolate.get(), "receive_video_frame").ToLocalChecked()).ToLocalChecked();
-        if (func->IsFunction())
+        v8::TryCatch try_catch(isolate.get());
+        v8::Local<v8::Script> script;
+        if (!v8::Script::Compile(context, js, &origin).ToLocal(&script)) // Compile the source code.
         {
-            receive_video_frame_func = v8::Handle<v8::Function>::Cast(func);
+            log(16, describe(try_catch));
+            return;
         }
+        install(context, script); // Run the script to get the result.
+        logs.drain();
     }
 
     ~Mipp()
     {
+        lookahead.reset();
+        stop_profile();
+        logs.stop();
+        previous.reset();
+        receive_video_frame_func.Reset();
+        receive_video_frames_func.Reset();
+        VideoFrameCtor.Reset();
+        frame_memory.Reset();
+        frame_alloc.Reset();
         isolate->Exit();
         persistent_context.Reset();
     }
@@ -278,41 +2095,236 @@ public:
 
 extern "C"
 {
+    static Engine *engine(mipp_t *mipp)
+    {
+        return reinterpret_cast<Engine *>(mipp->priv);
+    }
+
+    static std::function<void(int level, std::string msg)> log_function(void (*log)(int level, const char *msg))
+    {
+        return [log](int level, std::string msg)
+        {
+            if (log)
+            {
+                log(level, msg.c_str());
+                return;
+            }
+            std::cerr << msg << std::endl;
+        };
+    }
+
     int mipp_init(mipp_t *mipp, char *script_path, void *opaque,
                   int (*receive_video_frame)(void *, int width, int height, double pts, uint8_t *data),
                   void (*log)(int level, const char *msg))
     {
-        auto priv = new Mipp(
+        Engine *priv = new Mipp(
             script_path,
             [opaque, receive_video_frame](int width, int height, double pts, uint8_t *data)
             {
                 receive_video_frame(opaque, width, height, pts, data);
             },
-            [log](int level, std::string msg)
-            {
-                if (log)
-                {
-                    log(level, msg.c_str());
-                    return;
-                }
-                std::cerr << msg << std::endl;
-            });
+            log_function(log));
 
         mipp->video_in_count = std::max(1, priv->inputPads());
+        mipp->video_out_count = std::max(1, priv->outputPads());
         mipp->priv = reinterpret_cast<void *>(priv);
+
+        // MIPP_PROFILE=<prefix> profiles every mipp in the process from its first frame, workers included
+        if (auto prefix = std::getenv("MIPP_PROFILE"))
+        {
+            priv->set_option("profile_heap", "1");
+            priv->set_option("profile", prefix);
+        }
+        return 0;
+    }
+
+    int mipp_init_worker(mipp_t *mipp, char *script_path, const char *worker_path, int workers, uint64_t slot_bytes, void *opaque,
+                         int (*receive_video_frame)(void *, int width, int height, double pts, uint8_t *data),
+                         void (*log)(int level, const char *msg))
+    {
+#ifdef __linux__
+        auto priv = new Client(
+            script_path, worker_path ? worker_path : "mipp_worker", workers,
+            slot_bytes ? slot_bytes : uint64_t(3840) * 2160 * 8,
+            [opaque, receive_video_frame](int width, int height, double pts, uint8_t *data)
+            {
+                receive_video_frame(opaque, width, height, pts, data);
+            },
+            log_function(log));
+        if (!priv->ok())
+        {
+            delete priv;
+            mipp->priv = 0;
+            return -1;
+        }
+
+        mipp->video_in_count = std::max(1, priv->inputPads());
+        mipp->video_out_count = std::max(1, priv->outputPads());
+        mipp->priv = reinterpret_cast<void *>(static_cast<Engine *>(priv));
         return 0;
+#else
+        log_function(log)(16, "mipp_init_worker: worker processes are only supported on Linux");
+        return -1;
+#endif
     }
 
     void mipp_free(mipp_t *mipp)
     {
         if (0 != mipp->priv)
         {
-            delete reinterpret_cast<Mipp *>(mipp->priv);
+            delete engine(mipp);
+            mipp->priv = 0;
         }
     }
 
+    int mipp_flush(mipp_t *mipp)
+    {
+        auto e = engine(mipp);
+        HostPoolScope pool(e->host_pool);
+        e->flush();
+        return 0;
+    }
+
     int mipp_send_video_frame(mipp_t *mipp, int width, int height, int stride, double pts, uint8_t *data, int in_pad_index)
     {
-        return reinterpret_cast<Mipp *>(mipp->priv)->send_video_frame(width, height, stride, pts, data, in_pad_index);
+        return mipp_send_video_frame_planes(mipp, MIPP_PIX_FMT_RGB32, width, height, &stride, pts, &data, in_pad_index);
+    }
+
+    int mipp_send_video_frame_planes(mipp_t *mipp, int format, int width, int height, const int *strides, double pts, uint8_t *const *planes, int in_pad_index)
+    {
+        auto e = engine(mipp);
+        if (e->recorder && format >= MIPP_PIX_FMT_RGB32 && format <= MIPP_PIX_FMT_P010)
+        {
+            e->recorder->write(format, width, height, strides, pts, planes, in_pad_index);
+        }
+        HostPoolScope pool(e->host_pool);
+        return e->send_video_frame(format, width, height, strides, pts, planes, in_pad_index);
+    }
+
+    int mipp_send_video_frames(mipp_t *mipp, const mipp_frame_t *frames, int count)
+    {
+        auto e = engine(mipp);
+        for (int i = 0; e->recorder && i < count; i++)
+        {
+            auto &f = frames[i];
+            if (f.format >= MIPP_PIX_FMT_RGB32 && f.format <= MIPP_PIX_FMT_P010)
+            {
+                e->recorder->write(f.format, f.width, f.height, f.strides, f.pts, f.planes, f.in_pad);
+            }
+        }
+        HostPoolScope pool(e->host_pool);
+        return e->send_video_frames(frames, count);
+    }
+
+    int mipp_set_execute(mipp_t *mipp, void *opaque,
+                         int (*execute)(void *opaque, int (*job)(void *opaque, void *arg, int jobnr, int nb_jobs), void *arg, int *ret, int nb_jobs),
+                         int max_jobs)
+    {
+        auto e = engine(mipp);
+        e->host_pool = {};
+        if (!execute || max_jobs <= 1)
+        {
+            return 0;
+        }
+        e->host_pool.size = max_jobs;
+        e->host_pool.execute = [opaque, execute](const ThreadPool::Job &job, int nb_jobs)
+        {
+            execute(
+                opaque, [](void *, void *arg, int jobnr, int nb_jobs)
+                { (*static_cast<const ThreadPool::Job *>(arg))(jobnr, nb_jobs); return 0; },
+                const_cast<ThreadPool::Job *>(&job), nullptr, nb_jobs);
+        };
+        return 0;
+    }
+
+    int mipp_set_video_out_format(mipp_t *mipp, int format)
+    {
+        return engine(mipp)->set_video_out_format(format);
+    }
+
+    int mipp_set_option(mipp_t *mipp, const char *key, const char *value)
+    {
+        auto e = engine(mipp);
+        if (std::string(key) == "capture")
+        {
+            // Path to record every frame sent to, empty to stop, see capture.hpp
+            e->recorder.reset();
+            if (value && *value)
+            {
+                e->recorder = std::make_unique<capture::Writer>();
+                if (!e->recorder->open(value))
+                {
+                    e->recorder.reset();
+                    return -1;
+                }
+            }
+            return 0;
+        }
+        auto ret = e->set_option(key, value ? value : "");
+        mipp->video_out_count = std::max(1, e->outputPads());
+        return ret;
+    }
+
+    int mipp_profile_start(mipp_t *mipp, const char *prefix, int heap)
+    {
+        if (!prefix || !*prefix || mipp_set_option(mipp, "profile_heap", heap ? "1" : "0") < 0)
+        {
+            return -1;
+        }
+        return mipp_set_option(mipp, "profile", prefix);
+    }
+
+    int mipp_profile_stop(mipp_t *mipp)
+    {
+        return mipp_set_option(mipp, "profile", "");
+    }
+
+    int mipp_set_receive_video_frame_pad(mipp_t *mipp, void *opaque, int (*receive_video_frame)(void *opaque, int out_pad, int width, int height, double pts, uint8_t *data))
+    {
+        if (!receive_video_frame)
+        {
+            engine(mipp)->pad_callback = nullptr;
+            return 0;
+        }
+        engine(mipp)->pad_callback = [opaque, receive_video_frame](int pad, int width, int height, double pts, uint8_t *data)
+        { return receive_video_frame(opaque, pad, width, height, pts, data); };
+        return 0;
+    }
+
+    int mipp_get_output_size(mipp_t *mipp, int out_pad, int *width, int *height)
+    {
+        auto e = engine(mipp);
+        auto first = e->outputPads() - static_cast<int>(e->renditions.size());
+        if (out_pad < 0 || out_pad >= e->outputPads())
+        {
+            return -1;
+        }
+        *width = out_pad >= first ? e->renditions[out_pad - first].first : e->crop.width;
+        *height = out_pad >= first ? e->renditions[out_pad - first].second : e->crop.height;
+        return 0;
+    }
+
+    int mipp_set_metadata_callback(mipp_t *mipp, void *opaque, void (*metadata)(void *opaque, double pts, const char *key, const char *value))
+    {
+        if (!metadata)
+        {
+            engine(mipp)->metadata_callback = nullptr;
+            return 0;
+        }
+        engine(mipp)->metadata_callback = [opaque, metadata](double pts, const std::string &key, const std::string &value)
+        { metadata(opaque, pts, key.c_str(), value.c_str()); };
+        return 0;
+    }
+
+    int mipp_reload(mipp_t *mipp, const char *script_path)
+    {
+        engine(mipp)->request_reload(script_path ? script_path : "");
+        return 0;
+    }
+
+    int mipp_get_stats(mipp_t *mipp, mipp_stats_t *stats)
+    {
+        engine(mipp)->get_stats(stats);
+        return 0;
     }
 };
@@ -30,16 +30,229 @@ extern "C"
     {
         void *priv;
         int video_in_count;
+        int video_out_count; // output pads, see make_pads and the "renditions" option
     } mipp_t;
 
+    /**
+     * @brief Host pixel formats. 16 bit formats are little endian.
+     *
+     * MIPP_PIX_FMT_RGB32 frames are drawn on 8 bit surfaces, everything else on float
+     * (cairo RGBA128F) surfaces whose `data` is a Float32Array. Only packed formats
+     * can be used for output.
+     */
+    enum mipp_pix_fmt
+    {
+        MIPP_PIX_FMT_RGB32 = 0, // AV_PIX_FMT_RGB32, native endian 0xAARRGGBB
+        MIPP_PIX_FMT_RGBA64,    // AV_PIX_FMT_RGBA64LE
+        MIPP_PIX_FMT_RGB48,     // AV_PIX_FMT_RGB48LE
+        MIPP_PIX_FMT_YUV420P10, // AV_PIX_FMT_YUV420P10LE, BT.2020 limited range
+        MIPP_PIX_FMT_P010,      // AV_PIX_FMT_P010LE, BT.2020 limited range
+    };
+
+    /**
+     * @brief What to output for a frame whose script ran out of its budget, or was skipped to meet a deadline
+     */
+    enum mipp_overrun
+    {
+        MIPP_OVERRUN_PASSTHROUGH = 0, // the input frame, unmodified
+        MIPP_OVERRUN_REPEAT,          // the last output frame again, with the new pts
+        MIPP_OVERRUN_DROP,            // nothing
+    };
+
+    typedef struct mipp_stats
+    {
+        uint64_t frames_in;     // frames sent to mipp
+        uint64_t frames_out;    // frames passed to receive_video_frame
+        uint64_t script_errors; // frames where the script threw
+        uint64_t overruns;      // frames where the script was terminated for running out of budget
+        uint64_t passed_through;
+        uint64_t repeated;
+        uint64_t dropped;
+        uint64_t skipped;         // frames the scheduler didn't give to the script, see "latency_ms"
+        uint64_t late;            // frames output after their deadline
+        double max_lateness_ms;   // worst time past a deadline
+        double avg_cost_ms;       // moving average of script time per frame
+        double frame_interval_ms; // moving average of the pts step
+        uint64_t worker_restarts; // see mipp_init_worker
+        uint64_t idle;            // frames no timeline element was live on, passed through without running the script
+        uint64_t log_dropped;     // log messages lost to a full log queue
+        uint64_t log_suppressed;  // log messages over the "log_rate" of their line
+        uint64_t prerendered;     // overlay() calls served from renderings made ahead, see prerender()
+    } mipp_stats_t;
+
     extern int mipp_init(mipp_t *mipp, char *script_path, void *opaque,
                          int (*receive_video_frame)(void *, int width, int height, double pts, uint8_t *data),
                          void log(int level, const char *msg));
 
+    /**
+     * @brief Like mipp_init, but the script runs in `workers` mipp_worker processes (Linux only).
+     *
+     * Frames are passed through shared memory. A worker that crashes is restarted and the
+     * frames it had in flight are dropped. worker_path NULL looks for mipp_worker on PATH,
+     * slot_bytes 0 sizes shared memory for up to 4K RGBA64 frames. With more than one worker,
+     * outputs come out in input order but may be delivered during later mipp_send calls, see
+     * mipp_flush.
+     *
+     * Frames go to the workers round robin (a pad 0 frame and the other pads' frames after it
+     * go together), and every worker runs its own copy of the script. With N workers each copy
+     * sees only every Nth frame: state a script carries from one frame to the next (counters,
+     * previous frames, keep_history, animations driven by frame count rather than pts) is split
+     * across the copies and comes out wrong. Use more than one worker only for scripts whose
+     * output depends on the current frame and its pts alone.
+     */
+    extern int mipp_init_worker(mipp_t *mipp, char *script_path, const char *worker_path, int workers, uint64_t slot_bytes, void *opaque,
+                                int (*receive_video_frame)(void *, int width, int height, double pts, uint8_t *data),
+                                void log(int level, const char *msg));
+
     extern void mipp_free(mipp_t *mipp);
 
+    // Deliver the output of every frame sent so far
+    extern int mipp_flush(mipp_t *mipp);
+
     extern int mipp_send_video_frame(mipp_t *mipp, int width, int height, int stride, double pts, uint8_t *data, int in_pad);
 
+    // Like mipp_send_video_frame for any mipp_pix_fmt, planes and strides as in AVFrame data/linesize
+    extern int mipp_send_video_frame_planes(mipp_t *mipp, int format, int width, int height, const int *strides, double pts, uint8_t *const *planes, int in_pad);
+
+    /**
+     * @brief Kinds of per frame data a host can pass along with the pixels, see mipp_frame_t.
+     *
+     * The bytes are passed as the decoder exported them, in the layout of the matching
+     * AVFrameSideDataType. Scripts see each one as frame.sideData.<name>, a Uint8Array over
+     * the host's memory, valid until the call that received the frame returns.
+     */
+    enum mipp_side_data_type
+    {
+        MIPP_SIDE_DATA_MOTION_VECTORS = 0, // motionVectors, AVMotionVector[], 40 bytes each
+        MIPP_SIDE_DATA_REGIONS_OF_INTEREST, // regionsOfInterest, AVRegionOfInterest[]
+        MIPP_SIDE_DATA_A53_CC,              // closedCaptions, ATSC A53 Part 4 cc_data
+        MIPP_SIDE_DATA_SEI_UNREGISTERED,    // seiUnregistered, a UUID then the payload
+        MIPP_SIDE_DATA_TYPES,
+    };
+
+    typedef struct mipp_side_data
+    {
+        int type; // mipp_side_data_type
+        const uint8_t *data;
+        uint64_t size;
+    } mipp_side_data_t;
+
+    // One input frame of a mipp_send_video_frames batch, fields as in mipp_send_video_frame_planes
+    typedef struct mipp_frame
+    {
+        int format;
+        int width;
+        int height;
+        int strides[4];
+        uint8_t *planes[4];
+        double pts;
+        int in_pad;
+        const mipp_side_data_t *side_data; // side_data_count entries, may be NULL
+        int side_data_count;
+    } mipp_frame_t;
+
+    /**
+     * @brief Send the frames of one event, typically one per input pad, in a single call.
+     *
+     * Scripts that define receive_video_frames(frames, pads) get the whole batch in one call,
+     * an array of VideoFrames and the matching array of input pads. Other scripts get one
+     * receive_video_frame call per entry, still within a single entry into the script. The
+     * frame budget applies to the batch. Returns -1 if any entry has an unknown format.
+     */
+    extern int mipp_send_video_frames(mipp_t *mipp, const mipp_frame_t *frames, int count);
+
+    /**
+     * @brief Run mipp's per frame native work (conversions, copies, kernels) on the host's threads.
+     *
+     * Shaped like AVFilterGraph's execute: run job(opaque, arg, jobnr, nb_jobs) for jobnr 0 to
+     * nb_jobs - 1, possibly in parallel, and return once all have. max_jobs is how many the host
+     * runs at once. Only used from inside calls to mipp that frames are sent on, so it may rely on
+     * running on the host's own filter thread. NULL goes back to mipp's own pool.
+     */
+    extern int mipp_set_execute(mipp_t *mipp, void *opaque,
+                                int (*execute)(void *opaque, int (*job)(void *opaque, void *arg, int jobnr, int nb_jobs), void *arg, int *ret, int nb_jobs),
+                                int max_jobs);
+
+    // Format of the data passed to receive_video_frame, packed with a stride of width * bytes per pixel
+    extern int mipp_set_video_out_format(mipp_t *mipp, int format);
+
+    /**
+     * @brief Set a runtime option, returns -1 for unknown keys.
+     *
+     * "watch"          milliseconds between checks for changes to the script file, "0" to stop
+     * "budget_ms"      wall time the script may spend on one frame, "0" for unlimited
+     * "budget_cpu_ms"  CPU time the script may spend on one frame, "0" for unlimited. Linux and
+     *                  macOS only, elsewhere any other value returns -1
+     * "overrun"        "passthrough", "repeat" or "drop", see mipp_overrun
+     * "latency_ms"     live mode: frames are due this long after their pts on the wall clock, the
+     *                  script is skipped for frames it can't finish in time. "0" (default) is off
+     * "late"           "passthrough" (default), "repeat" or "drop", stand in for a skipped frame.
+     *                  Scripts draw on the frame itself, so there is no overlay to put on the
+     *                  current input: "repeat" freezes the picture, "passthrough" shows the
+     *                  input without the script's drawing
+     * "capture"        record every frame sent to this file, for replay with mipp_test. "" stops
+     * "renditions"     "WxH[,WxH...]", an output pad for each size after the script's own, fed
+     *                  natively with output pad 0 scaled to that size. "" removes them
+     * "crop"           "WxH+X+Y", the script's outputs are cut to that rectangle before conversion,
+     *                  frames it doesn't fit in are dropped. "" (default) is off
+     * "history_mb"     memory for the frames a script keeps with keep_history, the oldest are dropped
+     *                  past it. 256 by default
+     * "render_cache_mb" size of the on disk cache behind cached(key, render) for every mipp in the
+     *                  process, least recently used renderings are evicted past it. 1024 by default
+     * "profile"        start a V8 CPU profile of the script, written to <prefix>-<pid>-<n>.cpuprofile
+     *                  when "" stops it or the mipp is freed. MIPP_PROFILE=<prefix> sets it at init
+     * "profile_heap"   "1" to also sample allocations into a .heapprofile, set before "profile"
+     * "profile_signal" SIGUSR2 starts and stops a profile with this prefix. "" (default) is off
+     * "prerender"      "0" renders every overlay() on the frame path, for hosts without spare cores.
+     *                  "1" (default) lets scripts that call prerender() render ahead on another thread
+     * "log_level"      messages above this level are dropped before they are formatted, 56 by default
+     * "log_rate"       messages per second each log() line of a script may send, "0" for unlimited.
+     *                  50 by default, the count held back is reported with the next one let through
+     * "log_thread"     "1" (default) calls the log callback from a background thread, "0" calls it
+     *                  from the thread sending frames, after each frame
+     */
+    extern int mipp_set_option(mipp_t *mipp, const char *key, const char *value);
+
+    /**
+     * @brief Profile the script until mipp_profile_stop, see the "profile" options.
+     *
+     * The .cpuprofile and .heapprofile files open in Chrome DevTools. The CPU profile carries
+     * the frame number and pts of every frame sent meanwhile under its "mipp" key. Run with
+     * MIPP_PERF_MAP=1 for perf to resolve JIT compiled script frames through /tmp/perf-<pid>.map.
+     */
+    extern int mipp_profile_start(mipp_t *mipp, const char *prefix, int heap);
+
+    extern int mipp_profile_stop(mipp_t *mipp);
+
+    /**
+     * @brief Receive the frames of every output pad, instead of receive_video_frame which only gets pad 0.
+     */
+    extern int mipp_set_receive_video_frame_pad(mipp_t *mipp, void *opaque, int (*receive_video_frame)(void *opaque, int out_pad, int width, int height, double pts, uint8_t *data));
+
+    // Size of an output pad added by "renditions" or of the "crop", 0x0 for the script's own pads
+    // without a crop, which are the size of what it sends
+    extern int mipp_get_output_size(mipp_t *mipp, int out_pad, int *width, int *height);
+
+    /**
+     * @brief Receive the key/values a script attached to an output frame with frame.setMetadata.
+     *
+     * Called once per key from within mipp_send_video_frame (or mipp_flush), right before
+     * receive_video_frame for the frame they belong to. NULL stops.
+     */
+    extern int mipp_set_metadata_callback(mipp_t *mipp, void *opaque, void (*metadata)(void *opaque, double pts, const char *key, const char *value));
+
+    /**
+     * @brief Reload the script, or switch to script_path when it is not NULL. Safe to call from any thread.
+     *
+     * The new version is compiled in the background and swapped in at the start of a later
+     * frame. If it fails to compile, to run, or to handle its first frame the previous version
+     * keeps running.
+     */
+    extern int mipp_reload(mipp_t *mipp, const char *script_path);
+
+    // Call from the thread sending frames, counters are not synchronized
+    extern int mipp_get_stats(mipp_t *mipp, mipp_stats_t *stats);
+
 #ifdef __cplusplus
 } // extern "C"
 #endif
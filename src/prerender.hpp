@@ -0,0 +1,211 @@
+// Copyright 2024 Mux, Inc.
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// Renderings of a script's render_overlay(pts) made ahead of the frames that need them
+//
+// A thread with a second copy of the script (its own isolate, see Mipp's prerenderer) renders
+// the pts values the next frames are expected to have, extrapolated from the step between
+// the last two requests, into a queue of at most `depth` surfaces. The thread runs at a lower
+// priority so it only takes cores the frame path leaves idle. A request for a pts that isn't
+// ready is rendered on the spot by the caller, predictions that turn out wrong are dropped.
+namespace prerender
+{
+    // pts closer than this are the same frame, predictions accumulate rounding
+    static constexpr double same_pts = 1e-6;
+
+    struct Surface
+    {
+        double pts = 0;
+        int width = 0;
+        int height = 0;
+        bool is_float = false;
+        std::shared_ptr<std::vector<uint8_t>> pixels; // packed rows
+    };
+
+    // What runs on the thread, made there since an isolate belongs to the thread that enters it
+    struct Renderer
+    {
+        std::function<bool(double pts, Surface &out)> render;
+    };
+
+    // Setup hands over how to stop it from another thread (a render, or setup itself running
+    // the script) as soon as there is something to stop, before it runs any script
+    using Publish = std::function<void(std::function<void()> interrupt)>;
+
+    class Lookahead
+    {
+    private:
+        std::mutex m;
+        std::condition_variable cv;
+        std::deque<double> todo;     // pts to render, in order
+        std::deque<Surface> ready;   // by pts
+        bool busy = false;           // rendering `current`
+        bool starting = true;        // in setup
+        double current = 0;
+        double oldest = -INFINITY;   // anything before this is no longer wanted
+        size_t depth;
+        bool quit = false;
+        std::function<void()> interrupt;
+        std::thread thread;
+
+        bool wanted(double pts) const
+        {
+            return pts >= oldest - same_pts;
+        }
+
+        bool known(double pts) const
+        {
+            auto near = [pts](double p)
+            { return std::abs(p - pts) <= same_pts; };
+            return (busy && near(current)) || std::any_of(todo.begin(), todo.end(), near) ||
+                   std::any_of(ready.begin(), ready.end(), [&](const Surface &s)
+                               { return near(s.pts); });
+        }
+
+        void run(const std::function<Renderer(const Publish &)> &setup)
+        {
+#ifdef __linux__
+            // Idle cores only, the frame path keeps its priority
+            setpriority(PRIO_PROCESS, static_cast<id_t>(syscall(SYS_gettid)), 10);
+#endif
+
+            auto renderer = setup([this](std::function<void()> f)
+                                  {
+                                      std::lock_guard<std::mutex> lock(m);
+                                      interrupt = std::move(f);
+                                      if (quit)
+                                      {
+                                          interrupt(); // closed before setup got this far
+                                      } });
+            {
+                std::lock_guard<std::mutex> lock(m);
+                starting = false;
+            }
+            for (;;)
+            {
+                double pts;
+                {
+                    std::unique_lock<std::mutex> lock(m);
+                    cv.wait(lock, [&]
+                            { return quit || (!todo.empty() && ready.size() < depth); });
+                    if (quit)
+                    {
+                        break;
+                    }
+                    pts = todo.front();
+                    todo.pop_front();
+                    busy = true;
+                    current = pts;
+                }
+
+                Surface s;
+                auto ok = renderer.render && renderer.render(pts, s);
+
+                std::lock_guard<std::mutex> lock(m);
+                busy = false;
+                if (ok && wanted(pts))
+                {
+                    s.pts = pts;
+                    ready.insert(std::upper_bound(ready.begin(), ready.end(), pts, [](double p, const Surface &e)
+                                                  { return p < e.pts; }),
+                                 std::move(s));
+                }
+            }
+
+            // The isolate goes away on the thread it was made on
+            std::lock_guard<std::mutex> lock(m);
+            interrupt = nullptr;
+            renderer = {};
+        }
+
+    public:
+        Lookahead(std::function<Renderer(const Publish &)> setup, size_t depth) : depth(std::max<size_t>(1, depth))
+        {
+            thread = std::thread([this, setup = std::move(setup)]
+                                 { run(setup); });
+        }
+
+        ~Lookahead()
+        {
+            {
+                std::lock_guard<std::mutex> lock(m);
+                quit = true;
+                if ((busy || starting) && interrupt)
+                {
+                    interrupt();
+                }
+            }
+            cv.notify_all();
+            thread.join();
+        }
+
+        // The surface for `pts` if it is ready. Everything before it is dropped.
+        bool take(double pts, Surface &out)
+        {
+            std::lock_guard<std::mutex> lock(m);
+            oldest = pts;
+            while (!ready.empty() && ready.front().pts < pts - same_pts)
+            {
+                ready.pop_front();
+            }
+            if (ready.empty() || ready.front().pts > pts + same_pts)
+            {
+                return false;
+            }
+            out = std::move(ready.front());
+            ready.pop_front();
+            cv.notify_all();
+            return true;
+        }
+
+        // Queue the `depth` pts after `pts`, `step` apart, in place of older predictions
+        void ahead(double pts, double step)
+        {
+            if (!(step > 0))
+            {
+                return;
+            }
+            std::lock_guard<std::mutex> lock(m);
+            todo.clear();
+            for (size_t k = 1; k <= depth; k++)
+            {
+                auto next = pts + step * k;
+                if (!known(next))
+                {
+                    todo.push_back(next);
+                }
+            }
+            cv.notify_all();
+        }
+    };
+} // namespace
@@ -0,0 +1,229 @@
+// Copyright 2024 Mux, Inc.
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include "ezv8.hpp"
+
+#include <v8-profiler.h>
+
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+// CPU and sampling heap profiles of a running script, in the formats Chrome DevTools and
+// speedscope open: <prefix>-<pid>-<n>.cpuprofile and .heapprofile. The CPU profile also
+// carries a "mipp" key with the frame number and pts of every frame sent while profiling,
+// timed on the profile's clock, so samples can be matched to frames.
+//
+// Nothing is allocated or checked per frame until a profile is started, see the "profile"
+// and "profile_signal" options.
+namespace profile
+{
+    // SIGUSR2 deliveries since the handler was installed, see install_signal
+    static std::atomic<uint32_t> &signals()
+    {
+        static std::atomic<uint32_t> count{0};
+        return count;
+    }
+
+    static void install_signal()
+    {
+        static std::once_flag once;
+        std::call_once(once, []
+                       {
+                           struct sigaction sa = {};
+                           sa.sa_handler = [](int)
+                           { signals().fetch_add(1, std::memory_order_relaxed); };
+                           sa.sa_flags = SA_RESTART;
+                           sigemptyset(&sa.sa_mask);
+                           sigaction(SIGUSR2, &sa, nullptr); });
+    }
+
+    static std::string json_string(const std::string &s)
+    {
+        std::string out = "\"";
+        for (unsigned char c : s)
+        {
+            if (c == '"' || c == '\\')
+            {
+                out += '\\';
+                out += c;
+            }
+            else if (c < 0x20)
+            {
+                char esc[8];
+                std::snprintf(esc, sizeof(esc), "\\u%04x", c);
+                out += esc;
+            }
+            else
+            {
+                out += c;
+            }
+        }
+        return out + "\"";
+    }
+
+    class Session
+    {
+    private:
+        struct Mark
+        {
+            uint64_t frame;
+            double pts;
+            std::chrono::steady_clock::time_point at;
+        };
+
+        v8::Isolate *iso;
+        v8::CpuProfiler *cpu;
+        bool heap;
+        std::string path;
+        std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+        std::vector<Mark> marks;
+
+        struct StringStream : v8::OutputStream
+        {
+            std::string out;
+            void EndOfStream() override {}
+            int GetChunkSize() override { return 64 * 1024; }
+            WriteResult WriteAsciiChunk(char *data, int size) override
+            {
+                out.append(data, size);
+                return kContinue;
+            }
+        };
+
+        static void write_node(v8::Isolate *iso, const v8::AllocationProfile::Node *node, std::string &out)
+        {
+            size_t self = 0;
+            for (auto &a : node->allocations)
+            {
+                self += a.size * a.count;
+            }
+            out += "{\"callFrame\":{\"functionName\":" + json_string(*v8::String::Utf8Value(iso, node->name)) +
+                   ",\"scriptId\":\"" + std::to_string(node->script_id) +
+                   "\",\"url\":" + json_string(*v8::String::Utf8Value(iso, node->script_name)) +
+                   ",\"lineNumber\":" + std::to_string(node->line_number - 1) +
+                   ",\"columnNumber\":" + std::to_string(node->column_number - 1) +
+                   "},\"selfSize\":" + std::to_string(self) +
+                   ",\"id\":" + std::to_string(node->node_id) + ",\"children\":[";
+            for (size_t i = 0; i < node->children.size(); i++)
+            {
+                if (i)
+                    out += ',';
+                write_node(iso, node->children[i], out);
+            }
+            out += "]}";
+        }
+
+        bool write_cpu(v8::CpuProfile *profile)
+        {
+            StringStream json;
+            profile->Serialize(&json);
+            auto end = json.out.rfind('}');
+            if (end == std::string::npos)
+            {
+                return false;
+            }
+
+            // Frame marks on the profile's clock, steady_clock offsets from its start
+            std::string frames = ",\"mipp\":{\"frames\":[";
+            for (size_t i = 0; i < marks.size(); i++)
+            {
+                auto us = std::chrono::duration_cast<std::chrono::microseconds>(marks[i].at - started).count();
+                char item[96];
+                std::snprintf(item, sizeof(item), "%s[%llu,%.6f,%lld]", i ? "," : "", static_cast<unsigned long long>(marks[i].frame),
+                              marks[i].pts, static_cast<long long>(profile->GetStartTime() + us));
+                frames += item;
+            }
+            frames += "]}";
+            json.out.insert(end, frames);
+
+            std::ofstream f(path + ".cpuprofile", std::ios::binary | std::ios::trunc);
+            return !!f.write(json.out.data(), json.out.size());
+        }
+
+        bool write_heap(v8::AllocationProfile *profile)
+        {
+            std::string out = "{\"head\":";
+            write_node(iso, profile->GetRootNode(), out);
+            out += ",\"samples\":[";
+            auto &samples = profile->GetSamples();
+            for (size_t i = 0; i < samples.size(); i++)
+            {
+                out += (i ? ",{\"size\":" : "{\"size\":") + std::to_string(samples[i].size * samples[i].count) +
+                       ",\"nodeId\":" + std::to_string(samples[i].node_id) +
+                       ",\"ordinal\":" + std::to_string(samples[i].sample_id) + "}";
+            }
+            out += "]}";
+            std::ofstream f(path + ".heapprofile", std::ios::binary | std::ios::trunc);
+            return !!f.write(out.data(), out.size());
+        }
+
+    public:
+        Session(v8::Isolate *iso, const std::string &prefix, bool heap)
+            : iso(iso), cpu(v8::CpuProfiler::New(iso)), heap(heap)
+        {
+            static std::atomic<int> n{0};
+            path = prefix + "-" + std::to_string(getpid()) + "-" + std::to_string(n++);
+
+            v8::HandleScope scope(iso);
+            cpu->StartProfiling(v8::String::NewFromUtf8(iso, "mipp").ToLocalChecked(), v8::kLeafNodeLineNumbers, true);
+            if (heap)
+            {
+                iso->GetHeapProfiler()->StartSamplingHeapProfiler();
+            }
+        }
+
+        ~Session()
+        {
+            cpu->Dispose();
+        }
+
+        const std::string &prefix() const { return path; }
+
+        void mark(uint64_t frame, double pts)
+        {
+            marks.push_back({frame, pts, std::chrono::steady_clock::now()});
+        }
+
+        // Stop and write the files, false if any could not be written
+        bool finish()
+        {
+            v8::HandleScope scope(iso);
+            auto ok = false;
+            if (auto profile = cpu->StopProfiling(v8::String::NewFromUtf8(iso, "mipp").ToLocalChecked()))
+            {
+                ok = write_cpu(profile);
+                profile->Delete();
+            }
+            if (heap)
+            {
+                auto heap_profiler = iso->GetHeapProfiler();
+                std::unique_ptr<v8::AllocationProfile> profile(heap_profiler->GetAllocationProfile());
+                ok = profile && write_heap(profile.get()) && ok;
+                heap_profiler->StopSamplingHeapProfiler();
+            }
+            return ok;
+        }
+    };
+} // namespace
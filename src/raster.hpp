@@ -0,0 +1,146 @@
+// Copyright 2024 Mux, Inc.
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include "threadpool.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+
+// Native rasterization of the primitives scripts use most: pixel aligned rectangles with a
+// solid color and unscaled image draws, on premultiplied ARGB32. The cairo class takes these
+// paths when the transform is an integer translation and falls back to cairo for everything
+// else. Arithmetic follows pixman's so results match cairo's, mipp_bench --raster checks
+// that they do. Plain loops the compiler vectorizes.
+namespace raster
+{
+    // Smaller areas aren't worth waking the thread pool for
+    static constexpr int parallel_area = 256 * 1024;
+
+    struct Rect
+    {
+        int x = 0, y = 0, width = 0, height = 0;
+
+        Rect clip(int w, int h) const
+        {
+            Rect r;
+            r.x = std::max(0, x);
+            r.y = std::max(0, y);
+            r.width = std::max(0, std::min(x + width, w) - r.x);
+            r.height = std::max(0, std::min(y + height, h) - r.y);
+            return r;
+        }
+    };
+
+    // A cairo solid color as pixman gets it: premultiplied in 16 bits, truncated, then the high byte
+    static uint32_t premultiply(double r, double g, double b, double a)
+    {
+        auto c = [a](double v)
+        { return static_cast<uint32_t>(static_cast<uint16_t>(v * a * 65535.0) >> 8); };
+        return c(1.0) << 24 | c(r) << 16 | c(g) << 8 | c(b);
+    }
+
+    // x * a / 255 rounded, pixman's MUL_UN8
+    static inline uint32_t mul_un8(uint32_t x, uint32_t a)
+    {
+        auto t = x * a + 0x80;
+        return (t + (t >> 8)) >> 8;
+    }
+
+    // s OVER d for one premultiplied pixel
+    static inline uint32_t over(uint32_t s, uint32_t d)
+    {
+        auto ia = 255 - (s >> 24);
+        uint32_t out = 0;
+        for (int shift = 0; shift < 32; shift += 8)
+        {
+            auto v = ((s >> shift) & 0xff) + mul_un8((d >> shift) & 0xff, ia);
+            out |= std::min(v, 255u) << shift;
+        }
+        return out;
+    }
+
+    static void rows(const Rect &r, const std::function<void(int y0, int y1)> &fn)
+    {
+        if (r.width * r.height >= parallel_area)
+        {
+            parallel_rows(r.height, [&](int y0, int y1)
+                          { fn(r.y + y0, r.y + y1); });
+        }
+        else
+        {
+            fn(r.y, r.y + r.height);
+        }
+    }
+
+    // Replace the pixels of r with color (transparent for clearRect)
+    static void fill_source(uint8_t *data, int stride, const Rect &r, uint32_t color)
+    {
+        rows(r, [&](int y0, int y1)
+             {
+                 for (int y = y0; y < y1; y++)
+                 {
+                     auto p = reinterpret_cast<uint32_t *>(data + static_cast<size_t>(y) * stride) + r.x;
+                     std::fill(p, p + r.width, color);
+                 } });
+    }
+
+    static void fill_over(uint8_t *data, int stride, const Rect &r, uint32_t color)
+    {
+        if (color >> 24 == 0xff)
+        {
+            fill_source(data, stride, r, color);
+            return;
+        }
+        if (color == 0)
+        {
+            return;
+        }
+        rows(r, [&](int y0, int y1)
+             {
+                 for (int y = y0; y < y1; y++)
+                 {
+                     auto p = reinterpret_cast<uint32_t *>(data + static_cast<size_t>(y) * stride) + r.x;
+                     for (int x = 0; x < r.width; x++)
+                     {
+                         p[x] = over(color, p[x]);
+                     }
+                 } });
+    }
+
+    // Composite src (src_width x src_height) OVER dst with its top left corner at (x, y)
+    static void blit_over(const uint8_t *src, int src_stride, int src_width, int src_height,
+                          uint8_t *dst, int dst_stride, int dst_width, int dst_height, int x, int y)
+    {
+        auto r = Rect{x, y, src_width, src_height}.clip(dst_width, dst_height);
+        if (r.width <= 0 || r.height <= 0)
+        {
+            return;
+        }
+        rows(r, [&](int y0, int y1)
+             {
+                 for (int dy = y0; dy < y1; dy++)
+                 {
+                     auto s = reinterpret_cast<const uint32_t *>(src + static_cast<size_t>(dy - y) * src_stride) + (r.x - x);
+                     auto d = reinterpret_cast<uint32_t *>(dst + static_cast<size_t>(dy) * dst_stride) + r.x;
+                     for (int i = 0; i < r.width; i++)
+                     {
+                         d[i] = over(s[i], d[i]);
+                     }
+                 } });
+    }
+} // namespace
@@ -0,0 +1,224 @@
+// Copyright 2024 Mux, Inc.
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include "ezv8.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// Recompiles a script off the frame thread.
+//
+// A reload is requested explicitly or by the watcher thread noticing a new mtime. The frame
+// thread then calls poll() at each frame boundary: the first call starts a V8 streaming
+// compile whose task reads and parses the file on a background thread, later calls return
+// true once that is done and finish() hands back the compiled script for a fresh context.
+class ScriptReloader
+{
+private:
+    // Feeds the file to the streaming parser, keeping a copy for ScriptCompiler::Compile
+    class FileStream : public v8::ScriptCompiler::ExternalSourceStream
+    {
+    private:
+        std::string path;
+        std::string &source;
+        bool done = false;
+
+    public:
+        FileStream(std::string path, std::string &source) : path(std::move(path)), source(source) {}
+
+        size_t GetMoreData(const uint8_t **src) override
+        {
+            if (done)
+            {
+                return 0;
+            }
+            done = true;
+
+            std::ifstream t(path);
+            source.assign(std::istreambuf_iterator<char>(t), std::istreambuf_iterator<char>());
+            if (source.empty())
+            {
+                return 0;
+            }
+
+            // V8 takes ownership of the chunk
+            auto chunk = new uint8_t[source.size()];
+            std::memcpy(chunk, source.data(), source.size());
+            *src = chunk;
+            return source.size();
+        }
+    };
+
+    std::mutex mutex;
+    std::string path;
+    std::atomic<bool> requested{false};
+
+    std::thread watcher;
+    std::condition_variable watcher_wake;
+    bool watcher_quit = false;
+
+    // Frame thread only
+    std::string source;
+    std::unique_ptr<v8::ScriptCompiler::StreamedSource> streamed;
+    std::unique_ptr<v8::ScriptCompiler::ScriptStreamingTask> task;
+    std::thread compiler;
+    std::atomic<bool> compiled{false};
+
+    static std::filesystem::file_time_type mtime(const std::string &path)
+    {
+        std::error_code ec;
+        return std::filesystem::last_write_time(path, ec);
+    }
+
+    void stop_watching()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            watcher_quit = true;
+        }
+        watcher_wake.notify_all();
+        if (watcher.joinable())
+        {
+            watcher.join();
+        }
+    }
+
+public:
+    ScriptReloader(std::string path) : path(std::move(path)) {}
+
+    ~ScriptReloader()
+    {
+        stop_watching();
+        if (compiler.joinable())
+        {
+            compiler.join();
+        }
+    }
+
+    std::string script_path()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return path;
+    }
+
+    // Any thread. An empty path reloads the current script.
+    void request(const std::string &new_path = "")
+    {
+        if (!new_path.empty())
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            path = new_path;
+        }
+        requested = true;
+    }
+
+    // Frame thread. Back to `old_path` after its replacement was rejected, without reloading it
+    void revert(const std::string &old_path)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        path = old_path;
+    }
+
+    // Frame thread. The text finish() compiled
+    const std::string &source_text() const { return source; }
+
+    // Any thread. Polls the script's mtime every interval, 0 stops watching.
+    void watch(std::chrono::milliseconds interval)
+    {
+        stop_watching();
+        if (interval.count() <= 0)
+        {
+            return;
+        }
+
+        watcher_quit = false;
+        watcher = std::thread([this, interval]
+                              {
+                                  auto watched = script_path();
+                                  auto last = mtime(watched);
+                                  std::unique_lock<std::mutex> lock(mutex);
+                                  while (!watcher_wake.wait_for(lock, interval, [this]
+                                                                { return watcher_quit; }))
+                                  {
+                                      auto current = path;
+                                      lock.unlock();
+                                      auto t = mtime(current);
+                                      if (current != watched)
+                                      {
+                                          // A new or reverted path was reloaded (or not) on its own account
+                                          watched = current;
+                                          last = t;
+                                      }
+                                      else if (t != last)
+                                      {
+                                          last = t;
+                                          requested = true;
+                                      }
+                                      lock.lock();
+                                  } });
+    }
+
+    // Frame thread, once per frame. True when a compiled script is ready for finish()
+    bool poll(v8::Isolate *isolate)
+    {
+        if (task)
+        {
+            return compiled;
+        }
+
+        if (!requested.exchange(false))
+        {
+            return false;
+        }
+
+        source.clear();
+        streamed = std::make_unique<v8::ScriptCompiler::StreamedSource>(std::make_unique<FileStream>(script_path(), source), v8::ScriptCompiler::StreamedSource::UTF8);
+        task.reset(v8::ScriptCompiler::StartStreaming(isolate, streamed.get()));
+        compiled = false;
+        compiler = std::thread([this]
+                               {
+                                   task->Run();
+                                   compiled = true; });
+        return false;
+    }
+
+    // Frame thread, with `context` entered. Compiles the streamed script into `context`
+    v8::MaybeLocal<v8::Script> finish(v8::Isolate *isolate, v8::Local<v8::Context> context)
+    {
+        compiler.join();
+        task.reset();
+
+        auto name = v8::String::NewFromUtf8(isolate, script_path().c_str()).ToLocalChecked();
+        auto origin = v8::ScriptOrigin(isolate, name);
+        v8::Local<v8::String> full;
+        if (!v8::String::NewFromUtf8(isolate, source.c_str(), v8::NewStringType::kNormal, source.size()).ToLocal(&full))
+        {
+            return {};
+        }
+
+        auto script = v8::ScriptCompiler::Compile(context, streamed.get(), full, origin);
+        streamed.reset();
+        return script;
+    }
+};
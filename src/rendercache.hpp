@@ -0,0 +1,229 @@
+// Copyright 2024 Mux, Inc.
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include "cache.hpp"
+#include "cairo.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <ctime>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Renderings a script marked cacheable with `cached(key, render)`
+//
+// Each one is a file in the render/ directory of the mipp cache, named by a hash of its
+// key, holding a Header, the key and the packed pixels. Hits are mapped copy on write, so
+// the frame handed to the script shares pages with every other process using the same
+// rendering and drawing on it never reaches the file. The directory is kept under a size
+// limit by evicting the least recently used files, with a file's mtime as its last use.
+// Stores keep a running total and only scan the directory when it says the limit is
+// exceeded, eviction then makes room for a tenth of the limit so scans stay rare.
+namespace rendercache
+{
+    static constexpr char magic[8] = {'M', 'I', 'P', 'P', 'R', 'N', 'D', '1'};
+
+    struct Header
+    {
+        char magic[8];
+        int32_t width;
+        int32_t height;
+        int32_t is_float;  // RGBA128F, else ARGB32
+        int32_t key_size;  // the key follows, padded to `pixels`
+        int64_t pixels;    // offset of height rows of width * bpp bytes
+        double pts;
+        int32_t reserved[6];
+    };
+
+    // Total size of the directory, see the "render_cache_mb" option
+    static std::atomic<uint64_t> &limit()
+    {
+        static std::atomic<uint64_t> bytes{1024ull << 20};
+        return bytes;
+    }
+
+    // Bytes in the directory as of the last scan, plus what this process stored since
+    static std::atomic<uint64_t> &usage()
+    {
+        static std::atomic<uint64_t> bytes{0};
+        return bytes;
+    }
+
+    static std::string dir()
+    {
+        static const std::string path = []
+        {
+            auto p = std::filesystem::path(cache::dir()) / "render";
+            std::error_code ec;
+            std::filesystem::create_directories(p, ec);
+            return p.string();
+        }();
+        return path;
+    }
+
+    static std::string path(const std::string &key)
+    {
+        char name[32];
+        std::snprintf(name, sizeof(name), "%016llx.frame", static_cast<unsigned long long>(cache::hash(key)));
+        return (std::filesystem::path(dir()) / name).string();
+    }
+
+    struct Mapping
+    {
+        void *data = nullptr;
+        size_t size = 0;
+
+        ~Mapping()
+        {
+            if (data)
+            {
+                munmap(data, size);
+            }
+        }
+    };
+
+    struct Hit
+    {
+        std::unique_ptr<Mapping> mapping;
+        Header header;
+    };
+
+    static bool lookup(const std::string &key, Hit &hit)
+    {
+        auto file = path(key);
+        auto fd = ::open(file.c_str(), O_RDONLY);
+        if (fd < 0)
+        {
+            return false;
+        }
+        struct stat st;
+        auto p = fstat(fd, &st) == 0 && static_cast<size_t>(st.st_size) >= sizeof(Header) ? mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+        if (p != MAP_FAILED && st.st_mtime + 60 < time(nullptr))
+        {
+            // Used again, coarse enough that hits don't cost a syscall each
+            futimens(fd, nullptr);
+        }
+        close(fd);
+        if (p == MAP_FAILED)
+        {
+            return false;
+        }
+
+        hit.mapping = std::make_unique<Mapping>();
+        hit.mapping->data = p;
+        hit.mapping->size = st.st_size;
+        auto &h = hit.header;
+        std::memcpy(&h, p, sizeof(h));
+        auto bpp = h.is_float ? 16 : 4;
+        if (std::memcmp(h.magic, magic, sizeof(magic)) != 0 || h.width <= 0 || h.height <= 0 || h.key_size != static_cast<int32_t>(key.size()) ||
+            h.pixels < static_cast<int64_t>(sizeof(Header) + key.size()) || h.pixels % 16 != 0 ||
+            static_cast<size_t>(h.pixels) + static_cast<size_t>(h.width) * h.height * bpp > hit.mapping->size ||
+            std::memcmp(static_cast<const char *>(p) + sizeof(Header), key.data(), key.size()) != 0)
+        {
+            // Corrupt, or another key with the same hash
+            hit.mapping.reset();
+            return false;
+        }
+        return true;
+    }
+
+    // Count the directory, and if it is over the limit drop the least recently used renderings
+    // until it is under 90% of it
+    static void evict()
+    {
+        std::vector<std::tuple<std::filesystem::file_time_type, uint64_t, std::filesystem::path>> files;
+        uint64_t total = 0;
+        std::error_code ec;
+        for (auto &entry : std::filesystem::directory_iterator(dir(), ec))
+        {
+            if (entry.path().extension() != ".frame")
+            {
+                continue;
+            }
+            auto size = entry.file_size(ec);
+            auto time = entry.last_write_time(ec);
+            if (!ec)
+            {
+                files.emplace_back(time, size, entry.path());
+                total += size;
+            }
+        }
+        auto max = limit().load();
+        if (total > max)
+        {
+            std::sort(files.begin(), files.end());
+            for (auto &[time, size, file] : files)
+            {
+                if (total <= max - max / 10)
+                {
+                    break;
+                }
+                // Mappings of the file stay valid after it is gone
+                std::filesystem::remove(file, ec);
+                total -= size;
+            }
+        }
+        usage() = total;
+    }
+
+    static bool store(const std::string &key, cairo &surface, double pts)
+    {
+        surface.flush();
+        Header h = {};
+        std::memcpy(h.magic, magic, sizeof(magic));
+        h.width = surface.width();
+        h.height = surface.height();
+        h.is_float = surface.is_float();
+        h.key_size = key.size();
+        h.pixels = (sizeof(Header) + key.size() + 15) / 16 * 16;
+        h.pts = pts;
+
+        auto row = static_cast<size_t>(h.width) * (h.is_float ? 16 : 4);
+        auto size = h.pixels + row * h.height;
+        if (h.width <= 0 || h.height <= 0 || size > limit())
+        {
+            return false;
+        }
+        std::vector<uint8_t> out(size);
+        std::memcpy(out.data(), &h, sizeof(h));
+        std::memcpy(out.data() + sizeof(h), key.data(), key.size());
+        for (int y = 0; y < h.height; y++)
+        {
+            std::memcpy(out.data() + h.pixels + y * row, surface.data() + static_cast<size_t>(y) * surface.stride(), row);
+        }
+        if (!cache::write(path(key), out.data(), out.size()))
+        {
+            return false;
+        }
+
+        // Other processes' stores only show up in a scan, the first one counts what is there
+        static std::atomic<bool> scanned{false};
+        if (usage().fetch_add(size) + size > limit() || !scanned.exchange(true))
+        {
+            evict();
+        }
+        return true;
+    }
+} // namespace
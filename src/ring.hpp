@@ -0,0 +1,280 @@
+// Copyright 2024 Mux, Inc.
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#ifdef __linux__
+
+#include "mipp.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <string>
+
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+// Shared memory channel between a mipp host and a mipp_worker process.
+//
+// One memfd holds a header and two single producer, single consumer queues of fixed size
+// slots: requests from the host and responses from the worker. Every slot starts with a
+// Message, frame pixels follow it in the same slot, so frames cross the process boundary
+// with one memcpy and no encoding. Slots are sized for the largest frame and the memfd is
+// sparse, pages are only committed as frames touch them. Both sides block on the queue
+// counters with futexes.
+namespace ring
+{
+    static constexpr uint32_t magic = 0x4d495050; // "MIPP"
+
+    enum Kind : uint32_t
+    {
+        // host -> worker
+        FRAME,
+        OPTION, // payload "key\0value\0"
+        RELOAD, // payload path, empty for the current script
+        OUT_FORMAT,
+        QUIT,
+
+        // worker -> host
+        FRAME_OUT,
+        DONE,     // the worker finished a FRAME, `ret` is what mipp_send_video_frames returned
+        LOG,      // payload text
+        METADATA, // of the next FRAME_OUT, payload "key\0value\0"
+    };
+
+    struct Message
+    {
+        uint32_t kind;
+        int32_t format;
+        int32_t width;
+        int32_t height;
+        int32_t pad;
+        int32_t ret;
+        uint64_t seq;
+        double pts;
+        int32_t strides[4];
+        uint64_t offsets[4]; // of each plane, from the start of the payload
+        uint64_t bytes;      // of payload
+        uint64_t side_data;  // offset of side_data_count SideData records, each followed by its bytes
+        int32_t side_data_count;
+
+        uint8_t *payload() { return reinterpret_cast<uint8_t *>(this + 1); }
+    };
+
+    // One mipp_side_data_t of a FRAME, records are 64 byte aligned
+    struct SideData
+    {
+        int32_t type;
+        uint32_t reserved;
+        uint64_t size;
+    };
+
+    struct Queue
+    {
+        std::atomic<uint32_t> head; // slots written, only the producer moves it
+        std::atomic<uint32_t> tail; // slots read, only the consumer moves it
+        uint32_t slots;
+        uint64_t offset; // of the first slot from the start of the mapping
+    };
+
+    struct Shared
+    {
+        uint32_t magic;
+        std::atomic<uint32_t> ready; // set by the worker once the script is loaded
+        int32_t video_in_count;
+        int32_t video_out_count;
+        uint64_t slot_bytes;
+        Queue requests;
+        Queue responses;
+        mipp_stats_t stats; // the worker's, updated after every frame
+    };
+
+    static long futex(std::atomic<uint32_t> *word, int op, uint32_t val, const timespec *timeout = nullptr)
+    {
+        return syscall(SYS_futex, reinterpret_cast<uint32_t *>(word), op, val, timeout, nullptr, 0);
+    }
+
+    // Sleep while *word == expected, at most timeout_ms
+    static void wait(std::atomic<uint32_t> *word, uint32_t expected, int timeout_ms)
+    {
+        timespec ts = {timeout_ms / 1000, (timeout_ms % 1000) * 1000000L};
+        futex(word, FUTEX_WAIT, expected, &ts);
+    }
+
+    static void wake(std::atomic<uint32_t> *word)
+    {
+        futex(word, FUTEX_WAKE, INT32_MAX);
+    }
+
+    class Channel
+    {
+    private:
+        int fd = -1;
+        uint8_t *base = nullptr;
+        size_t size = 0;
+
+        Message *slot(Queue &q, uint32_t index) { return reinterpret_cast<Message *>(base + q.offset + (index % q.slots) * shared()->slot_bytes); }
+
+        bool map(int map_fd, size_t bytes)
+        {
+            auto p = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, map_fd, 0);
+            if (p == MAP_FAILED)
+            {
+                return false;
+            }
+            fd = map_fd;
+            base = static_cast<uint8_t *>(p);
+            size = bytes;
+            return true;
+        }
+
+    public:
+        Channel() = default;
+        Channel(const Channel &) = delete;
+        Channel &operator=(const Channel &) = delete;
+
+        ~Channel()
+        {
+            if (base)
+            {
+                munmap(base, size);
+            }
+            if (fd >= 0)
+            {
+                close(fd);
+            }
+        }
+
+        Shared *shared() { return reinterpret_cast<Shared *>(base); }
+        int descriptor() const { return fd; }
+
+        // Host side
+        bool create(uint32_t request_slots, uint32_t response_slots, uint64_t slot_bytes)
+        {
+            // Powers of two, so slot indices stay continuous when the counters wrap
+            auto pow2 = [](uint32_t n)
+            {
+                uint32_t p = 1;
+                while (p < n)
+                    p <<= 1;
+                return p;
+            };
+            request_slots = pow2(request_slots);
+            response_slots = pow2(response_slots);
+            slot_bytes = (slot_bytes + sizeof(Message) + 4095) & ~uint64_t(4095);
+            auto header = (sizeof(Shared) + 4095) & ~size_t(4095);
+            auto bytes = header + (request_slots + response_slots) * slot_bytes;
+
+            auto memfd = memfd_create("mipp", MFD_CLOEXEC);
+            if (memfd < 0 || ftruncate(memfd, bytes) != 0 || !map(memfd, bytes))
+            {
+                if (memfd >= 0)
+                    close(memfd);
+                return false;
+            }
+
+            auto s = new (base) Shared();
+            s->slot_bytes = slot_bytes;
+            s->requests.slots = request_slots;
+            s->requests.offset = header;
+            s->responses.slots = response_slots;
+            s->responses.offset = header + request_slots * slot_bytes;
+            s->magic = magic;
+            return true;
+        }
+
+        // Worker side, with the descriptor inherited from the host
+        bool attach(int inherited)
+        {
+            struct stat st;
+            if (fstat(inherited, &st) != 0 || !map(inherited, st.st_size))
+            {
+                return false;
+            }
+            return shared()->magic == magic;
+        }
+
+        // Producer: a slot to fill, or nullptr if the queue is full
+        Message *write_slot(Queue &q)
+        {
+            auto head = q.head.load(std::memory_order_relaxed);
+            if (head - q.tail.load(std::memory_order_acquire) >= q.slots)
+            {
+                return nullptr;
+            }
+            return slot(q, head);
+        }
+
+        void commit(Queue &q)
+        {
+            q.head.fetch_add(1, std::memory_order_release);
+            wake(&q.head);
+        }
+
+        // Consumer: the oldest message, or nullptr if the queue is empty
+        Message *read_slot(Queue &q)
+        {
+            auto tail = q.tail.load(std::memory_order_relaxed);
+            if (tail == q.head.load(std::memory_order_acquire))
+            {
+                return nullptr;
+            }
+            return slot(q, tail);
+        }
+
+        void release(Queue &q)
+        {
+            q.tail.fetch_add(1, std::memory_order_release);
+            wake(&q.tail);
+        }
+
+        // Block until write_slot or read_slot could succeed, or timeout_ms passed
+        void wait_writable(Queue &q, int timeout_ms)
+        {
+            auto tail = q.tail.load(std::memory_order_acquire);
+            if (q.head.load(std::memory_order_relaxed) - tail >= q.slots)
+            {
+                wait(&q.tail, tail, timeout_ms);
+            }
+        }
+
+        void wait_readable(Queue &q, int timeout_ms)
+        {
+            auto head = q.head.load(std::memory_order_acquire);
+            if (head == q.tail.load(std::memory_order_relaxed))
+            {
+                wait(&q.head, head, timeout_ms);
+            }
+        }
+
+        uint64_t payload_capacity() { return shared()->slot_bytes - sizeof(Message); }
+    };
+
+    // Fill a message carrying text, truncated to fit the slot
+    static void set_text(Channel &channel, Message *msg, const std::string &text)
+    {
+        msg->bytes = std::min<uint64_t>(text.size(), channel.payload_capacity() - 1);
+        std::memcpy(msg->payload(), text.data(), msg->bytes);
+        msg->payload()[msg->bytes] = 0;
+    }
+} // namespace
+
+#endif
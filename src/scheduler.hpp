@@ -0,0 +1,122 @@
+// Copyright 2024 Mux, Inc.
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+
+// Decides, per frame, whether there is time left to run the script.
+//
+// The first frame anchors pts to the wall clock, after which every frame is due at
+// anchor + pts + latency. A frame is admitted when the script's recent cost (an
+// exponentially weighted average) still fits before its deadline, otherwise the caller
+// stands in for it with a cheap frame. Frames arriving far behind, after an upstream
+// stall or a pts discontinuity, move the anchor instead of being skipped forever.
+class Scheduler
+{
+public:
+    using clock = std::chrono::steady_clock;
+    using ms = std::chrono::duration<double, std::milli>;
+
+    struct Stats
+    {
+        uint64_t skipped = 0;
+        uint64_t late = 0;
+        double max_lateness_ms = 0;
+        double avg_cost_ms = 0;
+        double frame_interval_ms = 0;
+    };
+
+private:
+    static constexpr double weight = 0.1;      // of the newest sample in the averages
+    static constexpr double resync_frames = 30; // behind by this many frame intervals moves the anchor
+
+    ms latency{0};
+    bool anchored = false;
+    clock::time_point anchor;
+    double last_pts = NAN;
+    Stats s;
+
+    clock::time_point deadline(double pts) const
+    {
+        return anchor + std::chrono::duration_cast<clock::duration>(ms(pts * 1000) + latency);
+    }
+
+    static void average(double &avg, double sample)
+    {
+        avg = avg == 0 ? sample : avg + weight * (sample - avg);
+    }
+
+public:
+    // Allowed delay between a frame's pts and its output, 0 turns scheduling off
+    void set_latency(ms l)
+    {
+        latency = l;
+        anchored = false;
+    }
+
+    bool enabled() const { return latency.count() > 0; }
+    const Stats &stats() const { return s; }
+
+    // Before running the script for a frame, false if it should be skipped
+    bool admit(double pts, clock::time_point now = clock::now())
+    {
+        if (!enabled())
+        {
+            return true;
+        }
+
+        if (!std::isnan(last_pts) && pts > last_pts)
+        {
+            average(s.frame_interval_ms, (pts - last_pts) * 1000);
+        }
+        last_pts = pts;
+
+        auto resync = ms(std::max(s.frame_interval_ms * resync_frames, latency.count()));
+        if (!anchored || now - deadline(pts) > resync || deadline(pts) - now > resync + latency)
+        {
+            anchor = now - std::chrono::duration_cast<clock::duration>(ms(pts * 1000));
+            anchored = true;
+        }
+
+        if (now + std::chrono::duration_cast<clock::duration>(ms(s.avg_cost_ms)) <= deadline(pts))
+        {
+            return true;
+        }
+        // Let the estimate decay while skipping, so one slow frame doesn't lock the script out
+        s.skipped++;
+        s.avg_cost_ms *= 1 - weight;
+        return false;
+    }
+
+    // After the script handled an admitted frame
+    void finished(double pts, clock::time_point started, clock::time_point now = clock::now())
+    {
+        if (!enabled())
+        {
+            return;
+        }
+
+        average(s.avg_cost_ms, ms(now - started).count());
+        auto lateness = ms(now - deadline(pts)).count();
+        if (lateness > 0)
+        {
+            s.late++;
+            s.max_lateness_ms = std::max(s.max_lateness_ms, lateness);
+        }
+    }
+};
@@ -0,0 +1,708 @@
+// Copyright 2024 Mux, Inc.
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include "threadpool.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// A small, pure per pixel expression language for `frame.shade(expr, uniforms, sources)`
+//
+//   l = 0.3 * r + 0.59 * g + 0.11 * b; r = l * gain; g = l; b = l
+//
+// Statements are `name = expr` separated by `;` or newlines. Assigning r, g, b or a sets the
+// output pixel, any other name is a local. Inputs are r g b a (0..1, straight alpha), x y,
+// width height pts, any uniform by name, and sample_r/g/b/a(source, x, y) to read a pixel
+// from one of the source frames. Operators follow C: ?: || && == != < <= > >= + - * / % and
+// unary - !, comparisons give 1 or 0.
+//
+// Programs are compiled once into register bytecode and cached by source hash. Every
+// instruction runs over Shader::LANES pixels at a time, so each op is a fixed length loop
+// the compiler turns into SIMD, and frames are split across the thread pool by rows.
+class Shader
+{
+public:
+    static constexpr int LANES = 16;
+
+    struct Source
+    {
+        const uint8_t *data;
+        int width, height, stride;
+    };
+
+private:
+    enum Op : uint8_t
+    {
+        ADD,
+        SUB,
+        MUL,
+        DIV,
+        MOD,
+        NEG,
+        NOT,
+        LT,
+        LE,
+        GT,
+        GE,
+        EQ,
+        NE,
+        AND,
+        OR,
+        SEL,
+        MIN,
+        MAX,
+        ABS,
+        FLOOR,
+        CEIL,
+        FRACT,
+        SQRT,
+        POW,
+        SIN,
+        COS,
+        EXP,
+        LOG,
+        STEP,
+        CLAMP,
+        MIX,
+        SMOOTHSTEP,
+        SAMPLE_R,
+        SAMPLE_G,
+        SAMPLE_B,
+        SAMPLE_A,
+    };
+
+    struct Instr
+    {
+        Op op;
+        uint16_t dst, a, b, c;
+    };
+
+    struct Builtin
+    {
+        Op op;
+        int argc;
+    };
+
+    // Fixed input registers, refilled for every block of pixels
+    enum Reg : uint16_t
+    {
+        IN_R,
+        IN_G,
+        IN_B,
+        IN_A,
+        IN_X,
+        IN_Y,
+        IN_WIDTH,
+        IN_HEIGHT,
+        IN_PTS,
+        REG_FIRST_FREE,
+    };
+
+    std::string m_source;
+    std::vector<Instr> m_code;
+    std::vector<std::pair<uint16_t, float>> m_consts;
+    std::vector<std::string> m_uniforms;
+    std::vector<uint16_t> m_uniform_regs;
+    uint16_t m_out[4] = {IN_R, IN_G, IN_B, IN_A};
+    uint16_t m_regs = REG_FIRST_FREE;
+    bool m_samples = false;
+
+    ///////////////////////////////////////////////////////////////////////////
+    // Parser, recursive descent straight to bytecode
+    struct Parser
+    {
+        Shader &s;
+        const std::string &src;
+        size_t pos = 0;
+        std::unordered_map<std::string, uint16_t> vars;
+
+        Parser(Shader &s, const std::string &src) : s(s), src(src)
+        {
+            vars = {{"r", IN_R}, {"g", IN_G}, {"b", IN_B}, {"a", IN_A}, {"x", IN_X}, {"y", IN_Y}, {"width", IN_WIDTH}, {"height", IN_HEIGHT}, {"pts", IN_PTS}};
+        }
+
+        [[noreturn]] void fail(const std::string &what)
+        {
+            throw std::runtime_error("shade: " + what + " at offset " + std::to_string(pos));
+        }
+
+        // Skips spaces, returns true if a newline was crossed
+        bool skip()
+        {
+            bool newline = false;
+            while (pos < src.size() && std::isspace(static_cast<unsigned char>(src[pos])))
+            {
+                newline |= src[pos++] == '\n';
+            }
+            return newline;
+        }
+
+        bool accept(const char *tok)
+        {
+            skip();
+            auto len = std::strlen(tok);
+            if (src.compare(pos, len, tok) != 0)
+            {
+                return false;
+            }
+            // don't split `<=` into `<` `=` or `==` into `=` `=`
+            if (len == 1 && pos + 1 < src.size() && src[pos + 1] == '=' && std::strchr("<>=!", tok[0]))
+            {
+                return false;
+            }
+            pos += len;
+            return true;
+        }
+
+        void expect(const char *tok)
+        {
+            if (!accept(tok))
+            {
+                fail(std::string("expected '") + tok + "'");
+            }
+        }
+
+        std::string ident()
+        {
+            skip();
+            auto start = pos;
+            while (pos < src.size() && (std::isalnum(static_cast<unsigned char>(src[pos])) || src[pos] == '_'))
+            {
+                pos++;
+            }
+            return src.substr(start, pos - start);
+        }
+
+        uint16_t reg()
+        {
+            if (s.m_regs == UINT16_MAX)
+            {
+                fail("expression too large");
+            }
+            return s.m_regs++;
+        }
+
+        uint16_t emit(Op op, uint16_t a, uint16_t b = 0, uint16_t c = 0)
+        {
+            auto dst = reg();
+            s.m_code.push_back({op, dst, a, b, c});
+            return dst;
+        }
+
+        uint16_t constant(float v)
+        {
+            for (auto &c : s.m_consts)
+            {
+                if (c.second == v)
+                {
+                    return c.first;
+                }
+            }
+            auto r = reg();
+            s.m_consts.emplace_back(r, v);
+            return r;
+        }
+
+        uint16_t primary()
+        {
+            skip();
+            if (pos >= src.size())
+            {
+                fail("unexpected end of expression");
+            }
+
+            auto ch = src[pos];
+            if (std::isdigit(static_cast<unsigned char>(ch)) || ch == '.')
+            {
+                char *end = nullptr;
+                auto v = std::strtof(src.c_str() + pos, &end);
+                pos = end - src.c_str();
+                return constant(v);
+            }
+
+            if (accept("("))
+            {
+                auto r = expr();
+                expect(")");
+                return r;
+            }
+
+            if (!std::isalpha(static_cast<unsigned char>(ch)) && ch != '_')
+            {
+                fail(std::string("unexpected '") + ch + "'");
+            }
+
+            auto name = ident();
+            if (accept("("))
+            {
+                const static std::unordered_map<std::string, Builtin> builtins = {
+                    {"min", {MIN, 2}},
+                    {"max", {MAX, 2}},
+                    {"abs", {ABS, 1}},
+                    {"floor", {FLOOR, 1}},
+                    {"ceil", {CEIL, 1}},
+                    {"fract", {FRACT, 1}},
+                    {"sqrt", {SQRT, 1}},
+                    {"pow", {POW, 2}},
+                    {"sin", {SIN, 1}},
+                    {"cos", {COS, 1}},
+                    {"exp", {EXP, 1}},
+                    {"log", {LOG, 1}},
+                    {"step", {STEP, 2}},
+                    {"clamp", {CLAMP, 3}},
+                    {"mix", {MIX, 3}},
+                    {"smoothstep", {SMOOTHSTEP, 3}},
+                    {"sample_r", {SAMPLE_R, 3}},
+                    {"sample_g", {SAMPLE_G, 3}},
+                    {"sample_b", {SAMPLE_B, 3}},
+                    {"sample_a", {SAMPLE_A, 3}},
+                };
+
+                auto it = builtins.find(name);
+                if (it == builtins.end())
+                {
+                    fail("unknown function '" + name + "'");
+                }
+
+                uint16_t args[3] = {0, 0, 0};
+                for (int i = 0; i < it->second.argc; i++)
+                {
+                    if (i > 0)
+                    {
+                        expect(",");
+                    }
+                    args[i] = expr();
+                }
+                expect(")");
+                s.m_samples |= it->second.op >= SAMPLE_R;
+                return emit(it->second.op, args[0], args[1], args[2]);
+            }
+
+            auto it = vars.find(name);
+            if (it != vars.end())
+            {
+                return it->second;
+            }
+
+            // Anything else is a uniform, resolved by name when the shader runs
+            auto r = reg();
+            s.m_uniforms.push_back(name);
+            s.m_uniform_regs.push_back(r);
+            vars[name] = r;
+            return r;
+        }
+
+        uint16_t unary()
+        {
+            if (accept("-"))
+            {
+                return emit(NEG, unary());
+            }
+            if (accept("!"))
+            {
+                return emit(NOT, unary());
+            }
+            if (accept("+"))
+            {
+                return unary();
+            }
+            return primary();
+        }
+
+        uint16_t mul()
+        {
+            auto l = unary();
+            for (;;)
+            {
+                if (accept("*"))
+                    l = emit(MUL, l, unary());
+                else if (accept("/"))
+                    l = emit(DIV, l, unary());
+                else if (accept("%"))
+                    l = emit(MOD, l, unary());
+                else
+                    return l;
+            }
+        }
+
+        uint16_t add()
+        {
+            auto l = mul();
+            for (;;)
+            {
+                if (accept("+"))
+                    l = emit(ADD, l, mul());
+                else if (accept("-"))
+                    l = emit(SUB, l, mul());
+                else
+                    return l;
+            }
+        }
+
+        uint16_t compare()
+        {
+            auto l = add();
+            for (;;)
+            {
+                if (accept("<="))
+                    l = emit(LE, l, add());
+                else if (accept(">="))
+                    l = emit(GE, l, add());
+                else if (accept("<"))
+                    l = emit(LT, l, add());
+                else if (accept(">"))
+                    l = emit(GT, l, add());
+                else
+                    return l;
+            }
+        }
+
+        uint16_t equality()
+        {
+            auto l = compare();
+            for (;;)
+            {
+                if (accept("=="))
+                    l = emit(EQ, l, compare());
+                else if (accept("!="))
+                    l = emit(NE, l, compare());
+                else
+                    return l;
+            }
+        }
+
+        uint16_t logic_and()
+        {
+            auto l = equality();
+            while (accept("&&"))
+            {
+                l = emit(AND, l, equality());
+            }
+            return l;
+        }
+
+        uint16_t logic_or()
+        {
+            auto l = logic_and();
+            while (accept("||"))
+            {
+                l = emit(OR, l, logic_and());
+            }
+            return l;
+        }
+
+        uint16_t expr()
+        {
+            auto cond = logic_or();
+            if (!accept("?"))
+            {
+                return cond;
+            }
+            auto t = expr();
+            expect(":");
+            auto f = expr();
+            return emit(SEL, cond, t, f);
+        }
+
+        void statement()
+        {
+            auto save = pos;
+            auto name = ident();
+            if (name.empty() || !accept("="))
+            {
+                pos = save;
+                fail("expected assignment");
+            }
+
+            // Statements are SSA, assigning just rebinds the name to the new register
+            vars[name] = expr();
+        }
+
+        void program()
+        {
+            for (;;)
+            {
+                while (accept(";"))
+                    ;
+                if (skip(), pos >= src.size())
+                {
+                    break;
+                }
+                statement();
+                auto newline = skip();
+                if (pos < src.size() && !accept(";") && !newline)
+                {
+                    fail("expected ';'");
+                }
+            }
+            s.m_out[0] = vars["r"];
+            s.m_out[1] = vars["g"];
+            s.m_out[2] = vars["b"];
+            s.m_out[3] = vars["a"];
+        }
+    };
+
+    ///////////////////////////////////////////////////////////////////////////
+    // Interpreter
+
+    // Clamp to 0..1, NaN becomes 0
+    static inline float saturate(float v) { return v > 0.0f ? (v < 1.0f ? v : 1.0f) : 0.0f; }
+
+    // floor(v) clamped to 0..size-1, in float so NaN and infinities never reach the int conversion
+    static inline int index(float v, int size)
+    {
+        v = std::floor(v);
+        return v > 0.0f ? (v < static_cast<float>(size - 1) ? static_cast<int>(v) : size - 1) : 0;
+    }
+
+    static inline float sample(const std::vector<Source> &sources, float src, float x, float y, int channel)
+    {
+        if (sources.empty())
+        {
+            return 0.0f;
+        }
+        auto &f = sources[index(src, static_cast<int>(sources.size()))];
+        if (f.width <= 0 || f.height <= 0 || !f.data)
+        {
+            return 0.0f;
+        }
+        auto ix = index(x, f.width);
+        auto iy = index(y, f.height);
+        auto p = reinterpret_cast<const uint32_t *>(f.data + iy * f.stride)[ix];
+        float a = (p >> 24) / 255.0f;
+        if (channel == 3)
+        {
+            return a;
+        }
+        float v = (p >> (16 - channel * 8) & 0xff) / 255.0f;
+        return a > 0.0f ? std::min(1.0f, v / a) : 0.0f;
+    }
+
+    void exec(float *regs, const std::vector<Source> &sources) const
+    {
+#define LANE_LOOP(expr)                \
+    for (int i = 0; i < LANES; i++)    \
+    {                                  \
+        d[i] = (expr);                 \
+    }                                  \
+    break
+
+        for (auto &in : m_code)
+        {
+            auto d = regs + in.dst * LANES;
+            auto a = regs + in.a * LANES;
+            auto b = regs + in.b * LANES;
+            auto c = regs + in.c * LANES;
+            switch (in.op)
+            {
+            case ADD:
+                LANE_LOOP(a[i] + b[i]);
+            case SUB:
+                LANE_LOOP(a[i] - b[i]);
+            case MUL:
+                LANE_LOOP(a[i] * b[i]);
+            case DIV:
+                LANE_LOOP(b[i] != 0.0f ? a[i] / b[i] : 0.0f);
+            case MOD:
+                LANE_LOOP(b[i] != 0.0f ? std::fmod(a[i], b[i]) : 0.0f);
+            case NEG:
+                LANE_LOOP(-a[i]);
+            case NOT:
+                LANE_LOOP(a[i] == 0.0f ? 1.0f : 0.0f);
+            case LT:
+                LANE_LOOP(a[i] < b[i] ? 1.0f : 0.0f);
+            case LE:
+                LANE_LOOP(a[i] <= b[i] ? 1.0f : 0.0f);
+            case GT:
+                LANE_LOOP(a[i] > b[i] ? 1.0f : 0.0f);
+            case GE:
+                LANE_LOOP(a[i] >= b[i] ? 1.0f : 0.0f);
+            case EQ:
+                LANE_LOOP(a[i] == b[i] ? 1.0f : 0.0f);
+            case NE:
+                LANE_LOOP(a[i] != b[i] ? 1.0f : 0.0f);
+            case AND:
+                LANE_LOOP(a[i] != 0.0f && b[i] != 0.0f ? 1.0f : 0.0f);
+            case OR:
+                LANE_LOOP(a[i] != 0.0f || b[i] != 0.0f ? 1.0f : 0.0f);
+            case SEL:
+                LANE_LOOP(a[i] != 0.0f ? b[i] : c[i]);
+            case MIN:
+                LANE_LOOP(std::min(a[i], b[i]));
+            case MAX:
+                LANE_LOOP(std::max(a[i], b[i]));
+            case ABS:
+                LANE_LOOP(std::fabs(a[i]));
+            case FLOOR:
+                LANE_LOOP(std::floor(a[i]));
+            case CEIL:
+                LANE_LOOP(std::ceil(a[i]));
+            case FRACT:
+                LANE_LOOP(a[i] - std::floor(a[i]));
+            case SQRT:
+                LANE_LOOP(std::sqrt(std::max(0.0f, a[i])));
+            case POW:
+                LANE_LOOP(std::pow(a[i], b[i]));
+            case SIN:
+                LANE_LOOP(std::sin(a[i]));
+            case COS:
+                LANE_LOOP(std::cos(a[i]));
+            case EXP:
+                LANE_LOOP(std::exp(a[i]));
+            case LOG:
+                LANE_LOOP(std::log(a[i]));
+            case STEP:
+                LANE_LOOP(b[i] < a[i] ? 0.0f : 1.0f);
+            case CLAMP:
+                LANE_LOOP(std::min(std::max(a[i], b[i]), c[i]));
+            case MIX:
+                LANE_LOOP(a[i] + (b[i] - a[i]) * c[i]);
+            case SMOOTHSTEP:
+                LANE_LOOP([&]
+                          { auto t = std::min(std::max((c[i] - a[i]) / (b[i] - a[i]), 0.0f), 1.0f);
+                            return t * t * (3.0f - 2.0f * t); }());
+            case SAMPLE_R:
+                LANE_LOOP(sample(sources, a[i], b[i], c[i], 0));
+            case SAMPLE_G:
+                LANE_LOOP(sample(sources, a[i], b[i], c[i], 1));
+            case SAMPLE_B:
+                LANE_LOOP(sample(sources, a[i], b[i], c[i], 2));
+            case SAMPLE_A:
+                LANE_LOOP(sample(sources, a[i], b[i], c[i], 3));
+            }
+        }
+#undef LANE_LOOP
+    }
+
+    void run_rows(uint8_t *data, int width, int stride, int begin, int end, const std::vector<float> &consts, const std::vector<Source> &sources) const
+    {
+        std::vector<float> regs(m_regs * LANES);
+        for (size_t i = 0; i < consts.size(); i++)
+        {
+            std::fill_n(&regs[i * LANES], LANES, consts[i]);
+        }
+
+        float *in_r = &regs[IN_R * LANES], *in_g = &regs[IN_G * LANES], *in_b = &regs[IN_B * LANES], *in_a = &regs[IN_A * LANES];
+        float *in_x = &regs[IN_X * LANES], *in_y = &regs[IN_Y * LANES];
+        const float *out_r = &regs[m_out[0] * LANES], *out_g = &regs[m_out[1] * LANES], *out_b = &regs[m_out[2] * LANES], *out_a = &regs[m_out[3] * LANES];
+
+        for (int y = begin; y < end; y++)
+        {
+            auto row = reinterpret_cast<uint32_t *>(data + y * stride);
+            std::fill_n(in_y, LANES, static_cast<float>(y));
+            for (int x0 = 0; x0 < width; x0 += LANES)
+            {
+                auto count = std::min(LANES, width - x0);
+                for (int i = 0; i < LANES; i++)
+                {
+                    auto p = i < count ? row[x0 + i] : 0;
+                    auto a = (p >> 24) / 255.0f;
+                    auto inv = a > 0.0f ? 1.0f / (a * 255.0f) : 0.0f;
+                    in_r[i] = (p >> 16 & 0xff) * inv;
+                    in_g[i] = (p >> 8 & 0xff) * inv;
+                    in_b[i] = (p & 0xff) * inv;
+                    in_a[i] = a;
+                    in_x[i] = static_cast<float>(x0 + i);
+                }
+
+                exec(regs.data(), sources);
+
+                uint32_t out[LANES];
+                for (int i = 0; i < LANES; i++)
+                {
+                    auto a = saturate(out_a[i]);
+                    auto r = saturate(out_r[i]) * a;
+                    auto g = saturate(out_g[i]) * a;
+                    auto b = saturate(out_b[i]) * a;
+                    out[i] = static_cast<uint32_t>(a * 255.0f + 0.5f) << 24 | static_cast<uint32_t>(r * 255.0f + 0.5f) << 16 | static_cast<uint32_t>(g * 255.0f + 0.5f) << 8 | static_cast<uint32_t>(b * 255.0f + 0.5f);
+                }
+                std::memcpy(row + x0, out, count * sizeof(uint32_t));
+            }
+        }
+    }
+
+public:
+    Shader(const std::string &source) : m_source(source)
+    {
+        Parser(*this, m_source).program();
+    }
+
+    // Compiled programs are shared by every instance in the process, the least recently used
+    // are forgotten past cache_size so scripts generating source per frame don't grow it
+    static constexpr size_t cache_size = 64;
+    static std::shared_ptr<const Shader> compile(const std::string &source)
+    {
+        using Lru = std::list<std::shared_ptr<const Shader>>;
+        static std::mutex mutex;
+        static Lru lru; // most recently used first
+        static std::unordered_map<std::string, Lru::iterator> cache;
+
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = cache.find(source);
+        if (it != cache.end())
+        {
+            lru.splice(lru.begin(), lru, it->second);
+            return *it->second;
+        }
+
+        auto shader = std::make_shared<const Shader>(source);
+        lru.push_front(shader);
+        cache.emplace(source, lru.begin());
+        if (lru.size() > cache_size)
+        {
+            cache.erase(lru.back()->m_source);
+            lru.pop_back();
+        }
+        return shader;
+    }
+
+    // Uniform names in the order run() expects their values
+    const std::vector<std::string> &uniforms() const { return m_uniforms; }
+
+    // Reads of the frame being shaded through `sources` see partially written rows
+    bool samples() const { return m_samples; }
+
+    // Shades an ARGB32 (premultiplied, cairo layout) image in place
+    void run(uint8_t *data, int width, int height, int stride, double pts, const std::vector<float> &uniforms, const std::vector<Source> &sources) const
+    {
+        // Register file prefix shared by every block: inputs, constants and uniforms
+        std::vector<float> consts(m_regs, 0.0f);
+        consts[IN_WIDTH] = width;
+        consts[IN_HEIGHT] = height;
+        consts[IN_PTS] = pts;
+        for (auto &c : m_consts)
+        {
+            consts[c.first] = c.second;
+        }
+        for (size_t i = 0; i < m_uniforms.size() && i < uniforms.size(); i++)
+        {
+            consts[m_uniform_regs[i]] = uniforms[i];
+        }
+
+        parallel_rows(height, [&](int begin, int end)
+                      { run_rows(data, width, stride, begin, end, consts, sources); });
+    }
+};
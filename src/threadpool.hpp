@@ -0,0 +1,213 @@
+// Copyright 2024 Mux, Inc.
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Process wide pool used to split native per frame work into row slices.
+// The calling thread takes part in the work, so a pool of N threads runs N + 1 jobs at once.
+class ThreadPool
+{
+public:
+    using Job = std::function<void(int jobnr, int nb_jobs)>;
+
+private:
+    std::vector<std::thread> threads;
+    std::mutex submit_mutex; // one batch at a time
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+
+    const Job *job = nullptr;
+    int nb_jobs = 0;
+    uint64_t generation = 0;
+    std::atomic<int> next_job{0};
+    int remaining = 0;
+    int active = 0; // workers holding `job`
+    bool quit = false;
+
+    void run_jobs(const Job &j, int count)
+    {
+        int finished = 0;
+        for (int i = next_job++; i < count; i = next_job++)
+        {
+            j(i, count);
+            finished++;
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        remaining -= finished;
+        if (remaining == 0)
+        {
+            done.notify_all();
+        }
+    }
+
+    void worker()
+    {
+        uint64_t seen = 0;
+        for (;;)
+        {
+            const Job *j;
+            int count;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [&]
+                          { return quit || generation != seen; });
+                if (quit)
+                {
+                    return;
+                }
+                seen = generation;
+                if (!job)
+                {
+                    continue;
+                }
+                j = job;
+                count = nb_jobs;
+                active++;
+            }
+            run_jobs(*j, count);
+
+            std::lock_guard<std::mutex> lock(mutex);
+            if (--active == 0)
+            {
+                done.notify_all();
+            }
+        }
+    }
+
+public:
+    ThreadPool(int thread_count)
+    {
+        for (int i = 0; i < thread_count; i++)
+        {
+            threads.emplace_back([this]
+                                 { worker(); });
+        }
+    }
+
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            quit = true;
+        }
+        wake.notify_all();
+        for (auto &t : threads)
+        {
+            t.join();
+        }
+    }
+
+    static ThreadPool &shared()
+    {
+        static ThreadPool pool(std::max(0, static_cast<int>(std::thread::hardware_concurrency()) - 1));
+        return pool;
+    }
+
+    // Number of jobs that can make progress at the same time
+    int size() const { return static_cast<int>(threads.size()) + 1; }
+
+    // Runs job(0..nb_jobs-1) and blocks until every job has returned
+    void execute(const Job &j, int count)
+    {
+        if (count <= 1 || threads.empty())
+        {
+            for (int i = 0; i < count; i++)
+            {
+                j(i, count);
+            }
+            return;
+        }
+
+        std::lock_guard<std::mutex> submit(submit_mutex);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            job = &j;
+            nb_jobs = count;
+            remaining = count;
+            next_job = 0;
+            generation++;
+        }
+        wake.notify_all();
+        run_jobs(j, count);
+
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [&]
+                  { return remaining == 0 && active == 0; });
+        job = nullptr;
+    }
+};
+
+// The host's own slice threads, see mipp_set_execute
+struct HostPool
+{
+    std::function<void(const ThreadPool::Job &job, int nb_jobs)> execute;
+    int size = 1; // jobs it runs at once
+};
+
+// Pool parallel_rows uses on this thread instead of the shared one, nullptr for the shared one
+static inline const HostPool *&current_host_pool()
+{
+    thread_local const HostPool *pool = nullptr;
+    return pool;
+}
+
+// Sends parallel_rows on this thread to `pool` while a call into a mipp that has one runs
+class HostPoolScope
+{
+private:
+    const HostPool *saved;
+
+public:
+    explicit HostPoolScope(const HostPool &pool) : saved(current_host_pool())
+    {
+        if (pool.execute)
+        {
+            current_host_pool() = &pool;
+        }
+    }
+
+    ~HostPoolScope()
+    {
+        current_host_pool() = saved;
+    }
+};
+
+// Split `rows` into contiguous slices, one job each
+static inline void parallel_rows(int rows, const std::function<void(int begin, int end)> &fn)
+{
+    ThreadPool::Job job = [&](int jobnr, int nb_jobs)
+    { fn(rows * jobnr / nb_jobs, rows * (jobnr + 1) / nb_jobs); };
+    if (auto host = current_host_pool())
+    {
+        auto jobs = std::max(1, std::min(rows / 16, host->size * 2));
+        if (jobs > 1)
+        {
+            host->execute(job, jobs);
+            return;
+        }
+    }
+    auto &pool = ThreadPool::shared();
+    pool.execute(job, std::max(1, std::min(rows / 16, pool.size() * 2)));
+}
@@ -0,0 +1,251 @@
+// Copyright 2024 Mux, Inc.
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Timed elements registered by a script with timeline_add.
+//
+// Each element is live for pts in [start, end], fades in and out over its first and last
+// seconds and carries keyframed numeric properties. Lookups go through an interval tree
+// (the elements sorted by start, with the tree implicit in the array and every node
+// holding the largest end below it) so finding the active set costs O(log n + k) per frame.
+namespace timeline
+{
+    enum Curve
+    {
+        LINEAR = 0,
+        EASE_IN,
+        EASE_OUT,
+        EASE_IN_OUT,
+    };
+
+    static bool curve_from_string(const std::string &name, Curve &curve)
+    {
+        if (name == "linear")
+            curve = LINEAR;
+        else if (name == "ease-in")
+            curve = EASE_IN;
+        else if (name == "ease-out")
+            curve = EASE_OUT;
+        else if (name == "ease-in-out")
+            curve = EASE_IN_OUT;
+        else
+            return false;
+        return true;
+    }
+
+    // t in [0, 1]
+    static double ease(Curve curve, double t)
+    {
+        t = std::min(1.0, std::max(0.0, t));
+        switch (curve)
+        {
+        case EASE_IN:
+            return t * t;
+        case EASE_OUT:
+            return 1 - (1 - t) * (1 - t);
+        case EASE_IN_OUT:
+            return t * t * (3 - 2 * t);
+        default:
+            return t;
+        }
+    }
+
+    // A keyframed property, keys are (seconds since the element's start, value) sorted by time
+    struct Track
+    {
+        std::string name;
+        std::vector<std::pair<double, double>> keys;
+
+        double at(double t, Curve curve) const
+        {
+            if (keys.empty())
+            {
+                return 0;
+            }
+            auto next = std::upper_bound(keys.begin(), keys.end(), t, [](double t, const std::pair<double, double> &k)
+                                         { return t < k.first; });
+            if (next == keys.begin())
+            {
+                return next->second;
+            }
+            if (next == keys.end())
+            {
+                return keys.back().second;
+            }
+            auto prev = next - 1;
+            auto span = next->first - prev->first;
+            auto f = span > 0 ? ease(curve, (t - prev->first) / span) : 1.0;
+            return prev->second + (next->second - prev->second) * f;
+        }
+    };
+
+    struct Element
+    {
+        uint32_t id = 0;
+        double start = 0;
+        double end = 0;
+        double fade_in = 0;
+        double fade_out = 0;
+        Curve curve = LINEAR; // of the fades and of the steps between keyframes
+        std::vector<Track> tracks;
+
+        // Text drawn natively, for elements without a draw callback
+        std::string text;
+        std::string font = "48px Sans";
+        std::string fill = "white";
+        bool callback = false; // the script draws it, see Mipp::cues
+
+        double alpha(double pts) const
+        {
+            auto a = 1.0;
+            if (fade_in > 0)
+            {
+                a = std::min(a, ease(curve, (pts - start) / fade_in));
+            }
+            if (fade_out > 0)
+            {
+                a = std::min(a, ease(curve, (end - pts) / fade_out));
+            }
+            return a;
+        }
+
+        double progress(double pts) const
+        {
+            return end > start ? std::min(1.0, std::max(0.0, (pts - start) / (end - start))) : 1.0;
+        }
+
+        const Track *track(const std::string &name) const
+        {
+            for (auto &t : tracks)
+            {
+                if (t.name == name)
+                {
+                    return &t;
+                }
+            }
+            return nullptr;
+        }
+
+        double value(const std::string &name, double pts, double fallback) const
+        {
+            auto t = track(name);
+            return t ? t->at(pts - start, curve) : fallback;
+        }
+    };
+
+    class Timeline
+    {
+    private:
+        std::vector<Element> elements; // sorted by start
+        std::vector<double> max_end;   // largest end in the subtree rooted at each index
+        bool dirty = false;
+        uint32_t next_id = 1;
+
+        double build(size_t lo, size_t hi)
+        {
+            auto mid = lo + (hi - lo) / 2;
+            auto m = elements[mid].end;
+            if (lo < mid)
+                m = std::max(m, build(lo, mid));
+            if (mid + 1 < hi)
+                m = std::max(m, build(mid + 1, hi));
+            return max_end[mid] = m;
+        }
+
+        void query(size_t lo, size_t hi, double pts, std::vector<const Element *> &out) const
+        {
+            if (lo >= hi)
+            {
+                return;
+            }
+            auto mid = lo + (hi - lo) / 2;
+            if (max_end[mid] < pts)
+            {
+                return;
+            }
+            query(lo, mid, pts, out);
+            if (elements[mid].start > pts)
+            {
+                // Everything to the right starts later still
+                return;
+            }
+            if (elements[mid].end >= pts)
+            {
+                out.push_back(&elements[mid]);
+            }
+            query(mid + 1, hi, pts, out);
+        }
+
+        void rebuild()
+        {
+            std::stable_sort(elements.begin(), elements.end(), [](const Element &a, const Element &b)
+                             { return a.start < b.start; });
+            max_end.resize(elements.size());
+            if (!elements.empty())
+            {
+                build(0, elements.size());
+            }
+            dirty = false;
+        }
+
+    public:
+        uint32_t add(Element e)
+        {
+            e.id = next_id++;
+            elements.push_back(std::move(e));
+            dirty = true;
+            return elements.back().id;
+        }
+
+        bool remove(uint32_t id)
+        {
+            auto it = std::find_if(elements.begin(), elements.end(), [id](const Element &e)
+                                   { return e.id == id; });
+            if (it == elements.end())
+            {
+                return false;
+            }
+            elements.erase(it);
+            dirty = true;
+            return true;
+        }
+
+        void clear()
+        {
+            elements.clear();
+            max_end.clear();
+            dirty = false;
+        }
+
+        bool empty() const { return elements.empty(); }
+
+        // The elements live at pts, in start order. Pointers are valid until the next add or remove.
+        void active(double pts, std::vector<const Element *> &out)
+        {
+            if (dirty)
+            {
+                rebuild();
+            }
+            out.clear();
+            query(0, elements.size(), pts, out);
+        }
+    };
+} // namespace
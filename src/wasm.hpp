@@ -0,0 +1,139 @@
+// Copyright 2024 Mux, Inc.
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include "cache.hpp"
+#include "ezv8.hpp"
+
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+// WebAssembly module loading for `loadWasm(path)`
+//
+// Compiled modules are kept in two places. Within a process every isolate shares the same
+// native code through CompiledWasmModule. On disk, V8's serialized module is stored in the
+// mipp cache keyed by a hash of the wire bytes, and handed back through the streaming
+// compiler, the only public API that accepts previously compiled code.
+namespace wasm
+{
+    static std::mutex &compiled_mutex()
+    {
+        static std::mutex m;
+        return m;
+    }
+
+    static std::unordered_map<uint64_t, v8::CompiledWasmModule> &compiled()
+    {
+        static std::unordered_map<uint64_t, v8::CompiledWasmModule> modules;
+        return modules;
+    }
+
+    static void serialize(v8::CompiledWasmModule module, const std::string &path)
+    {
+        auto bytes = module.Serialize();
+        if (bytes.size)
+        {
+            cache::write(path, bytes.buffer.get(), bytes.size);
+        }
+    }
+
+    // Installed with Isolate::SetWasmStreamingCallback, args[0] is the path given to compileStreaming
+    static void streaming_callback(const v8::FunctionCallbackInfo<v8::Value> &args)
+    {
+        auto iso = args.GetIsolate();
+        auto streaming = v8::WasmStreaming::Unpack(iso, args.Data());
+        std::string path = *v8::String::Utf8Value(iso, args[0]);
+
+        std::vector<uint8_t> wire;
+        if (!cache::read(path, wire))
+        {
+            streaming->Abort(v8::Exception::Error(v8::String::NewFromUtf8(iso, ("loadWasm: can not read " + path).c_str()).ToLocalChecked()));
+            return;
+        }
+
+        // Must outlive Finish()
+        std::vector<uint8_t> serialized;
+        auto serialized_path = cache::path(cache::hash(wire.data(), wire.size()), ".wasm.cache");
+        if (!cache::read(serialized_path, serialized) || !streaming->SetCompiledModuleBytes(serialized.data(), serialized.size()))
+        {
+            // Update the disk copy as tiering makes more optimized code available
+            streaming->SetMoreFunctionsCanBeSerializedCallback([serialized_path](v8::CompiledWasmModule module)
+                                                               { serialize(module, serialized_path); });
+        }
+
+        streaming->SetUrl(path.c_str(), path.size());
+        streaming->OnBytesReceived(wire.data(), wire.size());
+        streaming->Finish();
+    }
+
+    // Synchronously compile (or fetch from cache) the module at `path`
+    static v8::MaybeLocal<v8::WasmModuleObject> load(v8::Isolate *iso, v8::Local<v8::Context> ctx, const std::string &path)
+    {
+        std::vector<uint8_t> wire;
+        if (!cache::read(path, wire))
+        {
+            iso->ThrowException(v8::Exception::Error(v8::String::NewFromUtf8(iso, ("loadWasm: can not read " + path).c_str()).ToLocalChecked()));
+            return {};
+        }
+
+        auto key = cache::hash(wire.data(), wire.size());
+        {
+            std::lock_guard<std::mutex> lock(compiled_mutex());
+            auto it = compiled().find(key);
+            if (it != compiled().end())
+            {
+                return v8::WasmModuleObject::FromCompiledModule(iso, it->second);
+            }
+        }
+
+        auto webassembly = ctx->Global()->Get(ctx, v8::String::NewFromUtf8(iso, "WebAssembly").ToLocalChecked()).ToLocalChecked().As<v8::Object>();
+        auto compile = webassembly->Get(ctx, v8::String::NewFromUtf8(iso, "compileStreaming").ToLocalChecked()).ToLocalChecked().As<v8::Function>();
+        v8::Local<v8::Value> arg = v8::String::NewFromUtf8(iso, path.c_str()).ToLocalChecked();
+        v8::Local<v8::Value> result;
+        if (!compile->Call(ctx, webassembly, 1, &arg).ToLocal(&result) || !result->IsPromise())
+        {
+            return {};
+        }
+
+        // Scripts are synchronous, so drive compilation to completion here
+        auto promise = result.As<v8::Promise>();
+        while (promise->State() == v8::Promise::kPending)
+        {
+            if (!v8::platform::PumpMessageLoop(ezv8::V8Platform::get(), iso))
+            {
+                std::this_thread::yield();
+            }
+            iso->PerformMicrotaskCheckpoint();
+        }
+
+        if (promise->State() == v8::Promise::kRejected)
+        {
+            iso->ThrowException(promise->Result());
+            return {};
+        }
+
+        auto module = promise->Result().As<v8::WasmModuleObject>();
+        auto serialized_path = cache::path(key, ".wasm.cache");
+        if (!std::filesystem::exists(serialized_path))
+        {
+            serialize(module->GetCompiledModule(), serialized_path);
+        }
+
+        std::lock_guard<std::mutex> lock(compiled_mutex());
+        compiled().emplace(key, module->GetCompiledModule());
+        return module;
+    }
+} // namespace
@@ -0,0 +1,179 @@
+// Copyright 2024 Mux, Inc.
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include "ezv8.hpp"
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include <pthread.h>
+#ifdef __linux__
+#include <time.h>
+#elif defined(__APPLE__)
+#include <mach/mach.h>
+#endif
+
+// Bounds how long script code may run for one frame.
+//
+// The frame thread arms the watchdog before calling into JS and disarms it afterwards. If
+// the wall or CPU budget runs out in between, the watchdog thread calls TerminateExecution
+// and disarm() clears the termination again so the isolate can run the next frame.
+class Watchdog
+{
+private:
+    using clock = std::chrono::steady_clock;
+
+    v8::Isolate *isolate;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::thread thread;
+    bool quit = false;
+
+    bool armed = false;
+    bool fired = false;
+    clock::time_point deadline;
+    std::chrono::nanoseconds cpu_budget{0};
+    std::chrono::nanoseconds cpu_start{0};
+#ifdef __linux__
+    clockid_t cpu_clock;
+#elif defined(__APPLE__)
+    mach_port_t cpu_thread;
+#endif
+
+    // CPU time used by the thread that armed the watchdog
+    std::chrono::nanoseconds cpu_time() const
+    {
+#ifdef __linux__
+        timespec ts;
+        clock_gettime(cpu_clock, &ts);
+        return std::chrono::seconds(ts.tv_sec) + std::chrono::nanoseconds(ts.tv_nsec);
+#elif defined(__APPLE__)
+        thread_basic_info_data_t info;
+        mach_msg_type_number_t count = THREAD_BASIC_INFO_COUNT;
+        if (thread_info(cpu_thread, THREAD_BASIC_INFO, reinterpret_cast<thread_info_t>(&info), &count) != KERN_SUCCESS)
+        {
+            return std::chrono::nanoseconds(0);
+        }
+        return std::chrono::seconds(info.user_time.seconds + info.system_time.seconds) +
+               std::chrono::microseconds(info.user_time.microseconds + info.system_time.microseconds);
+#else
+        return std::chrono::nanoseconds(0);
+#endif
+    }
+
+    void run()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (!quit)
+        {
+            if (!armed)
+            {
+                wake.wait(lock);
+                continue;
+            }
+
+            // CPU time never runs faster than wall time, so sleep at least until it could be spent
+            auto now = clock::now();
+            auto next = deadline;
+            auto expired = now >= deadline;
+            if (cpu_budget.count())
+            {
+                auto used = cpu_time() - cpu_start;
+                expired = expired || used >= cpu_budget;
+                next = std::min(next, now + (cpu_budget - used));
+            }
+
+            if (expired)
+            {
+                armed = false;
+                fired = true;
+                isolate->TerminateExecution();
+                continue;
+            }
+            wake.wait_until(lock, next);
+        }
+    }
+
+public:
+    // Whether a CPU budget can be enforced on this platform
+#if defined(__linux__) || defined(__APPLE__)
+    static constexpr bool has_cpu_clock = true;
+#else
+    static constexpr bool has_cpu_clock = false;
+#endif
+
+    Watchdog(v8::Isolate *isolate) : isolate(isolate) {}
+
+    ~Watchdog()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            quit = true;
+        }
+        wake.notify_all();
+        if (thread.joinable())
+        {
+            thread.join();
+        }
+    }
+
+    // Frame thread. A zero budget is unlimited
+    void arm(std::chrono::microseconds wall, std::chrono::microseconds cpu)
+    {
+        if (!wall.count() && !cpu.count())
+        {
+            return;
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!thread.joinable())
+        {
+            thread = std::thread([this]
+                                 { run(); });
+        }
+
+        deadline = wall.count() ? clock::now() + wall : clock::time_point::max();
+        cpu_budget = has_cpu_clock ? cpu : std::chrono::microseconds(0);
+        if (cpu_budget.count())
+        {
+#ifdef __linux__
+            pthread_getcpuclockid(pthread_self(), &cpu_clock);
+#elif defined(__APPLE__)
+            cpu_thread = pthread_mach_thread_np(pthread_self());
+#endif
+            cpu_start = cpu_time();
+        }
+        fired = false;
+        armed = true;
+        wake.notify_all();
+    }
+
+    // Frame thread. True if the budget ran out, in which case script execution was terminated
+    bool disarm()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        armed = false;
+        if (!fired)
+        {
+            return false;
+        }
+        fired = false;
+        isolate->CancelTerminateExecution();
+        return true;
+    }
+};
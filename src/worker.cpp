@@ -0,0 +1,180 @@
+// Copyright 2024 Mux, Inc.
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// mipp_worker <script> <fd>
+//
+// Runs a script for a host that called mipp_init_worker, talking over the shared memory
+// channel in `fd`, see ring.hpp and client.hpp.
+
+#include "kernels.hpp"
+#include "mipp.h"
+#include "ring.hpp"
+
+#include <stdio.h>
+#include <string>
+
+#include <signal.h>
+#include <sys/prctl.h>
+
+static ring::Channel channel;
+static int out_format = MIPP_PIX_FMT_RGB32;
+static uint64_t current_seq = 0;
+
+static ring::Message *acquire()
+{
+    auto &q = channel.shared()->responses;
+    ring::Message *msg;
+    while (!(msg = channel.write_slot(q)))
+    {
+        channel.wait_writable(q, 1000);
+    }
+    std::memset(msg, 0, sizeof(ring::Message));
+    msg->seq = current_seq;
+    return msg;
+}
+
+static int receive_video_frame(void *, int pad, int width, int height, double pts, uint8_t *data)
+{
+    auto bytes = static_cast<uint64_t>(width) * height * kernels::bytes_per_pixel(out_format);
+    if (bytes > channel.payload_capacity())
+    {
+        fprintf(stderr, "mipp_worker: %dx%d output does not fit in a slot\n", width, height);
+        return -1;
+    }
+
+    auto msg = acquire();
+    msg->kind = ring::FRAME_OUT;
+    msg->pad = pad;
+    msg->width = width;
+    msg->height = height;
+    msg->pts = pts;
+    msg->bytes = bytes;
+    std::memcpy(msg->payload(), data, bytes);
+    channel.commit(channel.shared()->responses);
+    return 0;
+}
+
+static void forward_log(int level, const char *txt)
+{
+    auto msg = acquire();
+    msg->kind = ring::LOG;
+    msg->ret = level;
+    ring::set_text(channel, msg, txt);
+    channel.commit(channel.shared()->responses);
+}
+
+static void forward_metadata(void *, double pts, const char *key, const char *value)
+{
+    auto msg = acquire();
+    msg->kind = ring::METADATA;
+    msg->pts = pts;
+    ring::set_text(channel, msg, std::string(key) + '\0' + value);
+    channel.commit(channel.shared()->responses);
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 3)
+    {
+        fprintf(stderr, "usage: %s <script> <fd>\n", argv[0]);
+        return 1;
+    }
+
+    // Never outlive the host
+    prctl(PR_SET_PDEATHSIG, SIGKILL);
+    if (!channel.attach(std::stoi(argv[2])))
+    {
+        fprintf(stderr, "mipp_worker: can not attach to the host\n");
+        return 1;
+    }
+
+    auto shared = channel.shared();
+    mipp_t mipp = {};
+    mipp_init(&mipp, argv[1], nullptr, [](void *, int width, int height, double pts, uint8_t *data)
+              { return receive_video_frame(nullptr, 0, width, height, pts, data); },
+              forward_log);
+    mipp_set_receive_video_frame_pad(&mipp, nullptr, receive_video_frame);
+    mipp_set_metadata_callback(&mipp, nullptr, forward_metadata);
+    // forward_log writes the response queue, which only this thread may do
+    mipp_set_option(&mipp, "log_thread", "0");
+    shared->video_in_count = mipp.video_in_count;
+    shared->video_out_count = mipp.video_out_count;
+    shared->ready.store(1, std::memory_order_release);
+    ring::wake(&shared->ready);
+
+    auto &q = shared->requests;
+    for (;;)
+    {
+        auto msg = channel.read_slot(q);
+        if (!msg)
+        {
+            channel.wait_readable(q, 1000);
+            continue;
+        }
+
+        switch (msg->kind)
+        {
+        case ring::FRAME:
+        {
+            // Straight from shared memory, the slot is only released afterwards
+            mipp_frame_t frame = {msg->format, msg->width, msg->height, {}, {}, msg->pts, msg->pad};
+            for (int p = 0; p < kernels::plane_count(msg->format); p++)
+            {
+                frame.strides[p] = msg->strides[p];
+                frame.planes[p] = msg->payload() + msg->offsets[p];
+            }
+            mipp_side_data_t side_data[MIPP_SIDE_DATA_TYPES * 2];
+            auto offset = msg->side_data;
+            for (int i = 0; i < msg->side_data_count && frame.side_data_count < MIPP_SIDE_DATA_TYPES * 2; i++)
+            {
+                ring::SideData header;
+                std::memcpy(&header, msg->payload() + offset, sizeof(header));
+                side_data[frame.side_data_count++] = {header.type, msg->payload() + offset + sizeof(header), header.size};
+                offset = (offset + sizeof(header) + header.size + 63) & ~uint64_t(63);
+            }
+            frame.side_data = side_data;
+            current_seq = msg->seq;
+            auto ret = mipp_send_video_frames(&mipp, &frame, 1);
+            channel.release(q);
+
+            mipp_get_stats(&mipp, &shared->stats);
+            auto done = acquire();
+            done->kind = ring::DONE;
+            done->ret = ret;
+            channel.commit(shared->responses);
+            continue;
+        }
+        case ring::OPTION:
+        {
+            auto key = reinterpret_cast<const char *>(msg->payload());
+            if (strcmp(key, "log_thread") != 0)
+            {
+                mipp_set_option(&mipp, key, key + strlen(key) + 1);
+            }
+            break;
+        }
+        case ring::RELOAD:
+            mipp_reload(&mipp, msg->bytes ? reinterpret_cast<const char *>(msg->payload()) : nullptr);
+            break;
+        case ring::OUT_FORMAT:
+            out_format = msg->format;
+            mipp_set_video_out_format(&mipp, out_format);
+            break;
+        case ring::QUIT:
+            mipp_free(&mipp);
+            return 0;
+        }
+        channel.release(q);
+    }
+}